@@ -34,17 +34,20 @@ void fz_drop_bitmap(fz_context *ctx, fz_bitmap *bit);
 /*
 	A halftone is a set of threshold tiles, one per component. Each
 	threshold tile is a pixmap, possibly of varying sizes and phases.
-	Currently, we only provide one 'default' halftone tile for operating
-	on 1 component plus alpha pixmaps (where the alpha is ignored). This
-	is signified by an fz_halftone pointer to NULL.
+	The default halftone (signified by an fz_halftone pointer to NULL)
+	uses the same 16x16 screen for every component, at a different
+	phase for each colorant.
 */
 typedef struct fz_halftone_s fz_halftone;
 
 /*
 	fz_halftone_pixmap: Make a bitmap from a pixmap and a halftone.
 
-	pix: The pixmap to generate from. Currently must be a single color
-	component + alpha (where the alpha is assumed to be solid).
+	pix: The pixmap to generate from. Any number of color components
+	plus alpha (where the alpha is assumed to be solid). The bitmap
+	gets one bit per color component, interleaved per pixel. For gray
+	a set bit means black; for other colorspaces a set bit means the
+	colorant is on (so for CMYK, ink).
 
 	ht: The halftone to use. NULL implies the default halftone.
 
@@ -53,6 +56,25 @@ typedef struct fz_halftone_s fz_halftone;
 */
 fz_bitmap *fz_halftone_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht);
 
+/*
+	fz_halftone_pixmap_band: Make a bitmap from one band of a page
+	that is being rendered a band at a time into the same pixmap.
+
+	pix, ht: As for fz_halftone_pixmap.
+
+	band_start: The offset of this band from the top of the page, in
+	pixels. This keeps the phase of the halftone screen continuous
+	from one band to the next.
+
+	bandheight: The number of rows of pix to use (the last band of a
+	page may be shorter than the pixmap). Out of range values mean
+	the whole pixmap.
+
+	Returns a bitmap bandheight rows high. Throws exceptions in the
+	case of failure to allocate.
+*/
+fz_bitmap *fz_halftone_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start, int bandheight);
+
 struct fz_bitmap_s
 {
 	int refs;
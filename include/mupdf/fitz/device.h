@@ -284,6 +284,20 @@ fz_device *fz_new_trace_device(fz_context *ctx);
 */
 fz_device *fz_new_bbox_device(fz_context *ctx, fz_rect *rectp);
 
+/*
+	fz_new_prefetch_device: Create a device that decodes the images
+	on a page into the store, at the resolution that a draw device
+	running the page with the same transform would use, without
+	drawing anything.
+
+	Running the display lists of the next few pages through this
+	device in a worker thread (with a cloned context, as for drawing)
+	means their images are already decoded when they are drawn, for as
+	long as the store holds on to them. Errors decoding an image are
+	ignored; they will be reported when the page is drawn.
+*/
+fz_device *fz_new_prefetch_device(fz_context *ctx);
+
 /*
 	fz_new_test_device: Create a device to test for features.
 
@@ -183,10 +183,21 @@ fz_outline *fz_load_outline(fz_context *ctx, fz_document *doc);
 */
 void fz_layout_document(fz_context *ctx, fz_document *doc, float w, float h, float em);
 
+/*
+	fz_is_document_reflowable: Returns whether the document lays out
+	its pages itself, in which case its page count may only be an
+	estimate until its pages have been loaded.
+*/
+int fz_is_document_reflowable(fz_context *ctx, fz_document *doc);
+
 /*
 	fz_count_pages: Return the number of pages in document
 
 	May return 0 for documents with no pages.
+
+	Reflowable documents lay out their pages as they are loaded, and
+	until then may return an estimate, which is refined as pages
+	are loaded.
 */
 int fz_count_pages(fz_context *ctx, fz_document *doc);
 
@@ -10,7 +10,7 @@
 typedef struct fz_jbig2_globals_s fz_jbig2_globals;
 
 fz_stream *fz_open_copy(fz_context *ctx, fz_stream *chain);
-fz_stream *fz_open_null(fz_context *ctx, fz_stream *chain, int len, int offset);
+fz_stream *fz_open_null(fz_context *ctx, fz_stream *chain, fz_off_t len, fz_off_t offset);
 fz_stream *fz_open_concat(fz_context *ctx, int max, int pad);
 void fz_concat_push(fz_context *ctx, fz_stream *concat, fz_stream *chain); /* Ownership of chain is passed in */
 fz_stream *fz_open_arc4(fz_context *ctx, fz_stream *chain, unsigned char *key, unsigned keylen);
@@ -23,6 +23,26 @@ fz_stream *fz_open_faxd(fz_context *ctx, fz_stream *chain,
 	int k, int end_of_line, int encoded_byte_align,
 	int columns, int rows, int end_of_block, int black_is_1);
 fz_stream *fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits);
+
+/*
+	fz_inflate: Decompress a zlib (or raw deflate, with negative
+	window_bits) stream held entirely in memory, in a single pass,
+	directly into dst. This is considerably faster than reading
+	through fz_open_flated when the whole input is available and the
+	output size is known.
+
+	Returns the number of bytes written to dst. Truncated or corrupt
+	data gives a warning and a short count, as with fz_open_flated.
+*/
+int fz_inflate(fz_context *ctx, unsigned char *dst, int dstlen, unsigned char *src, int srclen, int window_bits);
+
+/*
+	fz_inflate_buffer: As fz_inflate, but decompress into a newly
+	allocated buffer of initial capacity size_hint, growing it as
+	required.
+*/
+fz_buffer *fz_inflate_buffer(fz_context *ctx, unsigned char *src, int srclen, int window_bits, int size_hint);
+
 fz_stream *fz_open_lzwd(fz_context *ctx, fz_stream *chain, int early_change);
 fz_stream *fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, int colors, int bpc);
 fz_stream *fz_open_jbig2d(fz_context *ctx, fz_stream *chain, fz_jbig2_globals *globals);
@@ -20,6 +20,13 @@ typedef struct fz_font_s fz_font;
 
 char *ft_error_string(int err);
 
+/*
+	Glyphs are rasterised using a small pool of FreeType instances,
+	so that several threads can render at once. Each font lazily
+	opens its own face in each instance it is rendered with.
+*/
+#define FZ_FT_RENDER_SLOTS 4
+
 /* forward declaration for circular dependency */
 struct fz_device_s;
 struct fz_display_list_s;
@@ -38,6 +45,11 @@ struct fz_font_s
 	/* origin of font data */
 	fz_buffer *ft_buffer;
 	char *ft_filepath; /* kept for downstream consumers (such as SumatraPDF) */
+	unsigned char *ft_data; /* ... or the memory ft_face was opened from */
+	int ft_size;
+
+	/* copies of ft_face for each render slot, opened on demand */
+	void *ft_render_face[FZ_FT_RENDER_SLOTS];
 
 	fz_matrix t3matrix;
 	void *t3resources;
@@ -13,6 +13,21 @@
 typedef struct fz_function_s fz_function;
 
 void fz_eval_function(fz_context *ctx, fz_function *func, const float *in, int inlen, float *out, int outlen);
+
+/*
+	fz_eval_function_batch: Evaluate a function at count points.
+
+	in: count input vectors of inlen values each, packed together.
+
+	out: count output vectors of outlen values each; successive
+	vectors start outstride floats apart (outstride >= outlen).
+
+	The results are the same as calling fz_eval_function for each
+	point in turn, but functions that support it evaluate the whole
+	batch at once, hoisting per-call setup out of the loop.
+*/
+void fz_eval_function_batch(fz_context *ctx, fz_function *func, int count, const float *in, int inlen, float *out, int outlen, int outstride);
+
 fz_function *fz_keep_function(fz_context *ctx, fz_function *func);
 void fz_drop_function(fz_context *ctx, fz_function *func);
 unsigned int fz_function_size(fz_context *ctx, fz_function *func);
@@ -33,6 +48,8 @@ struct fz_function_s
 	int m;					/* number of input values */
 	int n;					/* number of output values */
 	void (*evaluate)(fz_context *ctx, fz_function *func, const float *in, float *out);
+	/* optional; count points, m inputs packed, n outputs outstride apart */
+	void (*evaluate_batch)(fz_context *ctx, fz_function *func, int count, const float *in, float *out, int outstride);
 #ifndef NDEBUG
 	void (*debug)(fz_context *ctx, fz_function *func);
 #endif
@@ -93,6 +93,22 @@ void fz_output_pcl(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, fz_
 
 void fz_output_pcl_bitmap(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, fz_pcl_options *pcl);
 
+/*
+	Banded output of a monochrome bitmap page as pcl, so that a page
+	need never be held in memory at once.
+
+	fz_output_pcl_bitmap_header starts a page of w x h pixels and
+	returns a context to pass to the calls that follow. Each call to
+	fz_output_pcl_bitmap_band then writes the next band of the page
+	(bitmaps of width w, rows beyond h are ignored), and
+	fz_output_pcl_bitmap_trailer ends the page and frees the context.
+*/
+typedef struct fz_pcl_output_context_s fz_pcl_output_context;
+
+fz_pcl_output_context *fz_output_pcl_bitmap_header(fz_context *ctx, fz_output *out, int w, int h, int xres, int yres, fz_pcl_options *pcl);
+void fz_output_pcl_bitmap_band(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, fz_pcl_output_context *poc);
+void fz_output_pcl_bitmap_trailer(fz_context *ctx, fz_output *out, fz_pcl_output_context *poc);
+
 void fz_write_pcl(fz_context *ctx, fz_pixmap *pixmap, char *filename, int append, fz_pcl_options *pcl);
 
 void fz_write_pcl_bitmap(fz_context *ctx, fz_bitmap *bitmap, char *filename, int append, fz_pcl_options *pcl);
@@ -95,4 +95,28 @@ void fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap
 */
 void fz_output_pwg_bitmap_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, const fz_pwg_options *pwg);
 
+/*
+	Output a page to a pwg stream a band at a time, so that the whole
+	page need never be held in memory.
+
+	fz_output_pwg_page_header writes the page header for a w x h page
+	of n components (including alpha, which is not written). Each call
+	to fz_output_pwg_band then writes band number band (counting from
+	0) of the page; samples holds bandheight rows of w pixels, of which
+	only those falling within the page height h are written.
+*/
+void fz_output_pwg_page_header(fz_context *ctx, fz_output *out, int w, int h, int n, int xres, int yres, const fz_pwg_options *pwg);
+void fz_output_pwg_band(fz_context *ctx, fz_output *out, int w, int h, int n, int band, int bandheight, const unsigned char *samples);
+
+/*
+	Output a bitmap page to a pwg stream a band at a time.
+
+	fz_output_pwg_bitmap_header writes the page header for a w x h
+	page of n colorants (1 for monochrome, 4 for cmyk). Each call to
+	fz_output_pwg_bitmap_band then writes the next bitmap->h rows of
+	the page, such as those from fz_halftone_pixmap_band.
+*/
+void fz_output_pwg_bitmap_header(fz_context *ctx, fz_output *out, int w, int h, int n, int xres, int yres, const fz_pwg_options *pwg);
+void fz_output_pwg_bitmap_band(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap);
+
 #endif
@@ -81,6 +81,11 @@ struct fz_store_hash_s
 			int id;
 			float m[4];
 		} im;
+		struct
+		{
+			void *ptr;
+			float m[4];
+		} pm;
 	} u;
 };
 
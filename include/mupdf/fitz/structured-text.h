@@ -283,4 +283,88 @@ char *fz_copy_selection(fz_context *ctx, fz_text_page *page, fz_rect rect);
 */
 fz_device *fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page);
 
+/*
+	fz_new_text_output_device: Create a device that writes the text on
+	each page to an output stream as it is extracted, without building
+	a text page.
+
+	The output is the same as running a text device and then calling
+	fz_print_text_page, but each span is written as soon as the next
+	one has been placed, so memory use stays flat however much text a
+	page holds. Images are ignored. The last line of a page is written
+	at the end of the page.
+
+	sheet: The text sheet to which styles should be added, as for
+	fz_new_text_device.
+
+	out: The output stream to write UTF-8 text to.
+*/
+fz_device *fz_new_text_output_device(fz_context *ctx, fz_text_sheet *sheet, fz_output *out);
+
+/*
+	Text indexes: a document-wide index of the words of a set of text
+	pages, which can be saved to disk and searched later without
+	interpreting the pages again.
+
+	Words are runs of letters and digits, matched without regard to
+	case. Punctuation, symbols and spaces separate words. Word bboxes
+	are stored rounded outwards to a quarter of a unit.
+
+	NOTE: This is an experimental interface and subject to change without notice.
+*/
+typedef struct fz_text_index_s fz_text_index;
+typedef struct fz_text_index_hit_s fz_text_index_hit;
+
+struct fz_text_index_hit_s
+{
+	int page; /* Page number, as passed to fz_index_text_page */
+	int pos; /* Character offset of the hit within the page, as for fz_text_char_at */
+	fz_rect rect;
+};
+
+/*
+	fz_new_text_index: Create an empty text index to add pages to.
+*/
+fz_text_index *fz_new_text_index(fz_context *ctx);
+
+/*
+	fz_index_text_page: Add the words of a text page to an index.
+
+	Pages may be added in any order, but each page should be added
+	only once. An index is not thread safe; when pages are extracted
+	in several threads, calls to this function must be serialised.
+*/
+void fz_index_text_page(fz_context *ctx, fz_text_index *index, int page_number, fz_text_page *page);
+
+/*
+	fz_save_text_index: Write an index built with fz_index_text_page
+	to a file.
+*/
+void fz_save_text_index(fz_context *ctx, fz_text_index *index, const char *filename);
+
+/*
+	fz_open_text_index: Open a saved index for searching. Only the
+	dictionary of words is read in; the occurrences of each word are
+	read from the file as they are needed.
+*/
+fz_text_index *fz_open_text_index(fz_context *ctx, const char *filename);
+
+/*
+	fz_count_text_index_pages: Return the number of pages covered by
+	an index (one more than the highest page number added).
+*/
+int fz_count_text_index_pages(fz_context *ctx, fz_text_index *index);
+
+/*
+	fz_search_text_index: Search an opened index for a word or a phrase
+	(a sequence of words, which must be consecutive on a page).
+
+	Return the number of hits and store them in the passed in array,
+	in page order. A hit that spans several lines is returned as one
+	hit per line.
+*/
+int fz_search_text_index(fz_context *ctx, fz_text_index *index, const char *needle, fz_text_index_hit *hits, int hit_max);
+
+void fz_drop_text_index(fz_context *ctx, fz_text_index *index);
+
 #endif
@@ -124,6 +124,9 @@ void fz_free_argv(int argc, char **argv);
 
 #endif
 
+/* File offsets and stream positions are 64-bit, so that files larger than 2 GB can be read */
+typedef int64_t fz_off_t;
+
 #ifdef __ANDROID__
 #include <android/log.h>
 #define LOG_TAG "libmupdf"
@@ -176,6 +179,21 @@ void fz_free_argv(int argc, char **argv);
 #endif
 #endif
 
+/*
+	FZ_FORCEINLINE asks the compiler to inline a function even when its
+	own heuristics would not. Used for loop bodies that are instantiated
+	with constant arguments to give specialised loops.
+*/
+#ifdef __GNUC__
+#define FZ_FORCEINLINE __attribute__((always_inline)) inline
+#else
+#ifdef _MSC_VER
+#define FZ_FORCEINLINE __forceinline
+#else
+#define FZ_FORCEINLINE inline
+#endif
+#endif
+
 /*
 	GCC can do type checking of printf strings
 */
@@ -6,8 +6,10 @@
 typedef struct fz_html_font_set_s fz_html_font_set;
 typedef struct fz_html_s fz_html;
 typedef struct fz_html_flow_s fz_html_flow;
+typedef struct fz_html_page_s fz_html_page;
 
 typedef struct fz_css_rule_s fz_css_rule;
+typedef struct fz_css_index_s fz_css_index;
 typedef struct fz_css_match_s fz_css_match;
 typedef struct fz_css_style_s fz_css_style;
 
@@ -38,7 +40,6 @@ struct fz_css_rule_s
 {
 	fz_css_selector *selector;
 	fz_css_property *declaration;
-	fz_css_property *garbage; /* for freeing inline style attributes at the end */
 	fz_css_rule *next;
 };
 
@@ -158,6 +159,11 @@ struct fz_html_s
 	fz_css_style style;
 	int list_item;
 	int is_first_flow; /* for text-indent */
+	int seq; /* position in drawing order */
+	int last_page; /* the last page this box or its contents can be drawn on */
+	int page_count; /* for the root box: the pages it was laid out on */
+	float page_h;
+	fz_html_page *pages;
 };
 
 enum
@@ -171,17 +177,31 @@ struct fz_html_flow_s
 {
 	int type;
 	float x, y, w, h, em;
+	float unit_w; /* width of a word at 1 em, measured once; negative if not yet measured */
 	fz_css_style *style;
 	char *text, *broken_text;
 	fz_image *image;
 	fz_html_flow *next;
 };
 
+/* Where drawing of each page starts and stops, recorded by fz_layout_html */
+struct fz_html_page_s
+{
+	fz_html *start; /* the innermost box whose contents start the page */
+	fz_html_flow *start_flow; /* the first node to draw, if start is a flow box */
+	int start_seq; /* and its position in drawing order */
+	int end; /* nothing after this position is drawn on the page */
+};
+
 fz_css_rule *fz_parse_css(fz_context *ctx, fz_css_rule *chain, const char *source, const char *file);
 fz_css_property *fz_parse_css_properties(fz_context *ctx, const char *source);
+void fz_drop_css_property(fz_context *ctx, fz_css_property *prop);
 void fz_drop_css(fz_context *ctx, fz_css_rule *rule);
 
-void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *rule, fz_xml *node);
+fz_css_index *fz_new_css_index(fz_context *ctx, fz_css_rule *rule);
+void fz_drop_css_index(fz_context *ctx, fz_css_index *index);
+
+void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_index *index, fz_xml *node);
 
 int fz_get_css_match_display(fz_css_match *node);
 void fz_default_css_style(fz_context *ctx, fz_css_style *style);
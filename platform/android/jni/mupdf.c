@@ -384,7 +384,7 @@ static void bufferStreamClose(fz_context *ctx, void *state)
 	fz_free(ctx, state);
 }
 
-static void bufferStreamSeek(fz_context *ctx, fz_stream *stream, int offset, int whence)
+static void bufferStreamSeek(fz_context *ctx, fz_stream *stream, fz_off_t offset, int whence)
 {
 	buffer_state *bs = (buffer_state *)stream->state;
 	globals *glo = bs->globals;
@@ -670,6 +670,9 @@ static void pdfapp_loadpage(pdfapp_t *app, int no_cache)
 		app->page = fz_load_page(app->ctx, app->doc, app->pageno - 1);
 
 		fz_bound_page(app->ctx, app->page, &app->page_bbox);
+
+		/* Reflowable documents refine their page count as they are laid out */
+		app->pagecount = fz_count_pages(app->ctx, app->doc);
 	}
 	fz_catch(app->ctx)
 	{
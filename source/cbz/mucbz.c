@@ -2,6 +2,10 @@
 
 #define DPI 72.0f
 
+/* Decoded images are stored against the image, so the images of recently
+ * loaded pages are kept to be reused when those pages are loaded again. */
+#define IMAGE_CACHE_SIZE 8
+
 typedef struct cbz_document_s cbz_document;
 typedef struct cbz_page_s cbz_page;
 
@@ -23,6 +27,11 @@ struct cbz_document_s
 	fz_archive *zip;
 	int page_count;
 	const char **page;
+	struct {
+		int number;
+		fz_image *image;
+	} image_cache[IMAGE_CACHE_SIZE];
+	int image_cache_next;
 };
 
 static inline int cbz_isdigit(int c)
@@ -103,6 +112,9 @@ cbz_create_page_list(fz_context *ctx, cbz_document *doc)
 static void
 cbz_close_document(fz_context *ctx, cbz_document *doc)
 {
+	int i;
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+		fz_drop_image(ctx, doc->image_cache[i].image);
 	fz_drop_archive(ctx, doc->zip);
 	fz_free(ctx, (char **)doc->page);
 	fz_free(ctx, doc);
@@ -150,36 +162,55 @@ cbz_drop_page_imp(fz_context *ctx, cbz_page *page)
 	fz_drop_image(ctx, page->image);
 }
 
+static fz_image *
+cbz_load_page_image(fz_context *ctx, cbz_document *doc, int number)
+{
+	fz_image *image;
+	fz_buffer *buf;
+	int i;
+
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+		if (doc->image_cache[i].image && doc->image_cache[i].number == number)
+			return fz_keep_image(ctx, doc->image_cache[i].image);
+
+	buf = fz_read_archive_entry(ctx, doc->zip, doc->page[number]);
+	fz_try(ctx)
+		image = fz_new_image_from_buffer(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	i = doc->image_cache_next;
+	doc->image_cache_next = (i + 1) % IMAGE_CACHE_SIZE;
+	fz_drop_image(ctx, doc->image_cache[i].image);
+	doc->image_cache[i].number = number;
+	doc->image_cache[i].image = fz_keep_image(ctx, image);
+
+	return image;
+}
+
 static cbz_page *
 cbz_load_page(fz_context *ctx, cbz_document *doc, int number)
 {
-	unsigned char *data = NULL;
 	cbz_page *page = NULL;
-	fz_buffer *buf;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
-	fz_var(data);
 	fz_var(page);
 
-	buf = fz_read_archive_entry(ctx, doc->zip, doc->page[number]);
 	fz_try(ctx)
 	{
 		page = fz_new_page(ctx, sizeof *page);
 		page->super.bound_page = (fz_page_bound_page_fn *)cbz_bound_page;
 		page->super.run_page_contents = (fz_page_run_page_contents_fn *)cbz_run_page;
 		page->super.drop_page_imp = (fz_page_drop_page_imp_fn *)cbz_drop_page_imp;
-		page->image = fz_new_image_from_buffer(ctx, buf);
-	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, buf);
+		page->image = cbz_load_page_image(ctx, doc, number);
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, data);
-		cbz_drop_page_imp(ctx, page);
+		fz_drop_page(ctx, (fz_page *)page);
 		fz_rethrow(ctx);
 	}
 
@@ -599,14 +599,14 @@ fast_cmyk_to_rgb_ARM(unsigned char *dst, unsigned char *src, int n)
 }
 #endif
 
-static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
+/*
+	Convert n CMYK+alpha pixels to RGB+alpha (or, with ri = 2 and
+	bi = 0, BGR+alpha). Runs of identical pixels are only converted
+	once.
+*/
+static inline void
+cmyk_to_rgb_span(unsigned char * restrict d, const unsigned char * restrict s, int n, int ri, int bi)
 {
-	unsigned char *s = src->samples;
-	unsigned char *d = dst->samples;
-	int n = src->w * src->h;
-#ifdef ARCH_ARM
-	fast_cmyk_to_rgb_ARM(d, s, n);
-#else
 	unsigned int C,M,Y,K,r,g,b;
 
 	C = 0;
@@ -740,52 +740,40 @@ static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 			r = r>>23;
 			g = g>>23;
 			b = b>>23;
-			C = c;
-			M = m;
-			Y = y;
-			K = k;
+			C = s[0];
+			M = s[1];
+			Y = s[2];
+			K = s[3];
 		}
-		d[0] = r;
+		d[ri] = r;
 		d[1] = g;
-		d[2] = b;
+		d[bi] = b;
 #else
-		d[0] = 255 - (unsigned char)fz_mini(s[0] + s[3], 255);
+		d[ri] = 255 - (unsigned char)fz_mini(s[0] + s[3], 255);
 		d[1] = 255 - (unsigned char)fz_mini(s[1] + s[3], 255);
-		d[2] = 255 - (unsigned char)fz_mini(s[2] + s[3], 255);
+		d[bi] = 255 - (unsigned char)fz_mini(s[2] + s[3], 255);
 #endif
 		d[3] = s[4];
 		s += 5;
 		d += 4;
 	}
-#endif
 }
 
-static void fast_cmyk_to_bgr(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
+static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
-	while (n--)
-	{
-#ifdef SLOWCMYK
-		float cmyk[4], rgb[3];
-		cmyk[0] = s[0] / 255.0f;
-		cmyk[1] = s[1] / 255.0f;
-		cmyk[2] = s[2] / 255.0f;
-		cmyk[3] = s[3] / 255.0f;
-		cmyk_to_rgb(ctx, NULL, cmyk, rgb);
-		d[0] = rgb[2] * 255;
-		d[1] = rgb[1] * 255;
-		d[2] = rgb[0] * 255;
+#ifdef ARCH_ARM
+	fast_cmyk_to_rgb_ARM(d, s, n);
 #else
-		d[0] = 255 - (unsigned char)fz_mini(s[2] + s[3], 255);
-		d[1] = 255 - (unsigned char)fz_mini(s[1] + s[3], 255);
-		d[2] = 255 - (unsigned char)fz_mini(s[0] + s[3], 255);
+	cmyk_to_rgb_span(d, s, n, 0, 2);
 #endif
-		d[3] = s[4];
-		s += 5;
-		d += 4;
-	}
+}
+
+static void fast_cmyk_to_bgr(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
+{
+	cmyk_to_rgb_span(dst->samples, src->samples, src->w * src->h, 2, 0);
 }
 
 static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
@@ -975,7 +963,7 @@ fz_convert_pixmap(fz_context *ctx, fz_pixmap *dp, fz_pixmap *sp)
 	{
 		if (ds == fz_default_gray) fast_bgr_to_gray(dp, sp);
 		else if (ds == fz_default_rgb) fast_rgb_to_bgr(dp, sp); /* bgr = rgb here */
-		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(sp, dp);
+		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(dp, sp);
 		else fz_std_conv_pixmap(ctx, dp, sp);
 	}
 
@@ -1276,49 +1264,70 @@ fz_expand_indexed_pixmap(fz_context *ctx, fz_pixmap *src)
 	return dst;
 }
 
+/*
+	The cached color converter memoizes conversions in a fixed size
+	direct mapped table, so that memory use is bounded however many
+	distinct colors pass through it, and nothing is allocated once it
+	has been created. Each slot holds the source color followed by
+	the converted color; a slot is overwritten whenever a different
+	color hashes to it.
+*/
+
+enum { CACHED_COLOR_SLOTS = 1024 };
+
 typedef struct fz_cached_color_converter
 {
 	fz_color_converter base;
-	fz_hash_table *hash;
-
+	int sn, dn;
+	float *slots;
+	unsigned char used[CACHED_COLOR_SLOTS];
 }
 fz_cached_color_converter;
 
+static inline unsigned int
+hash_color(const float *v, int n)
+{
+	unsigned int h = 0, x;
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		memcpy(&x, &v[i], sizeof x);
+		h = (h ^ x) * 0x9e3779b1;
+		h ^= h >> 15;
+	}
+	return h & (CACHED_COLOR_SLOTS - 1);
+}
+
 static void fz_cached_color_convert(fz_context *ctx, fz_color_converter *cc_, float *ds, const float *ss)
 {
 	fz_cached_color_converter *cc = cc_->opaque;
-	void *val = fz_hash_find(ctx, cc->hash, ss);
-	int n = cc->base.ds->n * sizeof(float);
-	fz_color_converter *base_cc = &cc->base;
+	int sn = cc->sn;
+	int dn = cc->dn;
+	unsigned int i = hash_color(ss, sn);
+	float *slot = cc->slots + i * (sn + dn);
 
-	if (val)
+	if (cc->used[i] && !memcmp(slot, ss, sn * sizeof(float)))
 	{
-		memcpy(ds, val, n);
+		memcpy(ds, slot + sn, dn * sizeof(float));
 		return;
 	}
 
-	base_cc->convert(ctx, base_cc, ds, ss);
-	val = fz_malloc(ctx, n);
-	memcpy(val, ds, n);
-	fz_try(ctx)
-	{
-		fz_hash_insert(ctx, cc->hash, ss, val);
-	}
-	fz_catch(ctx)
-	{
-		fz_free(ctx, val);
-	}
+	cc->base.convert(ctx, &cc->base, ds, ss);
+	memcpy(slot, ss, sn * sizeof(float));
+	memcpy(slot + sn, ds, dn * sizeof(float));
+	cc->used[i] = 1;
 }
 
 void fz_init_cached_color_converter(fz_context *ctx, fz_color_converter *cc, fz_colorspace *ds, fz_colorspace *ss)
 {
-	int n = ss->n;
 	fz_cached_color_converter *cached = fz_malloc_struct(ctx, fz_cached_color_converter);
 
 	fz_try(ctx)
 	{
 		fz_lookup_color_converter(ctx, &cached->base, ds, ss);
-		cached->hash = fz_new_hash_table(ctx, 256, n * sizeof(float), -1);
+		cached->sn = ss->n;
+		cached->dn = ds->n;
+		cached->slots = fz_malloc_array(ctx, CACHED_COLOR_SLOTS, (ss->n + ds->n) * sizeof(float));
 		cc->convert = fz_cached_color_convert;
 		cc->ds = ds;
 		cc->ss = ss;
@@ -1326,7 +1335,7 @@ void fz_init_cached_color_converter(fz_context *ctx, fz_color_converter *cc, fz_
 	}
 	fz_catch(ctx)
 	{
-		fz_drop_hash(ctx, cached->hash);
+		fz_free(ctx, cached);
 		fz_rethrow(ctx);
 	}
 }
@@ -1334,7 +1343,6 @@ void fz_init_cached_color_converter(fz_context *ctx, fz_color_converter *cc, fz_
 void fz_fin_cached_color_converter(fz_context *ctx, fz_color_converter *cc_)
 {
 	fz_cached_color_converter *cc;
-	int i, n;
 
 	if (cc_ == NULL)
 		return;
@@ -1343,13 +1351,6 @@ void fz_fin_cached_color_converter(fz_context *ctx, fz_color_converter *cc_)
 		return;
 	cc_->opaque = NULL;
 
-	n = fz_hash_len(ctx, cc->hash);
-	for (i = 0; i < n; i++)
-	{
-		void *v = fz_hash_get_val(ctx, cc->hash, i);
-		if (v)
-			fz_free(ctx, v);
-	}
-	fz_drop_hash(ctx, cc->hash);
+	fz_free(ctx, cc->slots);
 	fz_free(ctx, cc);
 }
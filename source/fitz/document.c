@@ -220,6 +220,12 @@ fz_layout_document(fz_context *ctx, fz_document *doc, float w, float h, float em
 	}
 }
 
+int
+fz_is_document_reflowable(fz_context *ctx, fz_document *doc)
+{
+	return doc && doc->layout;
+}
+
 int
 fz_count_pages(fz_context *ctx, fz_document *doc)
 {
@@ -120,9 +120,30 @@ static inline int fz_exclusion_byte(int b, int s)
 	return b + s - (fz_mul255(b, s)<<1);
 }
 
+static FZ_FORCEINLINE int
+fz_blend_byte(int b, int s, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: return s;
+	case FZ_BLEND_MULTIPLY: return fz_mul255(b, s);
+	case FZ_BLEND_SCREEN: return fz_screen_byte(b, s);
+	case FZ_BLEND_OVERLAY: return fz_overlay_byte(b, s);
+	case FZ_BLEND_DARKEN: return fz_darken_byte(b, s);
+	case FZ_BLEND_LIGHTEN: return fz_lighten_byte(b, s);
+	case FZ_BLEND_COLOR_DODGE: return fz_color_dodge_byte(b, s);
+	case FZ_BLEND_COLOR_BURN: return fz_color_burn_byte(b, s);
+	case FZ_BLEND_HARD_LIGHT: return fz_hard_light_byte(b, s);
+	case FZ_BLEND_SOFT_LIGHT: return fz_soft_light_byte(b, s);
+	case FZ_BLEND_DIFFERENCE: return fz_difference_byte(b, s);
+	case FZ_BLEND_EXCLUSION: return fz_exclusion_byte(b, s);
+	}
+}
+
 /* Non-separable blend modes */
 
-static void
+static inline void
 fz_luminosity_rgb(unsigned char *rd, unsigned char *gd, unsigned char *bd, int rb, int gb, int bb, int rs, int gs, int bs)
 {
 	int delta, scale;
@@ -159,7 +180,7 @@ fz_luminosity_rgb(unsigned char *rd, unsigned char *gd, unsigned char *bd, int r
 	*bd = fz_clampi(b, 0, 255);
 }
 
-static void
+static inline void
 fz_saturation_rgb(unsigned char *rd, unsigned char *gd, unsigned char *bd, int rb, int gb, int bb, int rs, int gs, int bs)
 {
 	int minb, maxb;
@@ -218,13 +239,13 @@ fz_saturation_rgb(unsigned char *rd, unsigned char *gd, unsigned char *bd, int r
 	*bd = fz_clampi(b, 0, 255);
 }
 
-static void
+static inline void
 fz_color_rgb(unsigned char *rr, unsigned char *rg, unsigned char *rb, int br, int bg, int bb, int sr, int sg, int sb)
 {
 	fz_luminosity_rgb(rr, rg, rb, sr, sg, sb, br, bg, bb);
 }
 
-static void
+static inline void
 fz_hue_rgb(unsigned char *rr, unsigned char *rg, unsigned char *rb, int br, int bg, int bb, int sr, int sg, int sb)
 {
 	unsigned char tr, tg, tb;
@@ -232,6 +253,19 @@ fz_hue_rgb(unsigned char *rr, unsigned char *rg, unsigned char *rb, int br, int
 	fz_saturation_rgb(rr, rg, rb, tr, tg, tb, br, bg, bb);
 }
 
+static FZ_FORCEINLINE void
+fz_blend_rgb(unsigned char *rr, unsigned char *rg, unsigned char *rb, int br, int bg, int bb, int sr, int sg, int sb, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_HUE: fz_hue_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb); break;
+	case FZ_BLEND_SATURATION: fz_saturation_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb); break;
+	case FZ_BLEND_COLOR: fz_color_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb); break;
+	case FZ_BLEND_LUMINOSITY: fz_luminosity_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb); break;
+	}
+}
+
 void
 fz_blend_pixel(unsigned char dp[3], unsigned char bp[3], unsigned char sp[3], int blendmode)
 {
@@ -246,30 +280,61 @@ fz_blend_pixel(unsigned char dp[3], unsigned char bp[3], unsigned char sp[3], in
 	}
 	/* separable blend modes */
 	for (k = 0; k < 3; k++)
-	{
-		switch (blendmode)
-		{
-		default:
-		case FZ_BLEND_NORMAL: dp[k] = sp[k]; break;
-		case FZ_BLEND_MULTIPLY: dp[k] = fz_mul255(bp[k], sp[k]); break;
-		case FZ_BLEND_SCREEN: dp[k] = fz_screen_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_OVERLAY: dp[k] = fz_overlay_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_DARKEN: dp[k] = fz_darken_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_LIGHTEN: dp[k] = fz_lighten_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_COLOR_DODGE: dp[k] = fz_color_dodge_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_COLOR_BURN: dp[k] = fz_color_burn_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_HARD_LIGHT: dp[k] = fz_hard_light_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_SOFT_LIGHT: dp[k] = fz_soft_light_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_DIFFERENCE: dp[k] = fz_difference_byte(bp[k], sp[k]); break;
-		case FZ_BLEND_EXCLUSION: dp[k] = fz_exclusion_byte(bp[k], sp[k]); break;
-		}
-	}
+		dp[k] = fz_blend_byte(bp[k], sp[k], blendmode);
 }
 
 /* Blending loops */
 
-void
-fz_blend_separable(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode)
+/*
+	255 * 256 / a, for turning a premultiplied component into a
+	non-premultiplied one without a division per pixel. Entry 0 is 0.
+*/
+static const int fz_inv_alpha[256] =
+{
+	0, 65280, 32640, 21760, 16320, 13056, 10880, 9325,
+	8160, 7253, 6528, 5934, 5440, 5021, 4662, 4352,
+	4080, 3840, 3626, 3435, 3264, 3108, 2967, 2838,
+	2720, 2611, 2510, 2417, 2331, 2251, 2176, 2105,
+	2040, 1978, 1920, 1865, 1813, 1764, 1717, 1673,
+	1632, 1592, 1554, 1518, 1483, 1450, 1419, 1388,
+	1360, 1332, 1305, 1280, 1255, 1231, 1208, 1186,
+	1165, 1145, 1125, 1106, 1088, 1070, 1052, 1036,
+	1020, 1004, 989, 974, 960, 946, 932, 919,
+	906, 894, 882, 870, 858, 847, 836, 826,
+	816, 805, 796, 786, 777, 768, 759, 750,
+	741, 733, 725, 717, 709, 701, 694, 687,
+	680, 672, 666, 659, 652, 646, 640, 633,
+	627, 621, 615, 610, 604, 598, 593, 588,
+	582, 577, 572, 567, 562, 557, 553, 548,
+	544, 539, 535, 530, 526, 522, 518, 514,
+	510, 506, 502, 498, 494, 490, 487, 483,
+	480, 476, 473, 469, 466, 462, 459, 456,
+	453, 450, 447, 444, 441, 438, 435, 432,
+	429, 426, 423, 421, 418, 415, 413, 410,
+	408, 405, 402, 400, 398, 395, 393, 390,
+	388, 386, 384, 381, 379, 377, 375, 373,
+	370, 368, 366, 364, 362, 360, 358, 356,
+	354, 352, 350, 349, 347, 345, 343, 341,
+	340, 338, 336, 334, 333, 331, 329, 328,
+	326, 324, 323, 321, 320, 318, 316, 315,
+	313, 312, 310, 309, 307, 306, 305, 303,
+	302, 300, 299, 298, 296, 295, 294, 292,
+	291, 290, 288, 287, 286, 285, 283, 282,
+	281, 280, 278, 277, 276, 275, 274, 273,
+	272, 270, 269, 268, 267, 266, 265, 264,
+	263, 262, 261, 260, 259, 258, 257, 256,
+};
+
+/*
+	Each loop below is written in terms of a blend mode (and component
+	count) passed as an argument, and is only ever called with constant
+	values for these from a switch in the public entry point. The
+	compiler then produces one specialised loop per blend mode, with no
+	per-pixel switch, that it is free to unroll and vectorise.
+*/
+
+static FZ_FORCEINLINE void
+fz_blend_separable_N(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode)
 {
 	int k;
 	int n1 = n - 1;
@@ -279,32 +344,15 @@ fz_blend_separable(byte * restrict bp, byte * restrict sp, int n, int w, int ble
 		int ba = bp[n1];
 		int saba = fz_mul255(sa, ba);
 
-		/* ugh, division to get non-premul components */
-		int invsa = sa ? 255 * 256 / sa : 0;
-		int invba = ba ? 255 * 256 / ba : 0;
+		/* reciprocal alphas to get non-premul components */
+		int invsa = fz_inv_alpha[sa];
+		int invba = fz_inv_alpha[ba];
 
 		for (k = 0; k < n1; k++)
 		{
 			int sc = (sp[k] * invsa) >> 8;
 			int bc = (bp[k] * invba) >> 8;
-			int rc;
-
-			switch (blendmode)
-			{
-			default:
-			case FZ_BLEND_NORMAL: rc = sc; break;
-			case FZ_BLEND_MULTIPLY: rc = fz_mul255(bc, sc); break;
-			case FZ_BLEND_SCREEN: rc = fz_screen_byte(bc, sc); break;
-			case FZ_BLEND_OVERLAY: rc = fz_overlay_byte(bc, sc); break;
-			case FZ_BLEND_DARKEN: rc = fz_darken_byte(bc, sc); break;
-			case FZ_BLEND_LIGHTEN: rc = fz_lighten_byte(bc, sc); break;
-			case FZ_BLEND_COLOR_DODGE: rc = fz_color_dodge_byte(bc, sc); break;
-			case FZ_BLEND_COLOR_BURN: rc = fz_color_burn_byte(bc, sc); break;
-			case FZ_BLEND_HARD_LIGHT: rc = fz_hard_light_byte(bc, sc); break;
-			case FZ_BLEND_SOFT_LIGHT: rc = fz_soft_light_byte(bc, sc); break;
-			case FZ_BLEND_DIFFERENCE: rc = fz_difference_byte(bc, sc); break;
-			case FZ_BLEND_EXCLUSION: rc = fz_exclusion_byte(bc, sc); break;
-			}
+			int rc = fz_blend_byte(bc, sc, blendmode);
 
 			bp[k] = fz_mul255(255 - sa, bp[k]) + fz_mul255(255 - ba, sp[k]) + fz_mul255(saba, rc);
 		}
@@ -316,8 +364,41 @@ fz_blend_separable(byte * restrict bp, byte * restrict sp, int n, int w, int ble
 	}
 }
 
+static FZ_FORCEINLINE void
+fz_blend_separable_mode(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode)
+{
+	switch (n)
+	{
+	case 2: fz_blend_separable_N(bp, sp, 2, w, blendmode); break;
+	case 4: fz_blend_separable_N(bp, sp, 4, w, blendmode); break;
+	case 5: fz_blend_separable_N(bp, sp, 5, w, blendmode); break;
+	default: fz_blend_separable_N(bp, sp, n, w, blendmode); break;
+	}
+}
+
 void
-fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmode)
+fz_blend_separable(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_NORMAL); break;
+	case FZ_BLEND_MULTIPLY: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_MULTIPLY); break;
+	case FZ_BLEND_SCREEN: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_SCREEN); break;
+	case FZ_BLEND_OVERLAY: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_OVERLAY); break;
+	case FZ_BLEND_DARKEN: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_DARKEN); break;
+	case FZ_BLEND_LIGHTEN: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_LIGHTEN); break;
+	case FZ_BLEND_COLOR_DODGE: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_COLOR_DODGE); break;
+	case FZ_BLEND_COLOR_BURN: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_COLOR_BURN); break;
+	case FZ_BLEND_HARD_LIGHT: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_HARD_LIGHT); break;
+	case FZ_BLEND_SOFT_LIGHT: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_SOFT_LIGHT); break;
+	case FZ_BLEND_DIFFERENCE: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_DIFFERENCE); break;
+	case FZ_BLEND_EXCLUSION: fz_blend_separable_mode(bp, sp, n, w, FZ_BLEND_EXCLUSION); break;
+	}
+}
+
+static FZ_FORCEINLINE void
+fz_blend_nonseparable_N(byte * restrict bp, byte * restrict sp, int w, int blendmode)
 {
 	while (w--)
 	{
@@ -327,9 +408,9 @@ fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmo
 		int ba = bp[3];
 		int saba = fz_mul255(sa, ba);
 
-		/* ugh, division to get non-premul components */
-		int invsa = sa ? 255 * 256 / sa : 0;
-		int invba = ba ? 255 * 256 / ba : 0;
+		/* reciprocal alphas to get non-premul components */
+		int invsa = fz_inv_alpha[sa];
+		int invba = fz_inv_alpha[ba];
 
 		int sr = (sp[0] * invsa) >> 8;
 		int sg = (sp[1] * invsa) >> 8;
@@ -339,22 +420,7 @@ fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmo
 		int bg = (bp[1] * invba) >> 8;
 		int bb = (bp[2] * invba) >> 8;
 
-		switch (blendmode)
-		{
-		default:
-		case FZ_BLEND_HUE:
-			fz_hue_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_SATURATION:
-			fz_saturation_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_COLOR:
-			fz_color_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_LUMINOSITY:
-			fz_luminosity_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		}
+		fz_blend_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb, blendmode);
 
 		bp[0] = fz_mul255(255 - sa, bp[0]) + fz_mul255(255 - ba, sp[0]) + fz_mul255(saba, rr);
 		bp[1] = fz_mul255(255 - sa, bp[1]) + fz_mul255(255 - ba, sp[1]) + fz_mul255(saba, rg);
@@ -366,35 +432,25 @@ fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmo
 	}
 }
 
-static void
-fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode, byte * restrict hp, int alpha)
+void
+fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_HUE: fz_blend_nonseparable_N(bp, sp, w, FZ_BLEND_HUE); break;
+	case FZ_BLEND_SATURATION: fz_blend_nonseparable_N(bp, sp, w, FZ_BLEND_SATURATION); break;
+	case FZ_BLEND_COLOR: fz_blend_nonseparable_N(bp, sp, w, FZ_BLEND_COLOR); break;
+	case FZ_BLEND_LUMINOSITY: fz_blend_nonseparable_N(bp, sp, w, FZ_BLEND_LUMINOSITY); break;
+	}
+}
+
+static FZ_FORCEINLINE void
+fz_blend_separable_nonisolated_N(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode, byte * restrict hp, int alpha)
 {
 	int k;
 	int n1 = n - 1;
 
-	if (alpha == 255 && blendmode == 0)
-	{
-		/* In this case, the uncompositing and the recompositing
-		 * cancel one another out, and it's just a simple copy. */
-		/* FIXME: Maybe we can avoid using the shape plane entirely
-		 * and just copy? */
-		while (w--)
-		{
-			int ha = fz_mul255(*hp++, alpha); /* ha = shape_alpha */
-			/* If ha == 0 then leave everything unchanged */
-			if (ha != 0)
-			{
-				for (k = 0; k < n; k++)
-				{
-					bp[k] = sp[k];
-				}
-			}
-
-			sp += n;
-			bp += n;
-		}
-		return;
-	}
 	while (w--)
 	{
 		int ha = *hp++;
@@ -406,7 +462,7 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 			sa = sp[n1];
 			if (sa == 0)
 				break; /* No change! */
-			invsa = sa ? 255 * 256 / sa : 0;
+			invsa = fz_inv_alpha[sa];
 			ba = bp[n1];
 			if (ba == 0)
 			{
@@ -421,8 +477,8 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 			}
 			bahaa = fz_mul255(ba, haa);
 
-			/* ugh, division to get non-premul components */
-			invba = ba ? 255 * 256 / ba : 0;
+			/* reciprocal alphas to get non-premul components */
+			invba = fz_inv_alpha[ba];
 
 			/* Calculate result_alpha - a combination of the
 			 * background alpha, and 'shape' */
@@ -439,8 +495,8 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 			 * we actually want to calculate:
 			 * sc = (sc-bc)/ha + bc
 			 */
-			invha = ha ? 255 * 256 / ha : 0;
-			invra = ra ? 255 * 256 / ra : 0;
+			invha = fz_inv_alpha[ha];
+			invra = fz_inv_alpha[ra];
 
 			/* sa = the final alpha to blend with - this
 			 * is calculated from the shape + alpha,
@@ -461,22 +517,8 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 				if (sc < 0) sc = 0;
 				if (sc > 255) sc = 255;
 
-				switch (blendmode)
-				{
-				default:
-				case FZ_BLEND_NORMAL: rc = sc; break;
-				case FZ_BLEND_MULTIPLY: rc = fz_mul255(bc, sc); break;
-				case FZ_BLEND_SCREEN: rc = fz_screen_byte(bc, sc); break;
-				case FZ_BLEND_OVERLAY: rc = fz_overlay_byte(bc, sc); break;
-				case FZ_BLEND_DARKEN: rc = fz_darken_byte(bc, sc); break;
-				case FZ_BLEND_LIGHTEN: rc = fz_lighten_byte(bc, sc); break;
-				case FZ_BLEND_COLOR_DODGE: rc = fz_color_dodge_byte(bc, sc); break;
-				case FZ_BLEND_COLOR_BURN: rc = fz_color_burn_byte(bc, sc); break;
-				case FZ_BLEND_HARD_LIGHT: rc = fz_hard_light_byte(bc, sc); break;
-				case FZ_BLEND_SOFT_LIGHT: rc = fz_soft_light_byte(bc, sc); break;
-				case FZ_BLEND_DIFFERENCE: rc = fz_difference_byte(bc, sc); break;
-				case FZ_BLEND_EXCLUSION: rc = fz_exclusion_byte(bc, sc); break;
-				}
+				rc = fz_blend_byte(bc, sc, blendmode);
+
 				/* Composition formula, as given in pdf_reference17.pdf:
 				 * rc = ( 1 - (ha/ra)) * bc + (ha/ra) * ((1-ba)*sc + ba * rc)
 				 */
@@ -493,8 +535,67 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 	}
 }
 
+static FZ_FORCEINLINE void
+fz_blend_separable_nonisolated_mode(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode, byte * restrict hp, int alpha)
+{
+	switch (n)
+	{
+	case 2: fz_blend_separable_nonisolated_N(bp, sp, 2, w, blendmode, hp, alpha); break;
+	case 4: fz_blend_separable_nonisolated_N(bp, sp, 4, w, blendmode, hp, alpha); break;
+	case 5: fz_blend_separable_nonisolated_N(bp, sp, 5, w, blendmode, hp, alpha); break;
+	default: fz_blend_separable_nonisolated_N(bp, sp, n, w, blendmode, hp, alpha); break;
+	}
+}
+
 static void
-fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w, int blendmode, byte * restrict hp, int alpha)
+fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, int w, int blendmode, byte * restrict hp, int alpha)
+{
+	int k;
+
+	if (alpha == 255 && blendmode == 0)
+	{
+		/* In this case, the uncompositing and the recompositing
+		 * cancel one another out, and it's just a simple copy. */
+		/* FIXME: Maybe we can avoid using the shape plane entirely
+		 * and just copy? */
+		while (w--)
+		{
+			int ha = fz_mul255(*hp++, alpha); /* ha = shape_alpha */
+			/* If ha == 0 then leave everything unchanged */
+			if (ha != 0)
+			{
+				for (k = 0; k < n; k++)
+				{
+					bp[k] = sp[k];
+				}
+			}
+
+			sp += n;
+			bp += n;
+		}
+		return;
+	}
+
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_NORMAL, hp, alpha); break;
+	case FZ_BLEND_MULTIPLY: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_MULTIPLY, hp, alpha); break;
+	case FZ_BLEND_SCREEN: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_SCREEN, hp, alpha); break;
+	case FZ_BLEND_OVERLAY: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_OVERLAY, hp, alpha); break;
+	case FZ_BLEND_DARKEN: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_DARKEN, hp, alpha); break;
+	case FZ_BLEND_LIGHTEN: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_LIGHTEN, hp, alpha); break;
+	case FZ_BLEND_COLOR_DODGE: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_COLOR_DODGE, hp, alpha); break;
+	case FZ_BLEND_COLOR_BURN: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_COLOR_BURN, hp, alpha); break;
+	case FZ_BLEND_HARD_LIGHT: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_HARD_LIGHT, hp, alpha); break;
+	case FZ_BLEND_SOFT_LIGHT: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_SOFT_LIGHT, hp, alpha); break;
+	case FZ_BLEND_DIFFERENCE: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_DIFFERENCE, hp, alpha); break;
+	case FZ_BLEND_EXCLUSION: fz_blend_separable_nonisolated_mode(bp, sp, n, w, FZ_BLEND_EXCLUSION, hp, alpha); break;
+	}
+}
+
+static FZ_FORCEINLINE void
+fz_blend_nonseparable_nonisolated_N(byte * restrict bp, byte * restrict sp, int w, int blendmode, byte * restrict hp, int alpha)
 {
 	while (w--)
 	{
@@ -519,13 +620,13 @@ fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w,
 				 * that: sc = (ra.rc - bc)/ha + bc
 				 * Now, the result of the blend was stored in
 				 * src, so: */
-				int invha = ha ? 255 * 256 / ha : 0;
+				int invha = fz_inv_alpha[ha];
 
 				unsigned char rr, rg, rb;
 
-				/* ugh, division to get non-premul components */
-				int invsa = sa ? 255 * 256 / sa : 0;
-				int invba = ba ? 255 * 256 / ba : 0;
+				/* reciprocal alphas to get non-premul components */
+				int invsa = fz_inv_alpha[sa];
+				int invba = fz_inv_alpha[ba];
 
 				int sr = (sp[0] * invsa) >> 8;
 				int sg = (sp[1] * invsa) >> 8;
@@ -540,22 +641,7 @@ fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w,
 				sg = (((sg-bg)*invha)>>8) + bg;
 				sb = (((sb-bb)*invha)>>8) + bb;
 
-				switch (blendmode)
-				{
-				default:
-				case FZ_BLEND_HUE:
-					fz_hue_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_SATURATION:
-					fz_saturation_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_COLOR:
-					fz_color_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_LUMINOSITY:
-					fz_luminosity_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				}
+				fz_blend_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb, blendmode);
 
 				rr = fz_mul255(255 - haa, bp[0]) + fz_mul255(fz_mul255(255 - ba, sr), haa) + fz_mul255(baha, rr);
 				rg = fz_mul255(255 - haa, bp[1]) + fz_mul255(fz_mul255(255 - ba, sg), haa) + fz_mul255(baha, rg);
@@ -571,6 +657,19 @@ fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w,
 	}
 }
 
+static void
+fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w, int blendmode, byte * restrict hp, int alpha)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_HUE: fz_blend_nonseparable_nonisolated_N(bp, sp, w, FZ_BLEND_HUE, hp, alpha); break;
+	case FZ_BLEND_SATURATION: fz_blend_nonseparable_nonisolated_N(bp, sp, w, FZ_BLEND_SATURATION, hp, alpha); break;
+	case FZ_BLEND_COLOR: fz_blend_nonseparable_nonisolated_N(bp, sp, w, FZ_BLEND_COLOR, hp, alpha); break;
+	case FZ_BLEND_LUMINOSITY: fz_blend_nonseparable_nonisolated_N(bp, sp, w, FZ_BLEND_LUMINOSITY, hp, alpha); break;
+	}
+}
+
 void
 fz_blend_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int isolated, fz_pixmap *shape)
 {
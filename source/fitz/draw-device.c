@@ -510,6 +510,90 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, fz_path *path, const
 	}
 }
 
+/*
+ * All the glyphs in a text object share a font and a transform, and
+ * the same few glyphs recur over and over within a span. Remember the
+ * glyphs we have already fetched for the current text object so that
+ * repeats are painted without going back to the shared glyph cache
+ * (and taking its lock, hashing the key, and keeping and dropping the
+ * glyph) every time.
+ */
+
+#define SPAN_GLYPH_SLOTS 64
+
+typedef struct span_glyph_s span_glyph;
+
+struct span_glyph_s
+{
+	int gid;
+	unsigned char e, f;
+	fz_glyph *glyph;
+};
+
+typedef struct span_glyphs_s span_glyphs;
+
+struct span_glyphs_s
+{
+	span_glyph slot[SPAN_GLYPH_SLOTS];
+	fz_glyph *uncached;
+};
+
+static void
+init_span_glyphs(span_glyphs *sg)
+{
+	memset(sg, 0, sizeof *sg);
+}
+
+static void
+drop_span_glyphs(fz_context *ctx, span_glyphs *sg)
+{
+	int i;
+
+	for (i = 0; i < SPAN_GLYPH_SLOTS; i++)
+		fz_drop_glyph(ctx, sg->slot[i].glyph);
+	fz_drop_glyph(ctx, sg->uncached);
+}
+
+/*
+	As fz_render_glyph, but the glyph returned is borrowed from sg, and
+	only remains valid until the next call. The scissor and colorspace
+	must stay the same for all the glyphs looked up in one sg.
+*/
+static fz_glyph *
+render_span_glyph(fz_context *ctx, span_glyphs *sg, fz_font *font, int gid, fz_matrix *trm, fz_colorspace *model, const fz_irect *scissor)
+{
+	fz_matrix subpix_trm;
+	unsigned char qe, qf;
+	span_glyph *slot;
+	fz_glyph *glyph;
+
+	fz_drop_glyph(ctx, sg->uncached);
+	sg->uncached = NULL;
+
+	/* Large glyphs are clipped to the scissor relative to their
+	 * position, so cannot be reused elsewhere on the span. */
+	if (fz_subpixel_adjust(ctx, trm, &subpix_trm, &qe, &qf) > MAX_GLYPH_SIZE)
+	{
+		sg->uncached = fz_render_glyph(ctx, font, gid, trm, model, scissor);
+		return sg->uncached;
+	}
+
+	slot = &sg->slot[(gid ^ (qe >> 2) ^ (qf >> 4)) & (SPAN_GLYPH_SLOTS - 1)];
+	if (slot->glyph && slot->gid == gid && slot->e == qe && slot->f == qf)
+		return slot->glyph;
+
+	glyph = fz_render_glyph(ctx, font, gid, trm, model, scissor);
+	if (glyph)
+	{
+		fz_drop_glyph(ctx, slot->glyph);
+		slot->gid = gid;
+		slot->e = qe;
+		slot->f = qf;
+		slot->glyph = glyph;
+	}
+	return glyph;
+}
+
 static void
 draw_glyph(unsigned char *colorbv, fz_pixmap *dst, fz_glyph *glyph,
 	int xorig, int yorig, const fz_irect *scissor)
@@ -571,6 +655,7 @@ fz_draw_fill_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 	int i, gid;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
+	span_glyphs sg;
 
 	if (state->blendmode & FZ_BLEND_KNOCKOUT)
 		state = fz_knockout_begin(ctx, dev);
@@ -583,51 +668,62 @@ fz_draw_fill_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 
 	tm = text->trm;
 
-	for (i = 0; i < text->len; i++)
+	init_span_glyphs(&sg);
+	fz_try(ctx)
 	{
-		gid = text->items[i].gid;
-		if (gid < 0)
-			continue;
+		for (i = 0; i < text->len; i++)
+		{
+			gid = text->items[i].gid;
+			if (gid < 0)
+				continue;
 
-		tm.e = text->items[i].x;
-		tm.f = text->items[i].y;
-		fz_concat(&trm, &tm, ctm);
+			tm.e = text->items[i].x;
+			tm.f = text->items[i].y;
+			fz_concat(&trm, &tm, ctm);
 
-		glyph = fz_render_glyph(ctx, text->font, gid, &trm, model, &state->scissor);
-		if (glyph)
-		{
-			fz_pixmap *pixmap = glyph->pixmap;
-			int x = floorf(trm.e);
-			int y = floorf(trm.f);
-			if (pixmap == NULL || pixmap->n == 1)
-			{
-				draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
-				if (state->shape)
-					draw_glyph(&shapebv, state->shape, glyph, x, y, &state->scissor);
-			}
-			else
-			{
-				fz_matrix mat;
-				mat.a = pixmap->w; mat.b = mat.c = 0; mat.d = pixmap->h;
-				mat.e = x + pixmap->x; mat.f = y + pixmap->y;
-				fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &mat, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES));
-			}
-			fz_drop_glyph(ctx, glyph);
-		}
-		else
-		{
-			fz_path *path = fz_outline_glyph(ctx, text->font, gid, &tm);
-			if (path)
+			glyph = render_span_glyph(ctx, &sg, text->font, gid, &trm, model, &state->scissor);
+			if (glyph)
 			{
-				fz_draw_fill_path(ctx, devp, path, 0, ctm, colorspace, color, alpha);
-				fz_drop_path(ctx, path);
+				fz_pixmap *pixmap = glyph->pixmap;
+				int x = floorf(trm.e);
+				int y = floorf(trm.f);
+				if (pixmap == NULL || pixmap->n == 1)
+				{
+					draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
+					if (state->shape)
+						draw_glyph(&shapebv, state->shape, glyph, x, y, &state->scissor);
+				}
+				else
+				{
+					fz_matrix mat;
+					mat.a = pixmap->w; mat.b = mat.c = 0; mat.d = pixmap->h;
+					mat.e = x + pixmap->x; mat.f = y + pixmap->y;
+					fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &mat, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES));
+				}
 			}
 			else
 			{
-				fz_warn(ctx, "cannot render glyph");
+				fz_path *path = fz_outline_glyph(ctx, text->font, gid, &tm);
+				if (path)
+				{
+					fz_draw_fill_path(ctx, devp, path, 0, ctm, colorspace, color, alpha);
+					fz_drop_path(ctx, path);
+				}
+				else
+				{
+					fz_warn(ctx, "cannot render glyph");
+				}
 			}
 		}
 	}
+	fz_always(ctx)
+	{
+		drop_span_glyphs(ctx, &sg);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 
 	if (state->blendmode & FZ_BLEND_KNOCKOUT)
 		fz_knockout_end(ctx, dev);
@@ -708,6 +804,7 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 	int i, gid;
 	fz_draw_state *state;
 	fz_colorspace *model;
+	span_glyphs sg;
 
 	/* If accumulate == 0 then this text object is guaranteed complete */
 	/* If accumulate == 1 then this text object is the first (or only) in a sequence */
@@ -731,6 +828,7 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 		bbox = state->scissor;
 	}
 
+	init_span_glyphs(&sg);
 	fz_try(ctx)
 	{
 		if (accumulate == 0 || accumulate == 1)
@@ -777,7 +875,7 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 				tm.f = text->items[i].y;
 				fz_concat(&trm, &tm, ctm);
 
-				glyph = fz_render_glyph(ctx, text->font, gid, &trm, model, &state->scissor);
+				glyph = render_span_glyph(ctx, &sg, text->font, gid, &trm, model, &state->scissor);
 				if (glyph)
 				{
 					int x = (int)trm.e;
@@ -785,7 +883,6 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 					draw_glyph(NULL, mask, glyph, x, y, &bbox);
 					if (state[1].shape)
 						draw_glyph(NULL, state[1].shape, glyph, x, y, &bbox);
-					fz_drop_glyph(ctx, glyph);
 				}
 				else
 				{
@@ -821,6 +918,10 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 			}
 		}
 	}
+	fz_always(ctx)
+	{
+		drop_span_glyphs(ctx, &sg);
+	}
 	fz_catch(ctx)
 	{
 		if (accumulate == 0 || accumulate == 1)
@@ -25,6 +25,13 @@ void fz_flatten_dash_path(fz_context *ctx, fz_gel *gel, fz_path *path, const fz_
 
 fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect *scissor, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 
+/*
+ * Glyphs scaled larger than this are neither cached nor rendered
+ * by FreeType, and are clipped to the scissor when rendered.
+ */
+
+#define MAX_GLYPH_SIZE 256
+
 /*
  * Plotting functions.
  */
@@ -3,6 +3,23 @@
 
 enum { MAXN = 2 + FZ_MAX_COLORS };
 
+/* Called with a constant n, so that each case is unrolled and the
+ * colour steps are kept in registers rather than reloaded per sample. */
+static inline void paint_span(unsigned char *restrict p, int w, int *restrict c, const int *restrict dc, int n)
+{
+	int k;
+
+	while (w--)
+	{
+		for (k = 0; k < n; k++)
+		{
+			*p++ = c[k]>>16;
+			c[k] += dc[k];
+		}
+		*p++ = 255;
+	}
+}
+
 static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0, int cx1, const int *restrict v0, const int *restrict v1, int n)
 {
 	unsigned char *p;
@@ -42,14 +59,12 @@ static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0
 	}
 
 	p = pix->samples + ((x0 - pix->x) + (y - pix->y) * pix->w) * pix->n;
-	while (w--)
+	switch (n)
 	{
-		for (k = 0; k < n; k++)
-		{
-			*p++ = c[k]>>16;
-			c[k] += dc[k];
-		}
-		*p++ = 255;
+	case 1: paint_span(p, w, c, dc, 1); break;
+	case 3: paint_span(p, w, c, dc, 3); break;
+	case 4: paint_span(p, w, c, dc, 4); break;
+	default: paint_span(p, w, c, dc, n); break;
 	}
 }
 
@@ -155,14 +170,212 @@ fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, const fz_irect *bbox)
 	}
 }
 
+/*
+ * Shadings are often drawn repeatedly at the same transform, most of all
+ * when a page is rendered in bands or tiles. Keep the triangles each one
+ * decomposes into, with their colours already converted, in the store so
+ * that later bands need only paint them. The triangles are kept relative
+ * to the translation, so a shading that has only moved (scrolled, or on a
+ * band with a different origin) can reuse them too.
+ */
+
+#define MAX_SHADE_RECORD (4 << 20) /* bytes of triangles worth keeping */
+
+typedef struct shade_key_s shade_key;
+
+struct shade_key_s
+{
+	int refs;
+	fz_shade *shade;
+	float ctm[4];
+};
+
+typedef struct shade_record_s shade_record;
+
+struct shade_record_s
+{
+	fz_storable storable;
+	fz_colorspace *colorspace; /* of the destination */
+	int n; /* floats per vertex */
+	int len, cap; /* in floats */
+	float *verts; /* relative to the translation of the ctm */
+	unsigned char clut[256][FZ_MAX_COLORS];
+};
+
+static int
+fz_make_hash_shade_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	shade_key *key = (shade_key *)key_;
+
+	hash->u.pm.ptr = key->shade;
+	hash->u.pm.m[0] = key->ctm[0];
+	hash->u.pm.m[1] = key->ctm[1];
+	hash->u.pm.m[2] = key->ctm[2];
+	hash->u.pm.m[3] = key->ctm[3];
+	return 1;
+}
+
+static void *
+fz_keep_shade_key(fz_context *ctx, void *key_)
+{
+	shade_key *key = (shade_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_shade_key(fz_context *ctx, void *key_)
+{
+	shade_key *key = (shade_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_shade(ctx, key->shade);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_shade_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	shade_key *k0 = (shade_key *)k0_;
+	shade_key *k1 = (shade_key *)k1_;
+	return k0->shade == k1->shade && k0->ctm[0] == k1->ctm[0] && k0->ctm[1] == k1->ctm[1] && k0->ctm[2] == k1->ctm[2] && k0->ctm[3] == k1->ctm[3];
+}
+
+#ifndef NDEBUG
+static void
+fz_debug_shade_key(fz_context *ctx, FILE *out, void *key_)
+{
+	shade_key *key = (shade_key *)key_;
+	fprintf(out, "(shade type=%d, ctm=%g %g %g %g) ", key->shade->type, key->ctm[0], key->ctm[1], key->ctm[2], key->ctm[3]);
+}
+#endif
+
+static fz_store_type fz_shade_store_type =
+{
+	fz_make_hash_shade_key,
+	fz_keep_shade_key,
+	fz_drop_shade_key,
+	fz_cmp_shade_key,
+#ifndef NDEBUG
+	fz_debug_shade_key
+#endif
+};
+
+static void
+fz_drop_shade_record_imp(fz_context *ctx, fz_storable *storable)
+{
+	shade_record *rec = (shade_record *)storable;
+	fz_drop_colorspace(ctx, rec->colorspace);
+	fz_free(ctx, rec->verts);
+	fz_free(ctx, rec);
+}
+
+static void
+fz_drop_shade_record(fz_context *ctx, shade_record *rec)
+{
+	if (rec)
+		fz_drop_storable(ctx, &rec->storable);
+}
+
+static shade_record *
+fz_find_shade_record(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_colorspace *colorspace)
+{
+	shade_key key;
+	shade_record *rec;
+
+	key.refs = 1;
+	key.shade = shade;
+	key.ctm[0] = ctm->a;
+	key.ctm[1] = ctm->b;
+	key.ctm[2] = ctm->c;
+	key.ctm[3] = ctm->d;
+
+	rec = fz_find_item(ctx, fz_drop_shade_record_imp, &key, &fz_shade_store_type);
+	if (rec && rec->colorspace != colorspace)
+	{
+		/* Same shading drawn into another colorspace; make way for
+		 * the new one. */
+		fz_drop_shade_record(ctx, rec);
+		fz_remove_item(ctx, fz_drop_shade_record_imp, &key, &fz_shade_store_type);
+		rec = NULL;
+	}
+	return rec;
+}
+
+static void
+fz_store_shade_record(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, shade_record *rec)
+{
+	shade_key *key;
+	shade_record *existing;
+
+	key = fz_malloc_struct(ctx, shade_key);
+	key->refs = 1;
+	key->shade = fz_keep_shade(ctx, shade);
+	key->ctm[0] = ctm->a;
+	key->ctm[1] = ctm->b;
+	key->ctm[2] = ctm->c;
+	key->ctm[3] = ctm->d;
+
+	fz_try(ctx)
+	{
+		existing = fz_store_item(ctx, key, rec, sizeof(*rec) + rec->cap * sizeof(float), &fz_shade_store_type);
+		/* If a racing thread got there first, theirs is as good as ours. */
+		fz_drop_shade_record(ctx, existing);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_shade_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		/* Not fatal; we just won't reuse it. */
+		fz_warn(ctx, "cannot cache shading");
+	}
+}
+
 struct paint_tri_data
 {
 	fz_shade *shade;
 	fz_pixmap *dest;
 	const fz_irect *bbox;
 	fz_color_converter cc;
+	shade_record *rec; /* recording triangles for reuse, or NULL */
+	float e, f; /* translation to take off recorded vertices */
 };
 
+static void
+record_tri(fz_context *ctx, struct paint_tri_data *ptd, float *v[3])
+{
+	shade_record *rec = ptd->rec;
+	int n = rec->n;
+	int i;
+
+	if (rec->len + 3 * n > rec->cap)
+	{
+		int cap = fz_maxi(rec->cap * 2, 1024);
+		if (cap * sizeof(float) > MAX_SHADE_RECORD)
+		{
+			/* Too big to be worth keeping. */
+			fz_free(ctx, rec->verts);
+			rec->verts = NULL;
+			rec->len = rec->cap = 0;
+			ptd->rec = NULL;
+			return;
+		}
+		rec->verts = fz_resize_array(ctx, rec->verts, cap, sizeof(float));
+		rec->cap = cap;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		float *p = rec->verts + rec->len;
+		memcpy(p, v[i], n * sizeof(float));
+		p[0] -= ptd->e;
+		p[1] -= ptd->f;
+		rec->len += n;
+	}
+}
+
 static void
 prepare_vertex(fz_context *ctx, void *arg, fz_vertex *v, const float *input)
 {
@@ -195,37 +408,53 @@ do_paint_tri(fz_context *ctx, void *arg, fz_vertex *av, fz_vertex *bv, fz_vertex
 
 	dest = ptd->dest;
 	fz_paint_triangle(dest, vertices, 2 + dest->colorspace->n, ptd->bbox);
+	if (ptd->rec)
+		record_tri(ctx, ptd, vertices);
 }
 
 void
 fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, const fz_irect *bbox)
 {
-	unsigned char clut[256][FZ_MAX_COLORS];
 	fz_pixmap *temp = NULL;
 	fz_pixmap *conv = NULL;
 	float color[FZ_MAX_COLORS];
 	struct paint_tri_data ptd = { 0 };
+	shade_record *rec = NULL;
 	int i, k;
 	fz_matrix local_ctm;
 
 	fz_var(temp);
 	fz_var(conv);
+	fz_var(rec);
 
 	fz_try(ctx)
 	{
 		fz_concat(&local_ctm, &shade->matrix, ctm);
 
-		if (shade->use_function)
+		rec = fz_find_shade_record(ctx, shade, &local_ctm, dest->colorspace);
+		if (!rec)
 		{
-			fz_color_converter cc;
-			fz_lookup_color_converter(ctx, &cc, dest->colorspace, shade->colorspace);
-			for (i = 0; i < 256; i++)
+			rec = fz_malloc_struct(ctx, shade_record);
+			FZ_INIT_STORABLE(rec, 1, fz_drop_shade_record_imp);
+			rec->colorspace = fz_keep_colorspace(ctx, dest->colorspace);
+			rec->n = 2 + (shade->use_function ? 1 : dest->colorspace->n);
+
+			if (shade->use_function)
 			{
-				cc.convert(ctx, &cc, color, shade->function[i]);
-				for (k = 0; k < dest->colorspace->n; k++)
-					clut[i][k] = color[k] * 255;
-				clut[i][k] = shade->function[i][shade->colorspace->n] * 255;
+				fz_color_converter cc;
+				fz_lookup_color_converter(ctx, &cc, dest->colorspace, shade->colorspace);
+				for (i = 0; i < 256; i++)
+				{
+					cc.convert(ctx, &cc, color, shade->function[i]);
+					for (k = 0; k < dest->colorspace->n; k++)
+						rec->clut[i][k] = color[k] * 255;
+					rec->clut[i][k] = shade->function[i][shade->colorspace->n] * 255;
+				}
 			}
+		}
+
+		if (shade->use_function)
+		{
 			conv = fz_new_pixmap_with_bbox(ctx, dest->colorspace, bbox);
 			temp = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), bbox);
 			fz_clear_pixmap(ctx, temp);
@@ -235,12 +464,43 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 			temp = dest;
 		}
 
-		ptd.dest = temp;
-		ptd.shade = shade;
-		ptd.bbox = bbox;
-
-		fz_init_cached_color_converter(ctx, &ptd.cc, temp->colorspace, shade->colorspace);
-		fz_process_mesh(ctx, shade, &local_ctm, &prepare_vertex, &do_paint_tri, &ptd);
+		if (rec->verts)
+		{
+			/* Painted before; just repaint its triangles, moved to
+			 * where the shading is drawn this time. */
+			float buf[3][MAXN];
+			float *v[3];
+			int j;
+			v[0] = buf[0];
+			v[1] = buf[1];
+			v[2] = buf[2];
+			for (i = 0; i < rec->len; i += 3 * rec->n)
+			{
+				for (j = 0; j < 3; j++)
+				{
+					memcpy(buf[j], rec->verts + i + j * rec->n, rec->n * sizeof(float));
+					buf[j][0] += local_ctm.e;
+					buf[j][1] += local_ctm.f;
+				}
+				fz_paint_triangle(temp, v, rec->n, bbox);
+			}
+		}
+		else
+		{
+			ptd.dest = temp;
+			ptd.shade = shade;
+			ptd.bbox = bbox;
+			ptd.rec = rec;
+			ptd.e = local_ctm.e;
+			ptd.f = local_ctm.f;
+
+			fz_init_cached_color_converter(ctx, &ptd.cc, temp->colorspace, shade->colorspace);
+			fz_process_mesh(ctx, shade, &local_ctm, &prepare_vertex, &do_paint_tri, &ptd);
+
+			/* Keep it, unless it was too big to record. */
+			if (ptd.rec)
+				fz_store_shade_record(ctx, shade, &local_ctm, rec);
+		}
 
 		if (shade->use_function)
 		{
@@ -250,9 +510,9 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 			while (len--)
 			{
 				int v = *s++;
-				int a = fz_mul255(*s++, clut[v][conv->n - 1]);
+				int a = fz_mul255(*s++, rec->clut[v][conv->n - 1]);
 				for (k = 0; k < conv->n - 1; k++)
-					*d++ = fz_mul255(clut[v][k], a);
+					*d++ = fz_mul255(rec->clut[v][k], a);
 				*d++ = a;
 			}
 			fz_paint_pixmap(dest, conv, 255);
@@ -263,11 +523,13 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 	fz_always(ctx)
 	{
 		fz_fin_cached_color_converter(ctx, &ptd.cc);
+		fz_drop_shade_record(ctx, rec);
 	}
 	fz_catch(ctx)
 	{
 		fz_drop_pixmap(ctx, conv);
-		fz_drop_pixmap(ctx, temp);
+		if (temp != dest)
+			fz_drop_pixmap(ctx, temp);
 		fz_rethrow(ctx);
 	}
 }
@@ -152,107 +152,25 @@ static const cfd_node cf_2d_decode[] = {
 	{-1,0},{-1,0},{-1,0},{-1,0},{-1,0},{-1,0},{-1,0},{-1,0},{-3,3}
 };
 
-/* bit magic */
+/*
+ * Lines are held as lists of changing elements: the positions at which
+ * the colour changes, starting from an imaginary white pixel at -1. Even
+ * entries start black runs, odd entries start white runs, so the list is
+ * also a run-length description of the black spans of the line. Lookups
+ * of b1 and b2 in the reference line are then a walk along this list
+ * rather than a scan of its bits, and the packed output is only written
+ * once per line.
+ *
+ * The reference line list is terminated by two copies of the line width,
+ * so that looking one element past b1 never runs off the end.
+ */
 
-static inline int getbit(const unsigned char *buf, int x)
+static int
+cmp_run(const void *a_, const void *b_)
 {
-	return ( buf[x >> 3] >> ( 7 - (x & 7) ) ) & 1;
-}
-
-static const unsigned char mask[8] = {
-	0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03, 0x01, 0
-};
-
-static const unsigned char clz[256] = {
-	8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
-	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
-	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-};
-
-static inline int
-find_changing(const unsigned char *line, int x, int w)
-{
-	int a, b, m, W;
-
-	if (!line)
-		return w;
-
-	/* We assume w > 0, -1 <= x < w */
-	if (x < 0)
-	{
-		x = 0;
-		m = 0xFF;
-	}
-	else
-	{
-		/* Mask out the bits we've already used (including the one
-		 * we started from) */
-		m = mask[x & 7];
-	}
-	/* We have 'w' pixels (bits) in line. The last pixel that can be
-	 * safely accessed is the (w-1)th bit of line.
-	 * By taking W = w>>3, we know that the first W bytes of line are
-	 * full, with w&7 stray bits following. */
-	W = w>>3;
-	x >>= 3;
-	a = line[x]; /* Safe as x < w => x <= w-1 => x>>3 <= (w-1)>>3 */
-	b = a ^ (a>>1);
-	b &= m;
-	if (x >= W)
-	{
-		/* Within the last byte already */
-		x = (x<<3) + clz[b];
-		if (x > w)
-			x = w;
-		return x;
-	}
-	while (b == 0)
-	{
-		if (++x >= W)
-			goto nearend;
-		b = a & 1;
-		a = line[x];
-		b = (b<<7) ^ a ^ (a>>1);
-	}
-	return (x<<3) + clz[b];
-nearend:
-	/* We have less than a byte to go. If no stray bits, exit now. */
-	if ((x<<3) == w)
-		return w;
-	b = a&1;
-	a = line[x];
-	b = (b<<7) ^ a ^ (a>>1);
-	x = (x<<3) + clz[b];
-	if (x > w)
-		x = w;
-	return x;
-}
-
-static inline int
-find_changing_color(const unsigned char *line, int x, int w, int color)
-{
-	if (!line || x >= w)
-		return w;
-
-	x = find_changing(line, (x > 0 || !color) ? x : -1, w);
-
-	if (x < w && getbit(line, x) != color)
-		x = find_changing(line, x, w);
-
-	return x;
+	const int *a = a_;
+	const int *b = b_;
+	return a[0] - b[0];
 }
 
 static const unsigned char lm[8] = {
@@ -291,6 +209,34 @@ static inline void setbits(unsigned char *line, int x0, int x1)
 	}
 }
 
+static inline void clearbits(unsigned char *line, int x0, int x1)
+{
+	int a0, a1, b0, b1, a;
+
+	if (x1 <= x0)
+		return;
+
+	a0 = x0 >> 3;
+	a1 = x1 >> 3;
+
+	b0 = x0 & 7;
+	b1 = x1 & 7;
+
+	if (a0 == a1)
+	{
+		if (b1)
+			line[a0] &= ~(lm[b0] & rm[b1]);
+	}
+	else
+	{
+		line[a0] &= ~lm[b0];
+		for (a = a0 + 1; a < a1; a++)
+			line[a] = 0;
+		if (b1)
+			line[a1] &= ~rm[b1];
+	}
+}
+
 typedef struct fz_faxd_s fz_faxd;
 
 enum
@@ -324,7 +270,13 @@ struct fz_faxd_s
 	int stage;
 
 	int a, c, dim, eolc;
-	unsigned char *ref;
+
+	int *ref;	/* changing elements of the reference line */
+	int *cur;	/* changing elements of the line being decoded */
+	int ncur;
+	int tangled;	/* runs in cur are out of order */
+	int rpos;	/* where the last b1 search in ref started */
+
 	unsigned char *dst;
 	unsigned char *rp, *wp;
 
@@ -354,8 +306,8 @@ fill_bits(fz_context *ctx, fz_faxd *fax)
 	return 0;
 }
 
-static int
-get_code(fz_context *ctx, fz_faxd *fax, const cfd_node *table, int initialbits)
+static inline int
+get_code(fz_faxd *fax, const cfd_node *table, int initialbits)
 {
 	unsigned int word = fax->word;
 	int tidx = word >> (32 - initialbits);
@@ -375,8 +327,98 @@ get_code(fz_context *ctx, fz_faxd *fax, const cfd_node *table, int initialbits)
 	return val;
 }
 
-/* decode one 1d code */
+/* Sort and merge the black runs of the current line. Corrupt data can
+ * move a0 backwards, in which case runs arrive out of order or overlap;
+ * the result must be their union, as if each had been painted in turn. */
 static void
+untangle_runs(fz_faxd *fax)
+{
+	int *cur = fax->cur;
+	int i, n = 0;
+
+	qsort(cur, fax->ncur / 2, 2 * sizeof(int), cmp_run);
+	for (i = 0; i < fax->ncur; i += 2)
+	{
+		if (n > 0 && cur[i] <= cur[n-1])
+		{
+			if (cur[i+1] > cur[n-1])
+				cur[n-1] = cur[i+1];
+		}
+		else
+		{
+			cur[n++] = cur[i];
+			cur[n++] = cur[i+1];
+		}
+	}
+	fax->ncur = n;
+	fax->tangled = 0;
+}
+
+/* Add a black run from x0 to x1 to the current line */
+static inline void
+add_run(fz_faxd *fax, int x0, int x1)
+{
+	int *cur = fax->cur;
+	int n = fax->ncur;
+
+	if (x1 <= x0)
+		return;
+
+	if (n > 0 && !fax->tangled && x0 >= cur[n-2] && x0 <= cur[n-1])
+	{
+		/* Touches or overlaps the last run; extend it */
+		if (x1 > cur[n-1])
+			cur[n-1] = x1;
+		return;
+	}
+
+	if (n > 0 && x0 < cur[n-1])
+		fax->tangled = 1;
+
+	/* A merged line has at most columns+1 changing elements, so we
+	 * can only run out of room with tangled runs. */
+	if (fax->tangled && n + 2 > fax->columns + 1)
+	{
+		untangle_runs(fax);
+		n = fax->ncur;
+		fax->tangled = 1;
+	}
+
+	cur[n] = x0;
+	cur[n+1] = x1;
+	fax->ncur = n + 2;
+}
+
+/*
+ * Find b1: the first changing element on the reference line to the right
+ * of a0 with the opposite colour to a0. Returns its index in ref, so that
+ * the following element is b2.
+ */
+static inline int
+find_b1(fz_faxd *fax)
+{
+	int *ref = fax->ref;
+	int x = fax->a;
+	int i = fax->rpos;
+
+	/* At the start of a line a0 sits on the imaginary white pixel */
+	if (x <= 0 && !fax->c)
+		x = -1;
+
+	if (i > 0 && ref[i-1] > x)
+		i = 0;
+	while (ref[i] <= x)
+		i++;
+	fax->rpos = i;
+
+	/* Black runs start at even indices */
+	if ((i & 1) != fax->c)
+		i++;
+	return i;
+}
+
+/* decode one 1d code, returns non-zero on error */
+static int
 dec1d(fz_context *ctx, fz_faxd *fax)
 {
 	int code;
@@ -385,21 +427,30 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 		fax->a = 0;
 
 	if (fax->c)
-		code = get_code(ctx, fax, cf_black_decode, cfd_black_initial_bits);
+		code = get_code(fax, cf_black_decode, cfd_black_initial_bits);
 	else
-		code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
+		code = get_code(fax, cf_white_decode, cfd_white_initial_bits);
 
 	if (code == UNCOMPRESSED)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+	{
+		fz_warn(ctx, "uncompressed data in faxd");
+		return 1;
+	}
 
 	if (code < 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 1d faxd");
+	{
+		fz_warn(ctx, "negative code in 1d faxd");
+		return 1;
+	}
 
 	if (fax->a + code > fax->columns)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 1d faxd");
+	{
+		fz_warn(ctx, "overflow in 1d faxd");
+		return 1;
+	}
 
 	if (fax->c)
-		setbits(fax->dst, fax->a, fax->a + code);
+		add_run(fax, fax->a, fax->a + code);
 
 	fax->a += code;
 
@@ -410,13 +461,15 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 	}
 	else
 		fax->stage = STATE_MAKEUP;
+
+	return 0;
 }
 
-/* decode one 2d code */
-static void
+/* decode one 2d code, returns non-zero on error */
+static int
 dec2d(fz_context *ctx, fz_faxd *fax)
 {
-	int code, b1, b2;
+	int code, i, b1, b2;
 
 	if (fax->stage == STATE_H1 || fax->stage == STATE_H2)
 	{
@@ -424,21 +477,30 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 			fax->a = 0;
 
 		if (fax->c)
-			code = get_code(ctx, fax, cf_black_decode, cfd_black_initial_bits);
+			code = get_code(fax, cf_black_decode, cfd_black_initial_bits);
 		else
-			code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
+			code = get_code(fax, cf_white_decode, cfd_white_initial_bits);
 
 		if (code == UNCOMPRESSED)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+		{
+			fz_warn(ctx, "uncompressed data in faxd");
+			return 1;
+		}
 
 		if (code < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 2d faxd");
+		{
+			fz_warn(ctx, "negative code in 2d faxd");
+			return 1;
+		}
 
 		if (fax->a + code > fax->columns)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 2d faxd");
+		{
+			fz_warn(ctx, "overflow in 2d faxd");
+			return 1;
+		}
 
 		if (fax->c)
-			setbits(fax->dst, fax->a, fax->a + code);
+			add_run(fax, fax->a, fax->a + code);
 
 		fax->a += code;
 
@@ -451,91 +513,97 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 				fax->stage = STATE_NORMAL;
 		}
 
-		return;
+		return 0;
 	}
 
-	code = get_code(ctx, fax, cf_2d_decode, cfd_2d_initial_bits);
+	code = get_code(fax, cf_2d_decode, cfd_2d_initial_bits);
 
-	switch (code)
+	if (code == H)
 	{
-	case H:
 		fax->stage = STATE_H1;
-		break;
-
-	case P:
-		b1 = find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 >= fax->columns)
-			b2 = fax->columns;
-		else
-			b2 = find_changing(fax->ref, b1, fax->columns);
-		if (fax->c) setbits(fax->dst, fax->a, b2);
-		fax->a = b2;
-		break;
-
-	case V0:
-		b1 = find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+		return 0;
+	}
 
-	case VR1:
-		b1 = 1 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 >= fax->columns) b1 = fax->columns;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+	if (code < VR3 || code > VL3)
+	{
+		if (code == UNCOMPRESSED)
+			fz_warn(ctx, "uncompressed data in faxd");
+		else if (code == ERROR)
+			fz_warn(ctx, "invalid code in 2d faxd");
+		else if (code != P)
+			fz_warn(ctx, "invalid code in 2d faxd (%d)", code);
+		if (code != P)
+			return 1;
+	}
 
-	case VR2:
-		b1 = 2 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 >= fax->columns) b1 = fax->columns;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+	if (fax->a >= fax->columns)
+	{
+		i = -1;
+		b1 = fax->columns;
+	}
+	else
+	{
+		i = find_b1(fax);
+		b1 = fax->ref[i];
+	}
 
-	case VR3:
-		b1 = 3 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 >= fax->columns) b1 = fax->columns;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+	if (code == P)
+	{
+		b2 = (b1 >= fax->columns) ? fax->columns : fax->ref[i+1];
+		if (fax->c)
+			add_run(fax, fax->a, b2);
+		fax->a = b2;
+		return 0;
+	}
 
-	case VL1:
-		b1 = -1 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 < 0) b1 = 0;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+	/* Vertical modes: VR3 .. VL3 are 0 .. 6 */
+	b1 += V0 - code;
+	if (b1 >= fax->columns)
+		b1 = fax->columns;
+	if (b1 < 0)
+		b1 = 0;
+	if (fax->c)
+		add_run(fax, fax->a, b1);
+	fax->a = b1;
+	fax->c = !fax->c;
+	return 0;
+}
 
-	case VL2:
-		b1 = -2 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 < 0) b1 = 0;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+/* Write the packed bits for the current line into dst, and make it the
+ * reference line for the next one. */
+static void
+end_line(fz_faxd *fax)
+{
+	unsigned char *dst = fax->dst;
+	int *tmp;
+	int i;
 
-	case VL3:
-		b1 = -3 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
-		if (b1 < 0) b1 = 0;
-		if (fax->c) setbits(fax->dst, fax->a, b1);
-		fax->a = b1;
-		fax->c = !fax->c;
-		break;
+	if (fax->tangled)
+		untangle_runs(fax);
 
-	case UNCOMPRESSED:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+	if (fax->black_is_1)
+	{
+		memset(dst, 0, fax->stride);
+		for (i = 0; i < fax->ncur; i += 2)
+			setbits(dst, fax->cur[i], fax->cur[i+1]);
+	}
+	else
+	{
+		memset(dst, 0xFF, fax->stride);
+		for (i = 0; i < fax->ncur; i += 2)
+			clearbits(dst, fax->cur[i], fax->cur[i+1]);
+	}
 
-	case ERROR:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd");
+	fax->rp = dst;
+	fax->wp = dst + fax->stride;
 
-	default:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd (%d)", code);
-	}
+	tmp = fax->ref;
+	fax->ref = fax->cur;
+	fax->cur = tmp;
+	fax->ref[fax->ncur] = fax->columns;
+	fax->ref[fax->ncur + 1] = fax->columns;
+	fax->ncur = 0;
+	fax->rpos = 0;
 }
 
 static int
@@ -544,7 +612,7 @@ next_faxd(fz_context *ctx, fz_stream *stm, int max)
 	fz_faxd *fax = stm->state;
 	unsigned char *p = fax->buffer;
 	unsigned char *ep;
-	unsigned char *tmp;
+	int n;
 
 	if (max > sizeof(fax->buffer))
 		max = sizeof(fax->buffer);
@@ -569,7 +637,7 @@ next_faxd(fz_context *ctx, fz_stream *stm, int max)
 		return EOF;
 
 	if (fax->stage == STATE_EOL)
-		goto eol;
+		goto copy;
 
 loop:
 
@@ -617,26 +685,14 @@ loop:
 	else if (fax->dim == 1)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec1d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec1d(ctx, fax))
 			goto error;
-		}
 	}
 	else if (fax->dim == 2)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec2d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec2d(ctx, fax))
 			goto error;
-		}
 	}
 
 	/* no eol check after makeup codes nor in the middle of an H code */
@@ -655,18 +711,15 @@ loop:
 	goto loop;
 
 eol:
+	end_line(fax);
+
+copy:
 	fax->stage = STATE_EOL;
 
-	if (fax->black_is_1)
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++;
-	}
-	else
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++ ^ 0xff;
-	}
+	n = fz_mini(fax->wp - fax->rp, ep - p);
+	memcpy(p, fax->rp, n);
+	fax->rp += n;
+	p += n;
 
 	if (fax->rp < fax->wp)
 	{
@@ -678,14 +731,6 @@ eol:
 		return *stm->rp++;
 	}
 
-	tmp = fax->ref;
-	fax->ref = fax->dst;
-	fax->dst = tmp;
-	memset(fax->dst, 0, fax->stride);
-
-	fax->rp = fax->dst;
-	fax->wp = fax->dst + fax->stride;
-
 	fax->stage = STATE_NORMAL;
 	fax->c = 0;
 	fax->a = -1;
@@ -727,16 +772,10 @@ eol:
 
 error:
 	/* decode the remaining pixels up to where the error occurred */
-	if (fax->black_is_1)
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++;
-	}
-	else
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++ ^ 0xff;
-	}
+	end_line(fax);
+	n = fz_mini(fax->wp - fax->rp, ep - p);
+	memcpy(p, fax->rp, n);
+	p += n;
 	/* fallthrough */
 
 rtc:
@@ -762,6 +801,7 @@ close_faxd(fz_context *ctx, void *state_)
 
 	fz_drop_stream(ctx, fax->chain);
 	fz_free(ctx, fax->ref);
+	fz_free(ctx, fax->cur);
 	fz_free(ctx, fax->dst);
 	fz_free(ctx, fax);
 }
@@ -785,6 +825,7 @@ fz_open_faxd(fz_context *ctx, fz_stream *chain,
 		fax->chain = chain;
 
 		fax->ref = NULL;
+		fax->cur = NULL;
 		fax->dst = NULL;
 
 		fax->k = k;
@@ -806,19 +847,25 @@ fz_open_faxd(fz_context *ctx, fz_stream *chain,
 		fax->dim = fax->k < 0 ? 2 : 1;
 		fax->eolc = 0;
 
-		fax->ref = fz_malloc(ctx, fax->stride);
+		/* columns+1 changing elements, plus two terminators */
+		fax->ref = fz_malloc_array(ctx, fax->columns + 3, sizeof(int));
+		fax->cur = fz_malloc_array(ctx, fax->columns + 3, sizeof(int));
 		fax->dst = fz_malloc(ctx, fax->stride);
 		fax->rp = fax->dst;
-		fax->wp = fax->dst + fax->stride;
+		fax->wp = fax->dst;
 
-		memset(fax->ref, 0, fax->stride);
-		memset(fax->dst, 0, fax->stride);
+		fax->ref[0] = fax->columns;
+		fax->ref[1] = fax->columns;
+		fax->ncur = 0;
+		fax->tangled = 0;
+		fax->rpos = 0;
 	}
 	fz_catch(ctx)
 	{
 		if (fax)
 		{
 			fz_free(ctx, fax->dst);
+			fz_free(ctx, fax->cur);
 			fz_free(ctx, fax->ref);
 		}
 		fz_free(ctx, fax);
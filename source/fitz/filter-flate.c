@@ -131,3 +131,123 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 	}
 	return fz_new_stream(ctx, state, next_flated, close_flated);
 }
+
+#define MIN_BOMB (100 << 20)
+
+/*
+	Inflate a complete compressed stream in one call to zlib. When
+	inflate is asked to finish in a single call it decodes straight
+	into the output without maintaining a sliding window, and spends
+	almost all of its time in the inflate_fast loop.
+
+	Corrupt or truncated data ends the output with a warning, keeping
+	what was decoded before it, as reading through the flate filter
+	does.
+
+	Returns 1 if the output buffer filled up before the end of the
+	compressed data, 0 otherwise.
+*/
+static int
+inflate_all(fz_context *ctx, z_streamp zp)
+{
+	int code = inflate(zp, Z_FINISH);
+
+	if (code == Z_STREAM_END)
+		return 0;
+	if (code == Z_BUF_ERROR && zp->avail_out == 0)
+		return 1;
+	if (code == Z_BUF_ERROR)
+		fz_warn(ctx, "premature end of data in flate filter");
+	else if (code == Z_DATA_ERROR)
+		fz_warn(ctx, "ignoring zlib error: %s", zp->msg);
+	else if (code != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: %s", zp->msg);
+	return 0;
+}
+
+static void
+init_inflate(fz_context *ctx, z_streamp zp, unsigned char *src, int srclen, int window_bits)
+{
+	int code;
+
+	memset(zp, 0, sizeof *zp);
+	zp->zalloc = zalloc;
+	zp->zfree = zfree;
+	zp->opaque = ctx;
+	zp->next_in = src;
+	zp->avail_in = srclen;
+
+	code = inflateInit2(zp, window_bits);
+	if (code != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: inflateInit: %s", zp->msg);
+}
+
+int
+fz_inflate(fz_context *ctx, unsigned char *dst, int dstlen, unsigned char *src, int srclen, int window_bits)
+{
+	z_stream z;
+
+	init_inflate(ctx, &z, src, srclen, window_bits);
+
+	fz_try(ctx)
+	{
+		z.next_out = dst;
+		z.avail_out = dstlen;
+		inflate_all(ctx, &z);
+	}
+	fz_always(ctx)
+	{
+		inflateEnd(&z);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return dstlen - z.avail_out;
+}
+
+fz_buffer *
+fz_inflate_buffer(fz_context *ctx, unsigned char *src, int srclen, int window_bits, int size_hint)
+{
+	fz_buffer *buf = NULL;
+	z_stream z;
+	int more;
+
+	init_inflate(ctx, &z, src, srclen, window_bits);
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		if (size_hint < 1024)
+			size_hint = 1024;
+		buf = fz_new_buffer(ctx, size_hint);
+
+		do
+		{
+			if (buf->len == buf->cap)
+			{
+				if (buf->len >= MIN_BOMB && buf->len / 200 > srclen)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "compression bomb detected");
+				fz_grow_buffer(ctx, buf);
+			}
+			z.next_out = buf->data + buf->len;
+			z.avail_out = buf->cap - buf->len;
+			more = inflate_all(ctx, &z);
+			buf->len = buf->cap - z.avail_out;
+		}
+		while (more);
+	}
+	fz_always(ctx)
+	{
+		inflateEnd(&z);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
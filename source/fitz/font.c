@@ -11,6 +11,7 @@
 #define SHEAR 0.36397f
 
 static void fz_drop_freetype(fz_context *ctx);
+static void fz_drop_ft_render_faces(fz_context *ctx, fz_font *font);
 
 static fz_font *
 fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_count)
@@ -135,6 +136,7 @@ fz_drop_font(fz_context *ctx, fz_font *font)
 
 	if (font->ft_face)
 	{
+		fz_drop_ft_render_faces(ctx, font);
 		fz_lock(ctx, FZ_LOCK_FREETYPE);
 		fterr = FT_Done_Face((FT_Face)font->ft_face);
 		fz_unlock(ctx, FZ_LOCK_FREETYPE);
@@ -179,6 +181,8 @@ struct fz_font_context_s {
 	int ctx_refs;
 	FT_Library ftlib;
 	int ftlib_refs;
+	FT_Library render_lib[FZ_FT_RENDER_SLOTS];
+	int render_busy[FZ_FT_RENDER_SLOTS];
 	fz_load_system_font_func load_font;
 	fz_load_system_cjk_font_func load_cjk_font;
 };
@@ -322,6 +326,8 @@ fz_drop_freetype(fz_context *ctx)
 	int fterr;
 	fz_font_context *fct = ctx->font;
 
+	int i;
+
 	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	if (--fct->ftlib_refs == 0)
 	{
@@ -329,6 +335,125 @@ fz_drop_freetype(fz_context *ctx)
 		if (fterr)
 			fz_warn(ctx, "freetype finalizing: %s", ft_error_string(fterr));
 		fct->ftlib = NULL;
+		for (i = 0; i < FZ_FT_RENDER_SLOTS; i++)
+		{
+			if (fct->render_lib[i])
+			{
+				fterr = FT_Done_FreeType(fct->render_lib[i]);
+				if (fterr)
+					fz_warn(ctx, "freetype finalizing: %s", ft_error_string(fterr));
+				fct->render_lib[i] = NULL;
+			}
+		}
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+}
+
+/*
+	Glyph rendering state (char size, transform, and the glyph slot)
+	lives in the FT_Face, so only one thread may render from a face
+	at a time. Rather than serialising all rendering on the freetype
+	lock, each renderer claims one of a few render slots. A slot has
+	its own FT_Library, and each font opens its own face in that
+	library (from the same font data) the first time it is rendered
+	there. Once a slot is claimed its faces are used without holding
+	any lock. Opening and closing faces still happens under the
+	freetype lock, as FreeType requires. If all the slots are busy,
+	we fall back to the shared ft_face under the freetype lock.
+*/
+
+static FT_Face
+new_ft_render_face(fz_context *ctx, fz_font *font, int i)
+{
+	fz_font_context *fct = ctx->font;
+	FT_Face face = NULL;
+	FT_Long index = ((FT_Face)font->ft_face)->face_index;
+	int fterr;
+
+	if (!fct->render_lib[i])
+	{
+		fterr = FT_Init_FreeType(&fct->render_lib[i]);
+		if (fterr)
+		{
+			fct->render_lib[i] = NULL;
+			return NULL;
+		}
+	}
+
+	if (font->ft_data)
+		fterr = FT_New_Memory_Face(fct->render_lib[i], font->ft_data, font->ft_size, index, &face);
+	else if (font->ft_filepath)
+		fterr = FT_New_Face(fct->render_lib[i], font->ft_filepath, index, &face);
+	else
+		return NULL;
+	if (fterr)
+		return NULL;
+	return face;
+}
+
+/* Returns a face to render with. If *slot is -1, the face is the
+ * shared one and the freetype lock is held. */
+static FT_Face
+fz_begin_ft_render(fz_context *ctx, fz_font *font, int *slot)
+{
+	fz_font_context *fct = ctx->font;
+	FT_Face face;
+	int i, free_slot = -1;
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	for (i = 0; i < FZ_FT_RENDER_SLOTS; i++)
+	{
+		if (fct->render_busy[i])
+			continue;
+		if (font->ft_render_face[i])
+			break;
+		if (free_slot < 0)
+			free_slot = i;
+	}
+	if (i == FZ_FT_RENDER_SLOTS)
+	{
+		i = free_slot;
+		if (i < 0 || (font->ft_render_face[i] = new_ft_render_face(ctx, font, i)) == NULL)
+		{
+			*slot = -1;
+			return font->ft_face;
+		}
+	}
+	fct->render_busy[i] = 1;
+	face = font->ft_render_face[i];
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+
+	*slot = i;
+	return face;
+}
+
+static void
+fz_end_ft_render(fz_context *ctx, int slot)
+{
+	if (slot >= 0)
+	{
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		ctx->font->render_busy[slot] = 0;
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+}
+
+static void
+fz_drop_ft_render_faces(fz_context *ctx, fz_font *font)
+{
+	int fterr;
+	int i;
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	for (i = 0; i < FZ_FT_RENDER_SLOTS; i++)
+	{
+		if (font->ft_render_face[i])
+		{
+			fterr = FT_Done_Face((FT_Face)font->ft_render_face[i]);
+			if (fterr)
+				fz_warn(ctx, "freetype finalizing face: %s", ft_error_string(fterr));
+			font->ft_render_face[i] = NULL;
+		}
 	}
 	fz_unlock(ctx, FZ_LOCK_FREETYPE);
 }
@@ -389,6 +514,8 @@ fz_new_font_from_memory(fz_context *ctx, const char *name, unsigned char *data,
 
 	font = fz_new_font(ctx, name, use_glyph_bbox, face->num_glyphs);
 	font->ft_face = face;
+	font->ft_data = data;
+	font->ft_size = len;
 	fz_set_font_bbox(ctx, font,
 		(float) face->bbox.xMin / face->units_per_EM,
 		(float) face->bbox.yMin / face->units_per_EM,
@@ -460,11 +587,11 @@ pixmap_from_ft_bitmap(fz_context *ctx, int left, int top, FT_Bitmap *bitmap)
 		return fz_new_pixmap_from_8bpp_data(ctx, left, top - bitmap->rows, bitmap->width, bitmap->rows, bitmap->buffer + (bitmap->rows-1)*bitmap->pitch, -bitmap->pitch);
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Claims a render slot, and returns with it held */
 static FT_GlyphSlot
-do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
+do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa, int *slot)
 {
-	FT_Face face = font->ft_face;
+	FT_Face face;
 	FT_Matrix m;
 	FT_Vector v;
 	FT_Error fterr;
@@ -492,7 +619,7 @@ do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 	v.x = local_trm.e * 64;
 	v.y = local_trm.f * 64;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	face = fz_begin_ft_render(ctx, font, slot);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 		fz_warn(ctx, "freetype setting character size: %s", ft_error_string(fterr));
@@ -563,12 +690,13 @@ retry_unhinted:
 fz_pixmap *
 fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
+	int ft_slot;
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa, &ft_slot);
 	fz_pixmap *pixmap;
 
 	if (slot == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 		return NULL;
 	}
 
@@ -578,7 +706,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matr
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 	}
 	fz_catch(ctx)
 	{
@@ -588,16 +716,16 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matr
 	return pixmap;
 }
 
-/* The glyph cache lock is always taken when this is called. */
 fz_glyph *
 fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
+	int ft_slot;
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa, &ft_slot);
 	fz_glyph *glyph;
 
 	if (slot == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 		return NULL;
 	}
 
@@ -607,7 +735,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 	}
 	fz_catch(ctx)
 	{
@@ -617,11 +745,11 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 	return glyph;
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Claims a render slot, and returns with it held */
 static FT_Glyph
-do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, fz_stroke_state *state)
+do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, fz_stroke_state *state, int *slot)
 {
-	FT_Face face = font->ft_face;
+	FT_Face face;
 	float expansion = fz_matrix_expansion(ctm);
 	int linewidth = state->linewidth * expansion * 64 / 2;
 	FT_Matrix m;
@@ -644,7 +772,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 	v.x = local_trm.e * 64;
 	v.y = local_trm.f * 64;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	face = fz_begin_ft_render(ctx, font, slot);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 	{
@@ -661,7 +789,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 		return NULL;
 	}
 
-	fterr = FT_Stroker_New(ctx->font->ftlib, &stroker);
+	fterr = FT_Stroker_New(face->glyph->library, &stroker);
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Stroker_New: %s", ft_error_string(fterr));
@@ -717,13 +845,14 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 fz_pixmap *
 fz_render_ft_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, fz_stroke_state *state)
 {
-	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state);
+	int ft_slot;
+	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state, &ft_slot);
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
 	fz_pixmap *pixmap;
 
 	if (bitmap == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 		return NULL;
 	}
 
@@ -734,7 +863,7 @@ fz_render_ft_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const
 	fz_always(ctx)
 	{
 		FT_Done_Glyph(glyph);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 	}
 	fz_catch(ctx)
 	{
@@ -747,13 +876,14 @@ fz_render_ft_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const
 fz_glyph *
 fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, fz_stroke_state *state)
 {
-	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state);
+	int ft_slot;
+	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state, &ft_slot);
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
 	fz_glyph *result;
 
 	if (bitmap == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 		return NULL;
 	}
 
@@ -764,7 +894,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 	fz_always(ctx)
 	{
 		FT_Done_Glyph(glyph);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, ft_slot);
 	}
 	fz_catch(ctx)
 	{
@@ -779,6 +909,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_rect *bounds)
 {
 	FT_Face face = font->ft_face;
 	FT_Error fterr;
+	int slot;
 	FT_BBox cbox;
 	FT_Matrix m;
 	FT_Vector v;
@@ -813,7 +944,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_rect *bounds)
 		ft_flags = FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING;
 	}
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	face = fz_begin_ft_render(ctx, font, &slot);
 	/* Set the char size to scale=face->units_per_EM to effectively give
 	 * us unscaled results. This avoids quantisation. We then apply the
 	 * scale ourselves below. */
@@ -826,7 +957,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_rect *bounds)
 	if (fterr)
 	{
 		fz_warn(ctx, "freetype load glyph (gid %d): %s", gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, slot);
 		bounds->x0 = bounds->x1 = local_trm.e;
 		bounds->y0 = bounds->y1 = local_trm.f;
 		return bounds;
@@ -839,7 +970,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_rect *bounds)
 	}
 
 	FT_Outline_Get_CBox(&face->glyph->outline, &cbox);
-	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	fz_end_ft_render(ctx, slot);
 	bounds->x0 = cbox.xMin * recip;
 	bounds->y0 = cbox.yMin * recip;
 	bounds->x1 = cbox.xMax * recip;
@@ -927,6 +1058,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 	int fterr;
 	fz_matrix local_trm = *trm;
 	int ft_flags;
+	int slot;
 
 	const int scale = face->units_per_EM;
 	const float recip = 1 / (float)scale;
@@ -937,7 +1069,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 	if (font->ft_italic)
 		fz_pre_shear(&local_trm, SHEAR, 0);
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	face = fz_begin_ft_render(ctx, font, &slot);
 
 	if (font->ft_hint)
 	{
@@ -955,7 +1087,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 	if (fterr)
 	{
 		fz_warn(ctx, "freetype load glyph (gid %d): %s", gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, slot);
 		return NULL;
 	}
 
@@ -977,7 +1109,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_end_ft_render(ctx, slot);
 	}
 	fz_catch(ctx)
 	{
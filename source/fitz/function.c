@@ -32,6 +32,25 @@ fz_eval_function(fz_context *ctx, fz_function *func, const float *in, int inlen,
 	}
 }
 
+void
+fz_eval_function_batch(fz_context *ctx, fz_function *func, int count, const float *in, int inlen, float *out, int outlen, int outstride)
+{
+	int i, k;
+
+	if (func->evaluate_batch && inlen == func->m && outlen >= func->n)
+	{
+		func->evaluate_batch(ctx, func, count, in, out, outstride);
+		if (outlen > func->n)
+			for (i = 0; i < count; i++)
+				for (k = func->n; k < outlen; k++)
+					out[i * outstride + k] = 0;
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		fz_eval_function(ctx, func, in + i * inlen, inlen, out + i * outstride, outlen);
+}
+
 fz_function *
 fz_keep_function(fz_context *ctx, fz_function *func)
 {
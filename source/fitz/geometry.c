@@ -485,8 +485,12 @@ fz_transform_rect(fz_rect *restrict r, const fz_matrix *restrict m)
 			r->y0 = r->y1;
 			r->y1 = f;
 		}
-		fz_transform_point(fz_rect_min(r), m);
-		fz_transform_point(fz_rect_max(r), m);
+		s.x = r->x0; s.y = r->y0;
+		t.x = r->x1; t.y = r->y1;
+		fz_transform_point(&s, m);
+		fz_transform_point(&t, m);
+		r->x0 = s.x; r->y0 = s.y;
+		r->x1 = t.x; r->y1 = t.y;
 		return r;
 	}
 
@@ -60,23 +60,44 @@ static unsigned char mono_ht[] =
 	0xF2, 0x72, 0xD2, 0x52, 0xFA, 0x7A, 0xDA, 0x5A, 0xF0, 0x70, 0xD0, 0x50, 0xF8, 0x78, 0xD8, 0x58
 };
 
+/* Screen phases for successive colorants of the default halftone, so that
+ * dots of different colorants do not all fall on top of one another. */
+static const int default_ht_phase[4][2] =
+{
+	{ 0, 0 }, { 8, 0 }, { 0, 8 }, { 8, 8 }
+};
+
 fz_halftone *fz_default_halftone(fz_context *ctx, int num_comps)
 {
 	fz_halftone *ht = fz_new_halftone(ctx, num_comps);
-	assert(num_comps == 1); /* Only support 1 component for now */
-	ht->comp[0] = fz_new_pixmap_with_data(ctx, NULL, 16, 16, mono_ht);
+	int i;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < num_comps; i++)
+		{
+			fz_pixmap *tile = fz_new_pixmap_with_data(ctx, NULL, 16, 16, mono_ht);
+			tile->x = default_ht_phase[i & 3][0] + (i >> 2);
+			tile->y = default_ht_phase[i & 3][1] + (i >> 2) * 4;
+			ht->comp[i] = tile;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_halftone(ctx, ht);
+		fz_rethrow(ctx);
+	}
 	return ht;
 }
 
 /* Finally, code to actually perform halftoning. */
-static void make_ht_line(unsigned char *buf, fz_halftone *ht, int x, int y, int w)
+static void make_ht_line(unsigned char *buf, fz_halftone *ht, int n, int x, int y, int w)
 {
 	/* FIXME: There is a potential optimisation here; in the case where
 	 * the LCM of the halftone tile widths is smaller than w, we could
 	 * form just one 'LCM' run, then copy it repeatedly.
 	 */
-	int k, n;
-	n = ht->n;
+	int k;
 	for (k = 0; k < n; k++)
 	{
 		fz_pixmap *tile = ht->comp[k];
@@ -136,67 +157,165 @@ static void make_ht_line(unsigned char *buf, fz_halftone *ht, int x, int y, int
 	}
 }
 
-/* Inner mono thresholding code */
-static void do_threshold_1(unsigned char *ht_line, unsigned char *pixmap, unsigned char *out, int w)
+/*
+	Inner thresholding code. The contone values and the halftone line
+	are compared 8 output bits at a time without branches, which lets
+	the compiler keep everything in registers (and vectorise where it
+	can).
+
+	For a single gray component a bit is set where the pixel is darker
+	than the threshold (1 = black, as for pbm). For all other pixmaps
+	a bit is set where the colorant value reaches the threshold, so for
+	CMYK and separations 1 means 'ink'.
+*/
+static void do_threshold_1(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w)
+{
+	int h, bit;
+
+	while (w >= 8)
+	{
+		*out++ =
+			((pixmap[0] < ht_line[0]) << 7) |
+			((pixmap[2] < ht_line[1]) << 6) |
+			((pixmap[4] < ht_line[2]) << 5) |
+			((pixmap[6] < ht_line[3]) << 4) |
+			((pixmap[8] < ht_line[4]) << 3) |
+			((pixmap[10] < ht_line[5]) << 2) |
+			((pixmap[12] < ht_line[6]) << 1) |
+			(pixmap[14] < ht_line[7]);
+		pixmap += 16; /* Skip the alpha */
+		ht_line += 8;
+		w -= 8;
+	}
+
+	h = 0;
+	for (bit = 7; w > 0; bit--, w--)
+	{
+		h |= (*pixmap < *ht_line++) << bit;
+		pixmap += 2;
+	}
+	if (bit != 7)
+		*out = h;
+}
+
+static void do_threshold_4(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w)
+{
+	/* 2 pixels of 4 colorants (plus alpha) per output byte */
+	while (w >= 2)
+	{
+		*out++ =
+			((pixmap[0] >= ht_line[0]) << 7) |
+			((pixmap[1] >= ht_line[1]) << 6) |
+			((pixmap[2] >= ht_line[2]) << 5) |
+			((pixmap[3] >= ht_line[3]) << 4) |
+			((pixmap[5] >= ht_line[4]) << 3) |
+			((pixmap[6] >= ht_line[5]) << 2) |
+			((pixmap[7] >= ht_line[6]) << 1) |
+			(pixmap[8] >= ht_line[7]);
+		pixmap += 10;
+		ht_line += 8;
+		w -= 2;
+	}
+
+	if (w)
+		*out =
+			((pixmap[0] >= ht_line[0]) << 7) |
+			((pixmap[1] >= ht_line[1]) << 6) |
+			((pixmap[2] >= ht_line[2]) << 5) |
+			((pixmap[3] >= ht_line[3]) << 4);
+}
+
+static void do_threshold_n(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int n)
 {
-	int bit = 0x80;
 	int h = 0;
+	int bit = 7;
+	int k;
 
-	do
+	while (w--)
 	{
-		if (*pixmap < *ht_line++)
-			h |= bit;
-		pixmap += 2; /* Skip the alpha */
-		bit >>= 1;
-		if (bit == 0)
+		for (k = 0; k < n; k++)
 		{
-			*out++ = h;
-			h = 0;
-			bit = 0x80;
+			h |= (*pixmap++ >= *ht_line++) << bit;
+			if (--bit < 0)
+			{
+				*out++ = h;
+				h = 0;
+				bit = 7;
+			}
 		}
-
+		pixmap++; /* Skip the alpha */
 	}
-	while (--w);
-	if (bit != 0x80)
+	if (bit != 7)
 		*out = h;
 }
 
-fz_bitmap *fz_halftone_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht)
+fz_bitmap *fz_halftone_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start, int bandheight)
 {
-	fz_bitmap *out;
-	unsigned char *ht_line, *o, *p;
+	fz_bitmap *out = NULL;
+	unsigned char *ht_line = NULL;
+	unsigned char *o, *p;
 	int w, h, x, y, n, pstride, ostride;
 	fz_halftone *ht_orig = ht;
 
 	if (!pix)
 		return NULL;
 
-	assert(pix->n == 2); /* Mono + Alpha */
+	if (pix->n < 2)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot halftone a pixmap without color components");
+	if (bandheight < 0 || bandheight > pix->h)
+		bandheight = pix->h;
 
 	n = pix->n-1; /* Remove alpha */
-	if (ht == NULL)
+
+	fz_var(ht);
+	fz_var(ht_line);
+
+	fz_try(ctx)
 	{
-		ht = fz_default_halftone(ctx, n);
+		if (ht == NULL)
+			ht = fz_default_halftone(ctx, n);
+		else if (ht->n < n)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "halftone has too few components (%d) for pixmap (%d)", ht->n, n);
+		ht_line = fz_malloc(ctx, pix->w * n);
+		out = fz_new_bitmap(ctx, pix->w, bandheight, n, pix->xres, pix->yres);
+		o = out->samples;
+		p = pix->samples;
+
+		h = bandheight;
+		x = pix->x;
+		y = pix->y + band_start;
+		w = pix->w;
+		ostride = out->stride;
+		pstride = pix->w * pix->n;
+		while (h--)
+		{
+			make_ht_line(ht_line, ht, n, x, y++, w);
+			if (n == 1)
+				do_threshold_1(ht_line, p, o, w);
+			else if (n == 4)
+				do_threshold_4(ht_line, p, o, w);
+			else
+				do_threshold_n(ht_line, p, o, w, n);
+			o += ostride;
+			p += pstride;
+		}
 	}
-	ht_line = fz_malloc(ctx, pix->w * n);
-	out = fz_new_bitmap(ctx, pix->w, pix->h, n, pix->xres, pix->yres);
-	o = out->samples;
-	p = pix->samples;
-
-	h = pix->h;
-	x = pix->x;
-	y = pix->y;
-	w = pix->w;
-	ostride = out->stride;
-	pstride = pix->w * pix->n;
-	while (h--)
+	fz_always(ctx)
 	{
-		make_ht_line(ht_line, ht, x, y++, w);
-		do_threshold_1(ht_line, p, o, w);
-		o += ostride;
-		p += pstride;
+		fz_free(ctx, ht_line);
+		if (!ht_orig)
+			fz_drop_halftone(ctx, ht);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
 	}
-	if (!ht_orig)
-		fz_drop_halftone(ctx, ht);
 	return out;
 }
+
+fz_bitmap *fz_halftone_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht)
+{
+	if (!pix)
+		return NULL;
+	return fz_halftone_pixmap_band(ctx, pix, ht, 0, pix->h);
+}
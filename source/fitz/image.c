@@ -133,8 +133,82 @@ fz_unblend_masked_tile(fz_context *ctx, fz_pixmap *tile, fz_image *image)
 	fz_drop_pixmap(ctx, mask);
 }
 
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor, int native_l2factor)
+static inline int
+bitcount(int b)
+{
+	static const unsigned char nibble[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	return nibble[b >> 4] + nibble[b & 15];
+}
+
+/*
+	Box filter a packed 1 bit per pixel image straight into a tile of
+	(w+f-1)>>factor by (h+f-1)>>factor pixels, without expanding it to
+	8 bits per pixel first. Each destination value is 255 times the
+	fraction of set (or, if invert, clear) bits in its source block,
+	rounded down exactly as fz_subsample_pixmap would have done on the
+	unpacked tile. Runs of blank bytes are skipped.
+*/
+static void
+subsample_1bpc(fz_context *ctx, fz_pixmap *tile, unsigned char *src, int w, int h, int stride, int factor, int invert)
+{
+	int f = 1<<factor;
+	int nb = (w + 7) >> 3;
+	int last = (0xff << (7 - ((w - 1) & 7))) & 0xff;
+	int alpha = tile->n > 1;
+	unsigned char *d = tile->samples;
+	int *counts;
+	int x, y, i, k;
+
+	counts = fz_malloc_array(ctx, tile->w, sizeof(int));
+
+	for (y = 0; y < h; y += f)
+	{
+		int bh = fz_mini(f, h - y);
+
+		memset(counts, 0, tile->w * sizeof(int));
+		for (k = 0; k < bh; k++)
+		{
+			unsigned char *s = src + (unsigned int)((y + k) * stride);
+			for (i = 0; i < nb; i++)
+			{
+				int b = s[i];
+				if (i == nb - 1)
+					b &= last;
+				if (b == 0)
+					continue;
+				if (factor >= 3)
+					counts[(i << 3) >> factor] += bitcount(b);
+				else
+				{
+					int m = (0xff00 >> f) & 0xff;
+					int xx;
+					for (xx = 0; xx < 8; xx += f, m >>= f)
+						if (b & m)
+							counts[((i << 3) + xx) >> factor] += bitcount(b & m);
+				}
+			}
+		}
+
+		for (x = 0; x < tile->w; x++)
+		{
+			int area = fz_mini(f, w - (x << factor)) * bh;
+			int c = invert ? area - counts[x] : counts[x];
+			*d++ = 255 * c / area;
+			if (alpha)
+				*d++ = 255;
+		}
+	}
+
+	fz_free(ctx, counts);
+}
+
+/*
+	Decode an image either from a stream, or (if stm is NULL) by
+	inflating the image's Flate compressed buffer straight into the
+	sample buffer in a single pass.
+*/
+static fz_pixmap *
+decomp_image(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor, int native_l2factor)
 {
 	fz_pixmap *tile = NULL;
 	int stride, len, i;
@@ -142,20 +216,42 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 	int f = 1<<native_l2factor;
 	int w = (image->w + f-1) >> native_l2factor;
 	int h = (image->h + f-1) >> native_l2factor;
+	int subsample = fz_clampi(l2factor - native_l2factor, 0, 8);
+	int packed = 0;
+
+	/* Bilevel images (fax, JBIG2 and similar scans and masks) that
+	 * are to be subsampled can be filtered straight from the packed
+	 * bits, avoiding a full resolution 8 bit intermediate. */
+	if (subsample > 0 && image->bpc == 1 && image->n == 1 && !indexed && !image->usecolorkey)
+	{
+		if (image->decode[0] == 0 && image->decode[1] == 1)
+			packed = 1;
+		else if (image->decode[0] == 1 && image->decode[1] == 0)
+			packed = 2;
+	}
 
 	fz_var(tile);
 	fz_var(samples);
 
 	fz_try(ctx)
 	{
-		tile = fz_new_pixmap(ctx, image->colorspace, w, h);
+		if (packed)
+		{
+			f = 1<<subsample;
+			tile = fz_new_pixmap(ctx, image->colorspace, (w + f-1) >> subsample, (h + f-1) >> subsample);
+		}
+		else
+			tile = fz_new_pixmap(ctx, image->colorspace, w, h);
 		tile->interpolate = image->interpolate;
 
 		stride = (w * image->n * image->bpc + 7) / 8;
 
 		samples = fz_malloc_array(ctx, h, stride);
 
-		len = fz_read(ctx, stm, samples, h * stride);
+		if (stm)
+			len = fz_read(ctx, stm, samples, h * stride);
+		else
+			len = fz_inflate(ctx, samples, h * stride, image->buffer->buffer->data, image->buffer->buffer->len, 15);
 
 		/* Pad truncated images */
 		if (len < stride * h)
@@ -164,17 +260,25 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 			memset(samples + len, 0, stride * h - len);
 		}
 
-		/* Invert 1-bit image masks */
-		if (image->imagemask)
+		if (packed)
 		{
-			/* 0=opaque and 1=transparent so we need to invert */
-			unsigned char *p = samples;
-			len = h * stride;
-			for (i = 0; i < len; i++)
-				p[i] = ~p[i];
+			/* 0=opaque and 1=transparent for image masks */
+			subsample_1bpc(ctx, tile, samples, w, h, stride, subsample, (packed == 2) != !!image->imagemask);
 		}
+		else
+		{
+			/* Invert 1-bit image masks */
+			if (image->imagemask)
+			{
+				/* 0=opaque and 1=transparent so we need to invert */
+				unsigned char *p = samples;
+				len = h * stride;
+				for (i = 0; i < len; i++)
+					p[i] = ~p[i];
+			}
 
-		fz_unpack_tile(ctx, tile, samples, image->n, image->bpc, stride, indexed);
+			fz_unpack_tile(ctx, tile, samples, image->n, image->bpc, stride, indexed);
+		}
 
 		fz_free(ctx, samples);
 		samples = NULL;
@@ -191,7 +295,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 			fz_drop_pixmap(ctx, tile);
 			tile = conv;
 		}
-		else
+		else if (!packed)
 		{
 			fz_decode_tile(ctx, tile, image->decode);
 		}
@@ -214,16 +318,18 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 	}
 
 	/* Now apply any extra subsampling required */
-	if (l2factor - native_l2factor > 0)
-	{
-		if (l2factor - native_l2factor > 8)
-			l2factor = native_l2factor + 8;
-		fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
-	}
+	if (subsample > 0 && !packed)
+		fz_subsample_pixmap(ctx, tile, subsample);
 
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor, int native_l2factor)
+{
+	return decomp_image(ctx, stm, image, indexed, l2factor, native_l2factor);
+}
+
 void
 fz_drop_image_imp(fz_context *ctx, fz_storable *image_)
 {
@@ -319,6 +425,13 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 		/* fall through */
 
 	default:
+		if (image->buffer->params.type == FZ_IMAGE_FLATE && image->buffer->params.u.flate.predictor <= 1)
+		{
+			indexed = fz_colorspace_is_indexed(ctx, image->colorspace);
+			tile = decomp_image(ctx, NULL, image, indexed, l2factor, 0);
+			break;
+		}
+
 		native_l2factor = l2factor;
 		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &native_l2factor);
 
@@ -589,204 +589,274 @@ mode3compress(unsigned char *out, const unsigned char *in, unsigned char *prev,
 void wind(void)
 {}
 
-void
-fz_output_pcl_bitmap(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, fz_pcl_options *pcl)
+struct fz_pcl_output_context_s
 {
-	unsigned char *data, *out_data;
-	int y, ss, rmask, line_size;
+	fz_pcl_options *pcl;
+	int w, h, yres;
+	int y;
 	int num_blank_lines;
-	int compression = -1;
-	unsigned char *prev_row = NULL;
-	unsigned char *out_row_mode_2 = NULL;
-	unsigned char *out_row_mode_3 = NULL;
-	int out_count;
-	int max_mode_2_size;
-	int max_mode_3_size;
+	int compression;
+	int line_size;
+	unsigned char *prev_row;
+	unsigned char *out_row_mode_2;
+	unsigned char *out_row_mode_3;
+};
 
-	if (!out || !bitmap)
+static void
+drop_pcl_output_context(fz_context *ctx, fz_pcl_output_context *poc)
+{
+	if (!poc)
 		return;
+	fz_free(ctx, poc->prev_row);
+	fz_free(ctx, poc->out_row_mode_2);
+	fz_free(ctx, poc->out_row_mode_3);
+	fz_free(ctx, poc);
+}
 
-	if (pcl->features & HACK__IS_A_OCE9050)
-	{
-		/* Enter HPGL/2 mode, begin plot, Initialise (start plot), Enter PCL mode */
-		fz_puts(ctx, out, "\033%1BBPIN;\033%1A");
-	}
-
-	pcl_header(ctx, out, pcl, 1, bitmap->xres);
+fz_pcl_output_context *
+fz_output_pcl_bitmap_header(fz_context *ctx, fz_output *out, int w, int h, int xres, int yres, fz_pcl_options *pcl)
+{
+	fz_pcl_output_context *poc;
+	int line_size, max_mode_2_size, max_mode_3_size;
 
-	fz_var(prev_row);
-	fz_var(out_row_mode_2);
-	fz_var(out_row_mode_3);
+	if (!out)
+		return NULL;
 
+	poc = fz_malloc_struct(ctx, fz_pcl_output_context);
 	fz_try(ctx)
 	{
-		num_blank_lines = 0;
-		rmask = ~0 << (-bitmap->w & 7);
-		line_size = (bitmap->w + 7)/8;
+		poc->pcl = pcl;
+		poc->w = w;
+		poc->h = h;
+		poc->yres = yres;
+		poc->compression = -1;
+		line_size = poc->line_size = (w + 7)/8;
 		max_mode_2_size = line_size + (line_size/127) + 1;
 		max_mode_3_size = line_size + (line_size/8) + 1;
-		prev_row = fz_calloc(ctx, line_size, sizeof(unsigned char));
-		out_row_mode_2 = fz_calloc(ctx, max_mode_2_size, sizeof(unsigned char));
-		out_row_mode_3 = fz_calloc(ctx, max_mode_3_size, sizeof(unsigned char));
-
-		/* Transfer raster graphics. */
-		data = bitmap->samples;
-		ss = bitmap->stride;
-		for (y = 0; y < bitmap->h; y++, data += ss)
+		poc->prev_row = fz_calloc(ctx, line_size, sizeof(unsigned char));
+		poc->out_row_mode_2 = fz_calloc(ctx, max_mode_2_size, sizeof(unsigned char));
+		poc->out_row_mode_3 = fz_calloc(ctx, max_mode_3_size, sizeof(unsigned char));
+
+		if (pcl->features & HACK__IS_A_OCE9050)
 		{
-			unsigned char *end_data = data + line_size;
+			/* Enter HPGL/2 mode, begin plot, Initialise (start plot), Enter PCL mode */
+			fz_puts(ctx, out, "\033%1BBPIN;\033%1A");
+		}
 
-			if ((end_data[-1] & rmask) == 0)
-			{
+		pcl_header(ctx, out, pcl, 1, xres);
+	}
+	fz_catch(ctx)
+	{
+		drop_pcl_output_context(ctx, poc);
+		fz_rethrow(ctx);
+	}
+
+	return poc;
+}
+
+void
+fz_output_pcl_bitmap_band(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, fz_pcl_output_context *poc)
+{
+	fz_pcl_options *pcl;
+	unsigned char *data, *out_data;
+	int y, ss, rmask, line_size;
+	int out_count;
+
+	if (!out || !bitmap || !poc)
+		return;
+
+	if (bitmap->n != 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bitmap must be monochrome to write as pcl");
+	if (bitmap->w != poc->w)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bitmap band does not match pcl page width");
+
+	pcl = poc->pcl;
+	rmask = ~0 << (-bitmap->w & 7);
+	line_size = poc->line_size;
+
+	/* Transfer raster graphics. */
+	data = bitmap->samples;
+	ss = bitmap->stride;
+	for (y = 0; y < bitmap->h && poc->y < poc->h; y++, poc->y++, data += ss)
+	{
+		unsigned char *end_data = data + line_size;
+
+		if ((end_data[-1] & rmask) == 0)
+		{
+			end_data--;
+			while (end_data > data && end_data[-1] == 0)
 				end_data--;
-				while (end_data > data && end_data[-1] == 0)
-					end_data--;
+		}
+		if (end_data == data)
+		{
+			/* Blank line */
+			poc->num_blank_lines++;
+			continue;
+		}
+		wind();
+
+		/* We've reached a non-blank line. */
+		/* Put out a spacing command if necessary. */
+		if (poc->num_blank_lines == poc->y) {
+			/* We're at the top of a page. */
+			if (pcl->features & PCL_ANY_SPACING)
+			{
+				if (poc->num_blank_lines > 0)
+					fz_printf(ctx, out, "\033*p+%dY", poc->num_blank_lines * poc->yres);
+				/* Start raster graphics. */
+				fz_puts(ctx, out, "\033*r1A");
 			}
-			if (end_data == data)
+			else if (pcl->features & PCL_MODE_3_COMPRESSION)
 			{
-				/* Blank line */
-				num_blank_lines++;
-				continue;
+				/* Start raster graphics. */
+				fz_puts(ctx, out, "\033*r1A");
+				for (; poc->num_blank_lines; poc->num_blank_lines--)
+					fz_puts(ctx, out, "\033*b0W");
 			}
-			wind();
+			else
+			{
+				/* Start raster graphics. */
+				fz_puts(ctx, out, "\033*r1A");
+				for (; poc->num_blank_lines; poc->num_blank_lines--)
+					fz_puts(ctx, out, "\033*bW");
+			}
+		}
 
-			/* We've reached a non-blank line. */
-			/* Put out a spacing command if necessary. */
-			if (num_blank_lines == y) {
-				/* We're at the top of a page. */
-				if (pcl->features & PCL_ANY_SPACING)
+		/* Skip blank lines if any */
+		else if (poc->num_blank_lines != 0)
+		{
+			/* Moving down from current position causes head
+			 * motion on the DeskJet, so if the number of lines
+			 * is small, we're better off printing blanks.
+			 *
+			 * For Canon LBP4i and some others, <ESC>*b<n>Y
+			 * doesn't properly clear the seed row if we are in
+			 * compression mode 3.
+			 */
+			if ((poc->num_blank_lines < MIN_SKIP_LINES && poc->compression != 3) ||
+					!(pcl->features & PCL_ANY_SPACING))
+			{
+				int mode_3ns = ((pcl->features & PCL_MODE_3_COMPRESSION) && !(pcl->features & PCL_ANY_SPACING));
+				if (mode_3ns && poc->compression != 2)
 				{
-					if (num_blank_lines > 0)
-						fz_printf(ctx, out, "\033*p+%dY", num_blank_lines * bitmap->yres);
-					/* Start raster graphics. */
-					fz_puts(ctx, out, "\033*r1A");
+					/* Switch to mode 2 */
+					fz_puts(ctx, out, from3to2);
+					poc->compression = 2;
 				}
-				else if (pcl->features & PCL_MODE_3_COMPRESSION)
+				if (pcl->features & PCL_MODE_3_COMPRESSION)
 				{
-					/* Start raster graphics. */
-					fz_puts(ctx, out, "\033*r1A");
-					for (; num_blank_lines; num_blank_lines--)
+					/* Must clear the seed row. */
+					fz_puts(ctx, out, "\033*b1Y");
+					poc->num_blank_lines--;
+				}
+				if (mode_3ns)
+				{
+					for (; poc->num_blank_lines; poc->num_blank_lines--)
 						fz_puts(ctx, out, "\033*b0W");
 				}
 				else
 				{
-					/* Start raster graphics. */
-					fz_puts(ctx, out, "\033*r1A");
-					for (; num_blank_lines; num_blank_lines--)
+					for (; poc->num_blank_lines; poc->num_blank_lines--)
 						fz_puts(ctx, out, "\033*bW");
 				}
 			}
+			else if (pcl->features & PCL3_SPACING)
+				fz_printf(ctx, out, "\033*p+%dY", poc->num_blank_lines * poc->yres);
+			else
+				fz_printf(ctx, out, "\033*b%dY", poc->num_blank_lines);
+			/* Clear the seed row (only matters for mode 3 compression). */
+			memset(poc->prev_row, 0, line_size);
+		}
+		poc->num_blank_lines = 0;
 
-			/* Skip blank lines if any */
-			else if (num_blank_lines != 0)
-			{
-				/* Moving down from current position causes head
-				 * motion on the DeskJet, so if the number of lines
-				 * is small, we're better off printing blanks.
-				 *
-				 * For Canon LBP4i and some others, <ESC>*b<n>Y
-				 * doesn't properly clear the seed row if we are in
-				 * compression mode 3.
-				 */
-				if ((num_blank_lines < MIN_SKIP_LINES && compression != 3) ||
-						!(pcl->features & PCL_ANY_SPACING))
-				{
-					int mode_3ns = ((pcl->features & PCL_MODE_3_COMPRESSION) && !(pcl->features & PCL_ANY_SPACING));
-					if (mode_3ns && compression != 2)
-					{
-						/* Switch to mode 2 */
-						fz_puts(ctx, out, from3to2);
-						compression = 2;
-					}
-					if (pcl->features & PCL_MODE_3_COMPRESSION)
-					{
-						/* Must clear the seed row. */
-						fz_puts(ctx, out, "\033*b1Y");
-						num_blank_lines--;
-					}
-					if (mode_3ns)
-					{
-						for (; num_blank_lines; num_blank_lines--)
-							fz_puts(ctx, out, "\033*b0W");
-					}
-					else
-					{
-						for (; num_blank_lines; num_blank_lines--)
-							fz_puts(ctx, out, "\033*bW");
-					}
-				}
-				else if (pcl->features & PCL3_SPACING)
-					fz_printf(ctx, out, "\033*p+%dY", num_blank_lines * bitmap->yres);
-				else
-					fz_printf(ctx, out, "\033*b%dY", num_blank_lines);
-				/* Clear the seed row (only matters for mode 3 compression). */
-				memset(prev_row, 0, line_size);
-			}
-			num_blank_lines = 0;
-
-			/* Choose the best compression mode for this particular line. */
-			if (pcl->features & PCL_MODE_3_COMPRESSION)
-			{
-				/* Compression modes 2 and 3 are both available. Try
-				 * both and see which produces the least output data.
-				 */
-				int count3 = mode3compress(out_row_mode_3, data, prev_row, line_size);
-				int count2 = mode2compress(out_row_mode_2, data, line_size);
-				int penalty3 = (compression == 3 ? 0 : penalty_from2to3);
-				int penalty2 = (compression == 2 ? 0 : penalty_from3to2);
-
-				if (count3 + penalty3 < count2 + penalty2)
-				{
-					if (compression != 3)
-						fz_puts(ctx, out, from2to3);
-					compression = 3;
-					out_data = (unsigned char *)out_row_mode_3;
-					out_count = count3;
-				}
-				else
-				{
-					if (compression != 2)
-						fz_puts(ctx, out, from3to2);
-					compression = 2;
-					out_data = (unsigned char *)out_row_mode_2;
-					out_count = count2;
-				}
-			}
-			else if (pcl->features & PCL_MODE_2_COMPRESSION)
+		/* Choose the best compression mode for this particular line. */
+		if (pcl->features & PCL_MODE_3_COMPRESSION)
+		{
+			/* Compression modes 2 and 3 are both available. Try
+			 * both and see which produces the least output data.
+			 */
+			int count3 = mode3compress(poc->out_row_mode_3, data, poc->prev_row, line_size);
+			int count2 = mode2compress(poc->out_row_mode_2, data, line_size);
+			int penalty3 = (poc->compression == 3 ? 0 : penalty_from2to3);
+			int penalty2 = (poc->compression == 2 ? 0 : penalty_from3to2);
+
+			if (count3 + penalty3 < count2 + penalty2)
 			{
-				out_data = out_row_mode_2;
-				out_count = mode2compress(out_row_mode_2, data, line_size);
+				if (poc->compression != 3)
+					fz_puts(ctx, out, from2to3);
+				poc->compression = 3;
+				out_data = poc->out_row_mode_3;
+				out_count = count3;
 			}
 			else
 			{
-				out_data = data;
-				out_count = line_size;
+				if (poc->compression != 2)
+					fz_puts(ctx, out, from3to2);
+				poc->compression = 2;
+				out_data = poc->out_row_mode_2;
+				out_count = count2;
 			}
-
-			/* Transfer the data */
-			fz_printf(ctx, out, "\033*b%dW", out_count);
-			fz_write(ctx, out, out_data, out_count);
 		}
-
-		/* end raster graphics and eject page */
-		fz_puts(ctx, out, "\033*rB\f");
-
-		if (pcl->features & HACK__IS_A_OCE9050)
+		else if (pcl->features & PCL_MODE_2_COMPRESSION)
+		{
+			out_data = poc->out_row_mode_2;
+			out_count = mode2compress(poc->out_row_mode_2, data, line_size);
+		}
+		else
 		{
-			/* Pen up, pen select, advance full page, reset */
-			fz_puts(ctx, out, "\033%1BPUSP0PG;\033E");
+			out_data = data;
+			out_count = line_size;
 		}
+
+		/* Transfer the data */
+		fz_printf(ctx, out, "\033*b%dW", out_count);
+		fz_write(ctx, out, out_data, out_count);
 	}
-	fz_always(ctx)
+}
+
+void
+fz_output_pcl_bitmap_trailer(fz_context *ctx, fz_output *out, fz_pcl_output_context *poc)
+{
+	fz_pcl_options *pcl;
+
+	if (!out || !poc)
+		return;
+
+	pcl = poc->pcl;
+	drop_pcl_output_context(ctx, poc);
+
+	/* end raster graphics and eject page */
+	fz_puts(ctx, out, "\033*rB\f");
+
+	if (pcl->features & HACK__IS_A_OCE9050)
+	{
+		/* Pen up, pen select, advance full page, reset */
+		fz_puts(ctx, out, "\033%1BPUSP0PG;\033E");
+	}
+}
+
+void
+fz_output_pcl_bitmap(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, fz_pcl_options *pcl)
+{
+	fz_pcl_output_context *poc;
+
+	if (!out || !bitmap)
+		return;
+
+	if (bitmap->n != 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bitmap must be monochrome to write as pcl");
+
+	poc = fz_output_pcl_bitmap_header(ctx, out, bitmap->w, bitmap->h, bitmap->xres, bitmap->yres, pcl);
+	fz_try(ctx)
 	{
-		fz_free(ctx, prev_row);
-		fz_free(ctx, out_row_mode_2);
-		fz_free(ctx, out_row_mode_3);
+		fz_output_pcl_bitmap_band(ctx, out, bitmap, poc);
 	}
 	fz_catch(ctx)
 	{
+		drop_pcl_output_context(ctx, poc);
 		fz_rethrow(ctx);
 	}
+	fz_output_pcl_bitmap_trailer(ctx, out, poc);
 }
 
 void
@@ -13,7 +13,7 @@ static void
 output_header(fz_context *ctx, fz_output *out, const fz_pwg_options *pwg, int xres, int yres, int w, int h, int bpp)
 {
 	static const char zero[64] = { 0 };
-	int i;
+	int i, ncolors;
 
 	/* Page Header: */
 	fz_write(ctx, out, pwg ? pwg->media_class : zero, 64);
@@ -60,17 +60,18 @@ output_header(fz_context *ctx, fz_output *out, const fz_pwg_options *pwg, int xr
 	fz_write_int32be(ctx, out, 0); /* Chunky pixels */
 	switch (bpp)
 	{
-	case 1: fz_write_int32be(ctx, out, 3); /* Black */ break;
-	case 8: fz_write_int32be(ctx, out, 18); /* Sgray */ break;
-	case 24: fz_write_int32be(ctx, out, 19); /* Srgb */ break;
-	case 32: fz_write_int32be(ctx, out, 6); /* Cmyk */ break;
-	default: fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap bpp must be 1, 8, 24 or 32 to write as pwg");
+	case 1: fz_write_int32be(ctx, out, 3); /* Black */ ncolors = 1; break;
+	case 4: fz_write_int32be(ctx, out, 6); /* Cmyk, 1 bit per color */ ncolors = 4; break;
+	case 8: fz_write_int32be(ctx, out, 18); /* Sgray */ ncolors = 1; break;
+	case 24: fz_write_int32be(ctx, out, 19); /* Srgb */ ncolors = 3; break;
+	case 32: fz_write_int32be(ctx, out, 6); /* Cmyk */ ncolors = 4; break;
+	default: fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap bpp must be 1, 4, 8, 24 or 32 to write as pwg");
 	}
 	fz_write_int32be(ctx, out, pwg ? pwg->compression : 0);
 	fz_write_int32be(ctx, out, pwg ? pwg->row_count : 0);
 	fz_write_int32be(ctx, out, pwg ? pwg->row_feed : 0);
 	fz_write_int32be(ctx, out, pwg ? pwg->row_step : 0);
-	fz_write_int32be(ctx, out, bpp <= 8 ? 1 : 3); /* Num Colors */
+	fz_write_int32be(ctx, out, ncolors); /* Num Colors */
 	for (i=424; i < 452; i += 4)
 		fz_write(ctx, out, zero, 4);
 	fz_write_int32be(ctx, out, 1); /* TotalPageCount */
@@ -87,36 +88,49 @@ output_header(fz_context *ctx, fz_output *out, const fz_pwg_options *pwg, int xr
 }
 
 void
-fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_pwg_options *pwg)
+fz_output_pwg_page_header(fz_context *ctx, fz_output *out, int w, int h, int n, int xres, int yres, const fz_pwg_options *pwg)
 {
-	unsigned char *sp;
+	if (!out)
+		return;
+
+	if (n != 1 && n != 2 && n != 4 && n != 5)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap must be grayscale, rgb or cmyk to write as pwg");
+
+	output_header(ctx, out, pwg, xres, yres, w, h, (n > 1 ? n-1 : 1) * 8);
+}
+
+void
+fz_output_pwg_band(fz_context *ctx, fz_output *out, int w, int h, int n, int band, int bandheight, const unsigned char *samples)
+{
+	const unsigned char *sp;
 	int y, x, sn, dn, ss;
+	int finalband = (band+1)*bandheight >= h;
 
-	if (!out || !pixmap)
+	if (!out || !samples)
 		return;
 
-	if (pixmap->n != 1 && pixmap->n != 2 && pixmap->n != 4 && pixmap->n != 5)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap must be grayscale, rgb or cmyk to write as pwg");
+	if (finalband)
+		h -= band * bandheight;
+	else
+		h = bandheight;
 
-	sn = pixmap->n;
-	dn = pixmap->n;
+	sn = n;
+	dn = n;
 	if (dn > 1)
 		dn--;
 
-	output_header(ctx, out, pwg, pixmap->xres, pixmap->yres, pixmap->w, pixmap->h, dn*8);
-
 	/* Now output the actual bitmap, using a packbits like compression */
-	sp = pixmap->samples;
-	ss = pixmap->w * sn;
+	sp = samples;
+	ss = w * sn;
 	y = 0;
-	while (y < pixmap->h)
+	while (y < h)
 	{
 		int yrep;
 
-		assert(sp == pixmap->samples + y * ss);
+		assert(sp == samples + y * ss);
 
 		/* Count the number of times this line is repeated */
-		for (yrep = 1; yrep < 256 && y+yrep < pixmap->h; yrep++)
+		for (yrep = 1; yrep < 256 && y+yrep < h; yrep++)
 		{
 			if (memcmp(sp, sp + yrep * ss, ss) != 0)
 				break;
@@ -125,14 +139,14 @@ fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, con
 
 		/* Encode the line */
 		x = 0;
-		while (x < pixmap->w)
+		while (x < w)
 		{
 			int d;
 
-			assert(sp == pixmap->samples + y * ss + x * sn);
+			assert(sp == samples + y * ss + x * sn);
 
 			/* How far do we have to look to find a repeated value? */
-			for (d = 1; d < 128 && x+d < pixmap->w; d++)
+			for (d = 1; d < 128 && x+d < w; d++)
 			{
 				if (memcmp(sp + (d-1)*sn, sp + d*sn, sn) == 0)
 					break;
@@ -144,7 +158,7 @@ fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, con
 				/* We immediately have a repeat (or we've hit
 				 * the end of the line). Count the number of
 				 * times this value is repeated. */
-				for (xrep = 1; xrep < 128 && x+xrep < pixmap->w; xrep++)
+				for (xrep = 1; xrep < 128 && x+xrep < w; xrep++)
 				{
 					if (memcmp(sp, sp + xrep*sn, sn) != 0)
 						break;
@@ -174,7 +188,29 @@ fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, con
 }
 
 void
-fz_output_pwg_bitmap_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, const fz_pwg_options *pwg)
+fz_output_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_pwg_options *pwg)
+{
+	if (!out || !pixmap)
+		return;
+
+	fz_output_pwg_page_header(ctx, out, pixmap->w, pixmap->h, pixmap->n, pixmap->xres, pixmap->yres, pwg);
+	fz_output_pwg_band(ctx, out, pixmap->w, pixmap->h, pixmap->n, 0, pixmap->h, pixmap->samples);
+}
+
+void
+fz_output_pwg_bitmap_header(fz_context *ctx, fz_output *out, int w, int h, int n, int xres, int yres, const fz_pwg_options *pwg)
+{
+	if (!out)
+		return;
+
+	if (n != 1 && n != 4)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bitmap must be monochrome or cmyk to write as pwg");
+
+	output_header(ctx, out, pwg, xres, yres, w, h, n);
+}
+
+void
+fz_output_pwg_bitmap_band(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap)
 {
 	unsigned char *sp;
 	int y, x, ss;
@@ -183,12 +219,10 @@ fz_output_pwg_bitmap_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitm
 	if (!out || !bitmap)
 		return;
 
-	output_header(ctx, out, pwg, bitmap->xres, bitmap->yres, bitmap->w, bitmap->h, 1);
-
 	/* Now output the actual bitmap, using a packbits like compression */
 	sp = bitmap->samples;
 	ss = bitmap->stride;
-	byte_width = (bitmap->w+7)/8;
+	byte_width = (bitmap->w * bitmap->n + 7)/8;
 	y = 0;
 	while (y < bitmap->h)
 	{
@@ -250,6 +284,16 @@ fz_output_pwg_bitmap_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitm
 	}
 }
 
+void
+fz_output_pwg_bitmap_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, const fz_pwg_options *pwg)
+{
+	if (!out || !bitmap)
+		return;
+
+	fz_output_pwg_bitmap_header(ctx, out, bitmap->w, bitmap->h, bitmap->n, bitmap->xres, bitmap->yres, pwg);
+	fz_output_pwg_bitmap_band(ctx, out, bitmap);
+}
+
 void
 fz_output_pwg(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_pwg_options *pwg)
 {
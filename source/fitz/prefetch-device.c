@@ -0,0 +1,57 @@
+#include "mupdf/fitz.h"
+
+/* Decode an image at the size the draw device asks for, and leave it in the store */
+static void
+fz_prefetch_image(fz_context *ctx, fz_image *image, const fz_matrix *ctm)
+{
+	fz_pixmap *pixmap;
+	int dx, dy;
+
+	if (image->w == 0 || image->h == 0)
+		return;
+
+	dx = sqrtf(ctm->a * ctm->a + ctm->b * ctm->b);
+	dy = sqrtf(ctm->c * ctm->c + ctm->d * ctm->d);
+
+	fz_try(ctx)
+	{
+		pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+		fz_drop_pixmap(ctx, pixmap);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_ABORT);
+		/* Drawing the page will report the error */
+	}
+}
+
+static void
+fz_prefetch_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
+{
+	fz_prefetch_image(ctx, image, ctm);
+}
+
+static void
+fz_prefetch_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_prefetch_image(ctx, image, ctm);
+}
+
+static void
+fz_prefetch_clip_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_rect *rect, const fz_matrix *ctm)
+{
+	fz_prefetch_image(ctx, image, ctm);
+}
+
+fz_device *
+fz_new_prefetch_device(fz_context *ctx)
+{
+	fz_device *dev = fz_new_device(ctx, sizeof *dev);
+
+	dev->fill_image = fz_prefetch_fill_image;
+	dev->fill_image_mask = fz_prefetch_fill_image_mask;
+	dev->clip_image_mask = fz_prefetch_clip_image_mask;
+
+	return dev;
+}
@@ -535,29 +535,6 @@ split_stripe(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 	memcpy(s1->color[3], p->color[3], n * sizeof(s1->color[3][0]));
 }
 
-static void
-draw_stripe(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth)
-{
-	tensor_patch s0, s1;
-
-	/* split patch into two half-height patches */
-	split_stripe(p, &s0, &s1, painter->ncomp);
-
-	depth--;
-	if (depth == 0)
-	{
-		/* if no more subdividing, draw two new patches... */
-		triangulate_patch(ctx, painter, s1);
-		triangulate_patch(ctx, painter, s0);
-	}
-	else
-	{
-		/* ...otherwise, continue subdividing. */
-		draw_stripe(ctx, painter, &s1, depth);
-		draw_stripe(ctx, painter, &s0, depth);
-	}
-}
-
 static void
 split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 {
@@ -583,25 +560,186 @@ split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 }
 
 static void
-draw_patch(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth, int origdepth)
+draw_stripe(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth)
+{
+	tensor_patch s0, s1;
+
+	if (depth == 0)
+	{
+		triangulate_patch(ctx, painter, *p);
+		return;
+	}
+
+	/* split patch into two half-height patches */
+	split_stripe(p, &s0, &s1, painter->ncomp);
+	draw_stripe(ctx, painter, &s0, depth - 1);
+	draw_stripe(ctx, painter, &s1, depth - 1);
+}
+
+static void
+draw_subpatches(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth_u, int depth_v)
 {
 	tensor_patch s0, s1;
 
+	if (depth_u == 0)
+	{
+		draw_stripe(ctx, painter, p, depth_v);
+		return;
+	}
+
 	/* split patch into two half-width patches */
 	split_patch(p, &s0, &s1, painter->ncomp);
+	draw_subpatches(ctx, painter, &s0, depth_u - 1, depth_v);
+	draw_subpatches(ctx, painter, &s1, depth_u - 1, depth_v);
+}
 
-	depth--;
-	if (depth == 0)
+/* Subdivide each patch until the pieces are flat to within PATCH_FLATNESS
+ * device pixels, and their colour is close enough to linear for the two
+ * triangles drawn for each to reproduce it. */
+#define PATCH_FLATNESS 0.5f
+#define PATCH_COLOR_TOLERANCE (1 / 256.0f) /* of each component's range */
+#define PATCH_MAX_DEPTH 6 /* in each direction */
+
+static inline float
+curve_flatness(fz_point *pole, int polestep)
+{
+	/* How far the inner control points are from the thirds of the
+	 * chord; this bounds how far the curve strays from the chord, or
+	 * from a uniform pace along it. Halving the curve quarters it. */
+	float dx = (pole[3 * polestep].x - pole[0].x) / 3;
+	float dy = (pole[3 * polestep].y - pole[0].y) / 3;
+	float d1 = fz_max(fabsf(pole[1 * polestep].x - pole[0].x - dx), fabsf(pole[1 * polestep].y - pole[0].y - dy));
+	float d2 = fz_max(fabsf(pole[3 * polestep].x - pole[2 * polestep].x - dx), fabsf(pole[3 * polestep].y - pole[2 * polestep].y - dy));
+	return fz_max(d1, d2);
+}
+
+/* How many times we must halve something that quarters with each halving
+ * to bring it within tolerance. */
+static inline int
+patch_depth(float err, float tolerance)
+{
+	int depth = 0;
+	while (err > tolerance && depth < PATCH_MAX_DEPTH)
 	{
-		/* if no more subdividing, draw two new patches... */
-		draw_stripe(ctx, painter, &s0, origdepth);
-		draw_stripe(ctx, painter, &s1, origdepth);
+		err /= 4;
+		depth++;
 	}
-	else
+	return depth;
+}
+
+static void
+draw_edge_cracks(fz_context *ctx, fz_mesh_processor *painter, fz_point *pole, float *c0, float *c1, fz_vertex *v0, fz_vertex *v1, int depth, int flat)
+{
+	fz_point q0[4], q1[4];
+	float c[FZ_MAX_COLORS];
+	fz_vertex v;
+
+	split_curve(pole, q0, q1, 1);
+	midcolor(c, c0, c1, painter->ncomp);
+	v.p = q1[0];
+	fz_prepare_color(ctx, painter, &v, c);
+
+	/* Any neighbour will have divided this edge at least flat times.
+	 * Past that, fill the sliver between the chord and the two halves
+	 * of the curve, so that no gap is left against a neighbour that
+	 * divides the edge less finely than we do. */
+	if (flat <= 0)
+		paint_tri(ctx, painter, v0, &v, v1);
+
+	if (depth > 1)
 	{
-		/* ...otherwise, continue subdividing. */
-		draw_patch(ctx, painter, &s0, depth, origdepth);
-		draw_patch(ctx, painter, &s1, depth, origdepth);
+		draw_edge_cracks(ctx, painter, q0, c0, c, v0, &v, depth - 1, flat - 1);
+		draw_edge_cracks(ctx, painter, q1, c, c1, &v, v1, depth - 1, flat - 1);
+	}
+}
+
+static void
+draw_patch(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, const float *cscale)
+{
+	static const int corner[4][2] = { { 0, 0 }, { 0, 3 }, { 3, 3 }, { 3, 0 } };
+	float flat_u = 0, flat_v = 0;
+	float twist = 0, delta = 0;
+	float x0, y0, x1, y1, size, warp;
+	int depth_u, depth_v, depth_c;
+	fz_vertex v[4];
+	fz_point edge[4];
+	int i, k, depth, flat;
+
+	x0 = x1 = p->pole[0][0].x;
+	y0 = y1 = p->pole[0][0].y;
+	for (i = 0; i < 4; i++)
+	{
+		flat_u = fz_max(flat_u, curve_flatness(p->pole[i], 1));
+		flat_v = fz_max(flat_v, curve_flatness(&p->pole[0][i], 4));
+		for (k = 0; k < 4; k++)
+		{
+			x0 = fz_min(x0, p->pole[i][k].x);
+			y0 = fz_min(y0, p->pole[i][k].y);
+			x1 = fz_max(x1, p->pole[i][k].x);
+			y1 = fz_max(y1, p->pole[i][k].y);
+		}
+	}
+	size = fz_max(x1 - x0, y1 - y0);
+
+	/* Triangles interpolate colour linearly. The patch's colour is
+	 * bilinear in its parameters, which differs from that by its twist,
+	 * and is further warped where the patch is not a parallelogram. */
+	for (k = 0; k < painter->ncomp; k++)
+	{
+		float *c0 = p->color[0], *c1 = p->color[1], *c2 = p->color[2], *c3 = p->color[3];
+		twist = fz_max(twist, fabsf(c0[k] - c1[k] + c2[k] - c3[k]) * cscale[k]);
+		delta = fz_max(delta, fabsf(c0[k] - c1[k]) * cscale[k]);
+		delta = fz_max(delta, fabsf(c1[k] - c2[k]) * cscale[k]);
+		delta = fz_max(delta, fabsf(c2[k] - c3[k]) * cscale[k]);
+		delta = fz_max(delta, fabsf(c3[k] - c0[k]) * cscale[k]);
+	}
+	warp = fabsf(p->pole[0][0].x - p->pole[0][3].x + p->pole[3][3].x - p->pole[3][0].x);
+	warp += fabsf(p->pole[0][0].y - p->pole[0][3].y + p->pole[3][3].y - p->pole[3][0].y);
+	warp = (size > 0 ? delta * warp / (4 * size) : 0);
+
+	/* The two triangles are furthest from bilinear at the centre, by
+	 * a quarter of the twist. There is no point in dividing colour
+	 * below a pixel. */
+	depth_c = fz_maxi(patch_depth(twist / 4, 1), patch_depth(warp, 1));
+	depth_c = fz_mini(depth_c, patch_depth(size * size, 1));
+
+	depth_u = fz_maxi(depth_c, patch_depth(flat_u, PATCH_FLATNESS));
+	depth_v = fz_maxi(depth_c, patch_depth(flat_v, PATCH_FLATNESS));
+
+	/* Neighbouring patches may divide their common edge differently;
+	 * fill any cracks that opens up along our curved edges. */
+	if (painter->process && (depth_u > 0 || depth_v > 0))
+	{
+		for (i = 0; i < 4; i++)
+		{
+			v[i].p = p->pole[corner[i][0]][corner[i][1]];
+			fz_prepare_color(ctx, painter, &v[i], p->color[i]);
+		}
+		for (i = 0; i < 4; i++)
+		{
+			int a = corner[i][0], b = corner[i][1];
+			int c = corner[(i + 1) & 3][0], d = corner[(i + 1) & 3][1];
+			for (k = 0; k < 4; k++)
+				edge[k] = p->pole[a + (c - a) * k / 3][b + (d - b) * k / 3];
+			depth = (i & 1 ? depth_v : depth_u);
+			flat = patch_depth(curve_flatness(edge, 1), PATCH_FLATNESS);
+			if (depth > flat && curve_flatness(edge, 1) > PATCH_FLATNESS / 256)
+				draw_edge_cracks(ctx, painter, edge, p->color[i], p->color[(i + 1) & 3], &v[i], &v[(i + 1) & 3], depth, flat);
+		}
+	}
+
+	draw_subpatches(ctx, painter, p, depth_u, depth_v);
+}
+
+static void
+patch_color_scale(fz_shade *shade, int ncomp, float *cscale)
+{
+	int k;
+
+	for (k = 0; k < ncomp; k++)
+	{
+		float range = fabsf(shade->u.m.c1[k] - shade->u.m.c0[k]);
+		cscale[k] = (range > 0 ? 1 / (range * PATCH_COLOR_TOLERANCE) : 0);
 	}
 }
 
@@ -692,15 +830,13 @@ make_tensor_patch(tensor_patch *p, int type, fz_point *pt)
 	}
 }
 
-/* FIXME: Nasty */
-#define SUBDIV 3 /* how many levels to subdivide patches */
-
 static void
 fz_process_mesh_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
 {
 	fz_stream *stream = fz_open_compressed_buffer(ctx, shade->buffer);
 	float color_storage[2][4][FZ_MAX_COLORS];
 	fz_point point_storage[2][12];
+	float cscale[FZ_MAX_COLORS];
 	int store = 0;
 	int ncomp = painter->ncomp;
 	int i, k;
@@ -714,6 +850,8 @@ fz_process_mesh_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz
 	float *c0 = shade->u.m.c0;
 	float *c1 = shade->u.m.c1;
 
+	patch_color_scale(shade, ncomp, cscale);
+
 	fz_try(ctx)
 	{
 		float (*prevc)[FZ_MAX_COLORS] = NULL;
@@ -791,7 +929,7 @@ fz_process_mesh_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz
 			for (i = 0; i < 4; i++)
 				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+			draw_patch(ctx, painter, &patch, cscale);
 
 			prevp = v;
 			prevc = c;
@@ -823,12 +961,15 @@ fz_process_mesh_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz
 	float *c1 = shade->u.m.c1;
 	float color_storage[2][4][FZ_MAX_COLORS];
 	fz_point point_storage[2][16];
+	float cscale[FZ_MAX_COLORS];
 	int store = 0;
 	int ncomp = painter->ncomp;
 	int i, k;
 	float (*prevc)[FZ_MAX_COLORS] = NULL;
 	fz_point (*prevp) = NULL;
 
+	patch_color_scale(shade, ncomp, cscale);
+
 	fz_try(ctx)
 	{
 		while (!fz_is_eof_bits(ctx, stream))
@@ -904,7 +1045,7 @@ fz_process_mesh_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz
 			for (i = 0; i < 4; i++)
 				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+			draw_patch(ctx, painter, &patch, cscale);
 
 			prevp = v;
 			prevc = c;
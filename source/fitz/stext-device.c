@@ -31,6 +31,12 @@ struct fz_text_device_s
 	span_soup *spans;
 	fz_text_span *cur_span;
 	int lastchar;
+
+	/* When streaming: where to write, and the first and last spans
+	 * (without their text) of the line being written. */
+	fz_output *out;
+	int in_line;
+	fz_text_span line_first, line_last;
 };
 
 static fz_rect *
@@ -277,6 +283,98 @@ dump_line(fz_text_line *line)
 }
 #endif
 
+/*
+	Does span continue the line that starts with first_span, and so
+	far ends with last_span? Returns non-zero if span starts a new
+	line, along with its distance from the line and its spacing from
+	the last span.
+*/
+static int
+compare_span(fz_text_span *first_span, fz_text_span *last_span, fz_text_span *span, float *distance_, float *spacing_)
+{
+	/* Do span and last_line share the same baseline? */
+	fz_point p, q, perp_r;
+	float dot;
+	float size = fz_matrix_expansion(&span->transform);
+	float distance;
+	float spacing = 0;
+	int new_line;
+
+#ifdef DEBUG_SPANS
+	{
+		printf("Comparing: \"");
+		dump_span(last_span);
+		printf("\" and \"");
+		dump_span(span);
+		printf("\"\n");
+	}
+#endif
+
+	p.x = first_span->max.x - first_span->min.x;
+	p.y = first_span->max.y - first_span->min.y;
+	fz_normalize_vector(&p);
+	q.x = span->max.x - span->min.x;
+	q.y = span->max.y - span->min.y;
+	fz_normalize_vector(&q);
+#ifdef DEBUG_SPANS
+	printf("last_span=%g %g -> %g %g = %g %g\n", last_span->min.x, last_span->min.y, last_span->max.x, last_span->max.y, p.x, p.y);
+	printf("span     =%g %g -> %g %g = %g %g\n", span->min.x, span->min.y, span->max.x, span->max.y, q.x, q.y);
+#endif
+	perp_r.y = first_span->min.x - span->min.x;
+	perp_r.x = -(first_span->min.y - span->min.y);
+	/* Check if p and q are parallel. If so, then this
+	 * line is parallel with the last one. */
+	dot = p.x * q.x + p.y * q.y;
+	if (fabsf(dot) > 0.9995)
+	{
+		/* If we take the dot product of normalised(p) and
+		 * perp(r), we get the perpendicular distance from
+		 * one line to the next (assuming they are parallel). */
+		distance = p.x * perp_r.x + p.y * perp_r.y;
+		/* We allow 'small' distances of baseline changes
+		 * to cope with super/subscript. FIXME: We should
+		 * gather subscript/superscript information here. */
+		new_line = (fabsf(distance) > size * LINE_DIST);
+	}
+	else
+	{
+		new_line = 1;
+		distance = 0;
+	}
+	if (!new_line)
+	{
+		fz_point delta;
+
+		delta.x = span->min.x - last_span->max.x;
+		delta.y = span->min.y - last_span->max.y;
+
+		spacing = (p.x * delta.x + p.y * delta.y);
+		spacing = fabsf(spacing);
+		/* Only allow changes in baseline (subscript/superscript etc)
+		 * when the spacing is small. */
+		if (spacing * fabsf(distance) > size * LINE_DIST && fabsf(distance) > size * 0.1f)
+		{
+			new_line = 1;
+			distance = 0;
+			spacing = 0;
+		}
+		else
+		{
+			spacing /= size * SPACE_DIST;
+			/* Apply the same logic here as when we're adding chars to build spans. */
+			if (spacing >= 1 && spacing < (SPACE_MAX_DIST/SPACE_DIST))
+				spacing = 1;
+		}
+	}
+#ifdef DEBUG_SPANS
+	printf("dot=%g new_line=%d distance=%g size=%g spacing=%g\n", dot, new_line, distance, size, spacing);
+#endif
+
+	*distance_ = distance;
+	*spacing_ = spacing;
+	return new_line;
+}
+
 static void
 strain_soup(fz_context *ctx, fz_text_device *tdev)
 {
@@ -299,80 +397,7 @@ strain_soup(fz_context *ctx, fz_text_device *tdev)
 		if (last_span)
 		{
 			/* If we have a last_span, we must have a last_line */
-			/* Do span and last_line share the same baseline? */
-			fz_point p, q, perp_r;
-			float dot;
-			float size = fz_matrix_expansion(&span->transform);
-
-#ifdef DEBUG_SPANS
-			{
-				printf("Comparing: \"");
-				dump_span(last_span);
-				printf("\" and \"");
-				dump_span(span);
-				printf("\"\n");
-			}
-#endif
-
-			p.x = last_line->first_span->max.x - last_line->first_span->min.x;
-			p.y = last_line->first_span->max.y - last_line->first_span->min.y;
-			fz_normalize_vector(&p);
-			q.x = span->max.x - span->min.x;
-			q.y = span->max.y - span->min.y;
-			fz_normalize_vector(&q);
-#ifdef DEBUG_SPANS
-			printf("last_span=%g %g -> %g %g = %g %g\n", last_span->min.x, last_span->min.y, last_span->max.x, last_span->max.y, p.x, p.y);
-			printf("span     =%g %g -> %g %g = %g %g\n", span->min.x, span->min.y, span->max.x, span->max.y, q.x, q.y);
-#endif
-			perp_r.y = last_line->first_span->min.x - span->min.x;
-			perp_r.x = -(last_line->first_span->min.y - span->min.y);
-			/* Check if p and q are parallel. If so, then this
-			 * line is parallel with the last one. */
-			dot = p.x * q.x + p.y * q.y;
-			if (fabsf(dot) > 0.9995)
-			{
-				/* If we take the dot product of normalised(p) and
-				 * perp(r), we get the perpendicular distance from
-				 * one line to the next (assuming they are parallel). */
-				distance = p.x * perp_r.x + p.y * perp_r.y;
-				/* We allow 'small' distances of baseline changes
-				 * to cope with super/subscript. FIXME: We should
-				 * gather subscript/superscript information here. */
-				new_line = (fabsf(distance) > size * LINE_DIST);
-			}
-			else
-			{
-				new_line = 1;
-				distance = 0;
-			}
-			if (!new_line)
-			{
-				fz_point delta;
-
-				delta.x = span->min.x - last_span->max.x;
-				delta.y = span->min.y - last_span->max.y;
-
-				spacing = (p.x * delta.x + p.y * delta.y);
-				spacing = fabsf(spacing);
-				/* Only allow changes in baseline (subscript/superscript etc)
-				 * when the spacing is small. */
-				if (spacing * fabsf(distance) > size * LINE_DIST && fabsf(distance) > size * 0.1f)
-				{
-					new_line = 1;
-					distance = 0;
-					spacing = 0;
-				}
-				else
-				{
-					spacing /= size * SPACE_DIST;
-					/* Apply the same logic here as when we're adding chars to build spans. */
-					if (spacing >= 1 && spacing < (SPACE_MAX_DIST/SPACE_DIST))
-						spacing = 1;
-				}
-			}
-#ifdef DEBUG_SPANS
-			printf("dot=%g new_line=%d distance=%g size=%g spacing=%g\n", dot, new_line, distance, size, spacing);
-#endif
+			new_line = compare_span(last_line->first_span, last_span, span, &distance, &spacing);
 		}
 		span->spacing = spacing;
 		last_line = push_span(ctx, tdev, span, new_line, distance);
@@ -567,6 +592,25 @@ add_char_to_span(fz_context *ctx, fz_text_span *span, int c, fz_point *p, fz_poi
 	span->len++;
 }
 
+static void stream_span(fz_context *ctx, fz_text_device *tdev, fz_text_span *span);
+
+static void
+finish_span(fz_context *ctx, fz_text_device *dev)
+{
+	fz_text_span *span = dev->cur_span;
+
+	if (dev->out)
+	{
+		dev->cur_span = NULL;
+		stream_span(ctx, dev, span);
+	}
+	else
+	{
+		add_span_to_soup(ctx, dev->spans, span);
+		dev->cur_span = NULL;
+	}
+}
+
 static void
 fz_add_text_char_imp(fz_context *ctx, fz_text_device *dev, fz_text_style *style, int c, fz_matrix *trm, float adv, int wmode)
 {
@@ -689,8 +733,7 @@ fz_add_text_char_imp(fz_context *ctx, fz_text_device *dev, fz_text_style *style,
 	if (can_append == 0)
 	{
 		/* Start a new span */
-		add_span_to_soup(ctx, dev->spans, dev->cur_span);
-		dev->cur_span = NULL;
+		finish_span(ctx, dev);
 		dev->cur_span = fz_new_text_span(ctx, &p, wmode, trm);
 		dev->cur_span->spacing = 0;
 	}
@@ -883,6 +926,10 @@ fz_text_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *img, const fz
 	if (alpha < 0.5)
 		return;
 
+	/* Images are not written when streaming */
+	if (!page)
+		return;
+
 	/* New block */
 	if (page->len == page->cap)
 	{
@@ -998,11 +1045,86 @@ fz_bidi_reorder_text_page(fz_context *ctx, fz_text_page *page)
 					fz_bidi_reorder_span(span);
 }
 
+/*
+	Streaming. Spans are arranged into lines and blocks as they are
+	finished, exactly as strain_soup would, and written out straight
+	away. Only the geometry of the first and last spans of the current
+	line is kept, so memory use does not grow with the page.
+*/
+
+static void
+write_span_text(fz_context *ctx, fz_output *out, fz_text_span *span)
+{
+	char buf[256];
+	int i, n = 0;
+
+	for (i = 0; i < span->len; i++)
+	{
+		if (n > (int)sizeof buf - 10)
+		{
+			fz_write(ctx, out, buf, n);
+			n = 0;
+		}
+		n += fz_runetochar(buf + n, span->text[i].c);
+	}
+	fz_write(ctx, out, buf, n);
+}
+
+static void
+stream_span(fz_context *ctx, fz_text_device *tdev, fz_text_span *span)
+{
+	int new_line = 1;
+	float distance = 0;
+	float spacing = 0;
+
+	if (span == NULL)
+		return;
+
+	fz_try(ctx)
+	{
+		if (tdev->in_line)
+		{
+			new_line = compare_span(&tdev->line_first, &tdev->line_last, span, &distance, &spacing);
+			if (new_line)
+			{
+				/* The same test for a new block as push_span */
+				float size = fz_matrix_expansion(&span->transform);
+				fz_write(ctx, tdev->out, "\n", 1);
+				if (distance == 0 || distance > size * 1.5 || distance < -size * PARAGRAPH_DIST)
+					fz_write(ctx, tdev->out, "\n", 1);
+			}
+		}
+		fz_bidi_reorder_span(span);
+		write_span_text(ctx, tdev->out, span);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, span->text);
+		span->text = NULL;
+		span->len = span->cap = 0;
+		if (new_line)
+			tdev->line_first = *span;
+		tdev->line_last = *span;
+		tdev->in_line = 1;
+		fz_free(ctx, span);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void
 fz_text_begin_page(fz_context *ctx, fz_device *dev, const fz_rect *mediabox, const fz_matrix *ctm)
 {
 	fz_text_device *tdev = (fz_text_device*)dev;
 
+	if (tdev->out)
+	{
+		tdev->in_line = 0;
+		return;
+	}
+
 	if (tdev->page->len)
 	{
 		tdev->page->next = fz_new_text_page(ctx);
@@ -1020,6 +1142,16 @@ fz_text_end_page(fz_context *ctx, fz_device *dev)
 {
 	fz_text_device *tdev = (fz_text_device*)dev;
 
+	if (tdev->out)
+	{
+		finish_span(ctx, tdev);
+		/* End the last line and block */
+		if (tdev->in_line)
+			fz_write(ctx, tdev->out, "\n\n", 2);
+		tdev->in_line = 0;
+		return;
+	}
+
 	add_span_to_soup(ctx, tdev->spans, tdev->cur_span);
 	tdev->cur_span = NULL;
 
@@ -1038,6 +1170,11 @@ fz_text_drop_imp(fz_context *ctx, fz_device *dev)
 {
 	fz_text_device *tdev = (fz_text_device*)dev;
 	free_span_soup(ctx, tdev->spans);
+	if (tdev->cur_span)
+	{
+		fz_free(ctx, tdev->cur_span->text);
+		fz_free(ctx, tdev->cur_span);
+	}
 }
 
 fz_device *
@@ -1066,3 +1203,14 @@ fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page)
 
 	return (fz_device*)dev;
 }
+
+fz_device *
+fz_new_text_output_device(fz_context *ctx, fz_text_sheet *sheet, fz_output *out)
+{
+	fz_text_device *dev = (fz_text_device *)fz_new_text_device(ctx, sheet, NULL);
+
+	dev->out = out;
+	dev->in_line = 0;
+
+	return (fz_device*)dev;
+}
@@ -0,0 +1,795 @@
+#include "mupdf/fitz.h"
+#include "ucdn.h"
+
+/*
+	A text index maps each word (term) of a document to the places it
+	occurs, so that a document can be searched without interpreting
+	its pages again.
+
+	Words are maximal runs of letters, digits and combining marks
+	within a line of a text page, case folded. Each occurrence records the page, the word
+	number within the page (so that phrases can be found by looking for
+	consecutive words), the character offset of the word within the
+	page (counted as for fz_text_char_at) and the bbox of the word
+	quantised to QUANT units per point.
+
+	On disk, an index is laid out as follows. Numbers are unsigned
+	LEB128 varints unless noted otherwise.
+
+	header:	the 8 byte MAGIC, then the version, page count and term
+		count as 32-bit big endian numbers, and the offset of the
+		dictionary as a 64-bit big endian number.
+
+	postings: for each term, in dictionary order, the occurrences
+		of the term sorted by page and word number. Each occurrence
+		is the page delta, the word number and character offset
+		(as deltas from the previous occurrence on the same page),
+		x0 and y0 (zigzag encoded) then width and height.
+
+	dictionary: for each term, in strcmp order, the length of the
+		term, the UTF-8 bytes of the term, the number of occurrences
+		and the number of bytes of postings. The postings of one term
+		must fit in 2 GB, as they are read into memory whole.
+*/
+
+#define MAGIC "MUTXTIDX"
+#define VERSION 2
+#define HEADER_SIZE 28
+#define QUANT 4
+#define MAX_TERM 64 /* runes, of at most 4 UTF-8 bytes each */
+#define MAX_COORD 1000000.0f
+
+typedef struct
+{
+	int page, word, pos;
+	int x, y, w, h;
+} index_posting;
+
+typedef struct
+{
+	char *term;
+	unsigned int hash;
+	int len, cap;
+	index_posting *list;
+} index_term;
+
+typedef struct
+{
+	const unsigned char *term;
+	int term_len;
+	fz_off_t offset;
+	int count, size;
+} index_entry;
+
+struct fz_text_index_s
+{
+	int page_count;
+
+	/* While building: an open addressed hash table of terms. */
+	int term_count, table_size;
+	index_term *table;
+
+	/* When opened from a file: the dictionary and the file. */
+	fz_stream *file;
+	fz_buffer *dict_buf;
+	int dict_len;
+	index_entry *dict;
+};
+
+static inline int fz_tolower(int c)
+{
+	/* TODO: proper unicode case folding */
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+static int
+is_word_char(int c)
+{
+	if (c < 128)
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	/* Letters, combining marks and numbers; punctuation, symbols and
+	 * spaces separate words */
+	switch (ucdn_get_general_category(c))
+	{
+	case UCDN_GENERAL_CATEGORY_LL:
+	case UCDN_GENERAL_CATEGORY_LM:
+	case UCDN_GENERAL_CATEGORY_LO:
+	case UCDN_GENERAL_CATEGORY_LT:
+	case UCDN_GENERAL_CATEGORY_LU:
+	case UCDN_GENERAL_CATEGORY_MC:
+	case UCDN_GENERAL_CATEGORY_ME:
+	case UCDN_GENERAL_CATEGORY_MN:
+	case UCDN_GENERAL_CATEGORY_ND:
+	case UCDN_GENERAL_CATEGORY_NL:
+	case UCDN_GENERAL_CATEGORY_NO:
+		return 1;
+	}
+	return 0;
+}
+
+/* Append a folded rune to a term. Returns the new byte length. */
+static int
+add_term_rune(char *term, int len, int *runes, int c)
+{
+	if (*runes >= MAX_TERM)
+		return len;
+	(*runes)++;
+	return len + fz_runetochar(term + len, fz_tolower(c));
+}
+
+static unsigned int
+hash_term(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+fz_text_index *
+fz_new_text_index(fz_context *ctx)
+{
+	fz_text_index *index = fz_malloc_struct(ctx, fz_text_index);
+	fz_try(ctx)
+	{
+		index->table_size = 1024;
+		index->table = fz_malloc_array(ctx, index->table_size, sizeof(index_term));
+		memset(index->table, 0, index->table_size * sizeof(index_term));
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, index);
+		fz_rethrow(ctx);
+	}
+	return index;
+}
+
+void
+fz_drop_text_index(fz_context *ctx, fz_text_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+	for (i = 0; i < index->table_size; i++)
+	{
+		fz_free(ctx, index->table[i].term);
+		fz_free(ctx, index->table[i].list);
+	}
+	fz_free(ctx, index->table);
+	fz_free(ctx, index->dict);
+	fz_drop_buffer(ctx, index->dict_buf);
+	fz_drop_stream(ctx, index->file);
+	fz_free(ctx, index);
+}
+
+static void
+grow_term_table(fz_context *ctx, fz_text_index *index)
+{
+	int new_size = index->table_size * 2;
+	index_term *new_table = fz_malloc_array(ctx, new_size, sizeof(index_term));
+	int i, k;
+
+	memset(new_table, 0, new_size * sizeof(index_term));
+	for (i = 0; i < index->table_size; i++)
+	{
+		if (!index->table[i].term)
+			continue;
+		k = index->table[i].hash & (new_size - 1);
+		while (new_table[k].term)
+			k = (k + 1) & (new_size - 1);
+		new_table[k] = index->table[i];
+	}
+	fz_free(ctx, index->table);
+	index->table = new_table;
+	index->table_size = new_size;
+}
+
+static index_term *
+lookup_term(fz_context *ctx, fz_text_index *index, const char *term)
+{
+	unsigned int hash = hash_term(term);
+	int k;
+
+	if ((index->term_count + 1) * 4 > index->table_size * 3)
+		grow_term_table(ctx, index);
+
+	k = hash & (index->table_size - 1);
+	while (index->table[k].term)
+	{
+		if (index->table[k].hash == hash && !strcmp(index->table[k].term, term))
+			return &index->table[k];
+		k = (k + 1) & (index->table_size - 1);
+	}
+
+	index->table[k].term = fz_strdup(ctx, term);
+	index->table[k].hash = hash;
+	index->term_count++;
+	return &index->table[k];
+}
+
+static void
+add_posting(fz_context *ctx, fz_text_index *index, const char *term, int page, int word, int pos, const fz_rect *bbox)
+{
+	index_term *t = lookup_term(ctx, index, term);
+	index_posting *p;
+
+	if (t->len == t->cap)
+	{
+		int new_cap = t->cap ? t->cap * 2 : 4;
+		t->list = fz_resize_array(ctx, t->list, new_cap, sizeof(index_posting));
+		t->cap = new_cap;
+	}
+
+	p = &t->list[t->len++];
+	p->page = page;
+	p->word = word;
+	p->pos = pos;
+	p->x = floorf(fz_clamp(bbox->x0, -MAX_COORD, MAX_COORD) * QUANT);
+	p->y = floorf(fz_clamp(bbox->y0, -MAX_COORD, MAX_COORD) * QUANT);
+	p->w = ceilf(fz_clamp(bbox->x1, -MAX_COORD, MAX_COORD) * QUANT) - p->x;
+	p->h = ceilf(fz_clamp(bbox->y1, -MAX_COORD, MAX_COORD) * QUANT) - p->y;
+	if (p->w < 0) p->w = 0;
+	if (p->h < 0) p->h = 0;
+}
+
+void
+fz_index_text_page(fz_context *ctx, fz_text_index *index, int page_number, fz_text_page *page)
+{
+	char term[MAX_TERM * 4 + 1];
+	int term_len, term_runes, term_pos;
+	fz_rect term_bbox;
+	int block_num, pos, word, i;
+
+	if (!index->table)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot add pages to an index opened from a file");
+	if (page_number < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page number in text index");
+
+	pos = 0;
+	word = 0;
+	for (block_num = 0; block_num < page->len; block_num++)
+	{
+		fz_text_block *block;
+		fz_text_line *line;
+		fz_text_span *span;
+
+		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
+			continue;
+		block = page->blocks[block_num].u.text;
+		for (line = block->lines; line < block->lines + block->len; line++)
+		{
+			term_len = term_runes = term_pos = 0;
+			term_bbox = fz_empty_rect;
+			for (span = line->first_span; span; span = span->next)
+			{
+				for (i = 0; i < span->len; i++, pos++)
+				{
+					int c = span->text[i].c;
+					if (is_word_char(c))
+					{
+						fz_rect bbox;
+						if (term_len == 0)
+							term_pos = pos;
+						term_len = add_term_rune(term, term_len, &term_runes, c);
+						fz_union_rect(&term_bbox, fz_text_char_bbox(ctx, &bbox, span, i));
+					}
+					else if (term_len > 0)
+					{
+						term[term_len] = 0;
+						add_posting(ctx, index, term, page_number, word++, term_pos, &term_bbox);
+						term_len = term_runes = 0;
+						term_bbox = fz_empty_rect;
+					}
+				}
+			}
+			if (term_len > 0)
+			{
+				term[term_len] = 0;
+				add_posting(ctx, index, term, page_number, word++, term_pos, &term_bbox);
+			}
+			pos++; /* pseudo-newline */
+		}
+	}
+
+	if (page_number >= index->page_count)
+		index->page_count = page_number + 1;
+}
+
+/* Writing */
+
+static int
+put_varint(unsigned char *buf, unsigned int v)
+{
+	int n = 0;
+	while (v >= 0x80)
+	{
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+static unsigned int
+zigzag(int v)
+{
+	return ((unsigned int)v << 1) ^ (unsigned int)(v >> 31);
+}
+
+static int
+unzigzag(unsigned int v)
+{
+	return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+static int
+encode_posting(unsigned char *buf, const index_posting *p, const index_posting *prev)
+{
+	int n = 0;
+	if (prev && prev->page == p->page)
+	{
+		n += put_varint(buf + n, 0);
+		n += put_varint(buf + n, p->word - prev->word);
+		n += put_varint(buf + n, p->pos - prev->pos);
+	}
+	else
+	{
+		n += put_varint(buf + n, prev ? p->page - prev->page : p->page);
+		n += put_varint(buf + n, p->word);
+		n += put_varint(buf + n, p->pos);
+	}
+	n += put_varint(buf + n, zigzag(p->x));
+	n += put_varint(buf + n, zigzag(p->y));
+	n += put_varint(buf + n, p->w);
+	n += put_varint(buf + n, p->h);
+	return n;
+}
+
+static int
+cmp_posting(const void *a_, const void *b_)
+{
+	const index_posting *a = a_;
+	const index_posting *b = b_;
+	if (a->page != b->page)
+		return a->page < b->page ? -1 : 1;
+	return a->word < b->word ? -1 : a->word > b->word;
+}
+
+static int
+cmp_term(const void *a_, const void *b_)
+{
+	const index_term *a = *(const index_term **)a_;
+	const index_term *b = *(const index_term **)b_;
+	return strcmp(a->term, b->term);
+}
+
+void
+fz_save_text_index(fz_context *ctx, fz_text_index *index, const char *filename)
+{
+	unsigned char buf[8 * 5];
+	index_term **terms = NULL;
+	int *sizes = NULL;
+	fz_output *out = NULL;
+	fz_off_t offset;
+	int i, k, n;
+
+	if (!index->table)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot save an index opened from a file");
+
+	fz_var(terms);
+	fz_var(sizes);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		terms = fz_malloc_array(ctx, index->term_count + 1, sizeof(index_term *));
+		sizes = fz_malloc_array(ctx, index->term_count + 1, sizeof(int));
+
+		n = 0;
+		for (i = 0; i < index->table_size; i++)
+			if (index->table[i].term)
+				terms[n++] = &index->table[i];
+		qsort(terms, n, sizeof(index_term *), cmp_term);
+
+		/* Pages may have been added in any order */
+		offset = HEADER_SIZE;
+		for (i = 0; i < n; i++)
+		{
+			index_term *t = terms[i];
+			qsort(t->list, t->len, sizeof(index_posting), cmp_posting);
+			sizes[i] = 0;
+			for (k = 0; k < t->len; k++)
+			{
+				int size = encode_posting(buf, &t->list[k], k ? &t->list[k-1] : NULL);
+				if (sizes[i] > INT_MAX - size)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "too many occurrences of a word to index");
+				sizes[i] += size;
+			}
+			offset += sizes[i];
+		}
+
+		out = fz_new_output_to_filename(ctx, filename);
+
+		fz_write(ctx, out, MAGIC, 8);
+		fz_write_int32be(ctx, out, VERSION);
+		fz_write_int32be(ctx, out, index->page_count);
+		fz_write_int32be(ctx, out, n);
+		fz_write_int32be(ctx, out, (int)(offset >> 32));
+		fz_write_int32be(ctx, out, (int)offset);
+
+		for (i = 0; i < n; i++)
+		{
+			index_term *t = terms[i];
+			for (k = 0; k < t->len; k++)
+				fz_write(ctx, out, buf, encode_posting(buf, &t->list[k], k ? &t->list[k-1] : NULL));
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			int len = strlen(terms[i]->term);
+			fz_write(ctx, out, buf, put_varint(buf, len));
+			fz_write(ctx, out, terms[i]->term, len);
+			k = put_varint(buf, terms[i]->len);
+			k += put_varint(buf + k, sizes[i]);
+			fz_write(ctx, out, buf, k);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_free(ctx, sizes);
+		fz_free(ctx, terms);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+/* Reading */
+
+static unsigned int
+get_varint(fz_context *ctx, const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	unsigned int v = 0;
+	int shift = 0;
+
+	do
+	{
+		if (p == end || shift > 28)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+		v |= (unsigned int)(*p & 0x7f) << shift;
+		shift += 7;
+	}
+	while (*p++ & 0x80);
+
+	*pp = p;
+	return v;
+}
+
+static int
+read_int32be(fz_context *ctx, fz_stream *stm)
+{
+	int a = fz_read_byte(ctx, stm);
+	int b = fz_read_byte(ctx, stm);
+	int c = fz_read_byte(ctx, stm);
+	int d = fz_read_byte(ctx, stm);
+	if (d == EOF)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of text index");
+	return (a << 24) | (b << 16) | (c << 8) | d;
+}
+
+fz_text_index *
+fz_open_text_index(fz_context *ctx, const char *filename)
+{
+	fz_text_index *index;
+	unsigned char magic[8];
+	const unsigned char *p, *end;
+	fz_off_t dict_offset, offset;
+	int i, count, hi, lo;
+
+	index = fz_malloc_struct(ctx, fz_text_index);
+	fz_try(ctx)
+	{
+		index->file = fz_open_file(ctx, filename);
+
+		if (fz_read(ctx, index->file, magic, 8) != 8 || memcmp(magic, MAGIC, 8))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "not a text index: %s", filename);
+		if (read_int32be(ctx, index->file) != VERSION)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported text index version: %s", filename);
+		index->page_count = read_int32be(ctx, index->file);
+		count = read_int32be(ctx, index->file);
+		hi = read_int32be(ctx, index->file);
+		lo = read_int32be(ctx, index->file);
+		dict_offset = hi < 0 ? 0 : ((fz_off_t)hi << 32) | (unsigned int)lo;
+		if (index->page_count < 0 || count < 0 || dict_offset < HEADER_SIZE)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index: %s", filename);
+
+		fz_seek(ctx, index->file, dict_offset, SEEK_SET);
+		index->dict_buf = fz_read_all(ctx, index->file, 0);
+		index->dict = fz_malloc_array(ctx, count + 1, sizeof(index_entry));
+
+		p = index->dict_buf->data;
+		end = p + index->dict_buf->len;
+		offset = HEADER_SIZE;
+		for (i = 0; i < count; i++)
+		{
+			index_entry *e = &index->dict[i];
+			e->term_len = get_varint(ctx, &p, end);
+			if (e->term_len < 0 || e->term_len > end - p)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index: %s", filename);
+			e->term = p;
+			p += e->term_len;
+			e->count = get_varint(ctx, &p, end);
+			e->size = get_varint(ctx, &p, end);
+			if (e->count <= 0 || e->size < e->count || e->size > dict_offset - offset)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index: %s", filename);
+			e->offset = offset;
+			offset += e->size;
+		}
+		index->dict_len = count;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+	return index;
+}
+
+int
+fz_count_text_index_pages(fz_context *ctx, fz_text_index *index)
+{
+	return index->page_count;
+}
+
+static index_entry *
+find_entry(fz_text_index *index, const char *term)
+{
+	int len = strlen(term);
+	int l = 0;
+	int r = index->dict_len - 1;
+
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		index_entry *e = &index->dict[m];
+		int c = memcmp(term, e->term, fz_mini(len, e->term_len));
+		if (c == 0)
+			c = len - e->term_len;
+		if (c < 0)
+			r = m - 1;
+		else if (c > 0)
+			l = m + 1;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* Add a stored delta to a page, word or character number. */
+static int
+add_delta(fz_context *ctx, int base, unsigned int delta)
+{
+	if (delta > (unsigned int)(INT_MAX - base))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+	return base + delta;
+}
+
+/* Read and decode the postings of one term. */
+static index_posting *
+load_postings(fz_context *ctx, fz_text_index *index, index_entry *e)
+{
+	unsigned char *data;
+	index_posting *list;
+	const unsigned char *p, *end;
+	int i;
+
+	data = fz_malloc(ctx, e->size);
+	list = NULL;
+	fz_try(ctx)
+	{
+		fz_seek(ctx, index->file, e->offset, SEEK_SET);
+		if (fz_read(ctx, index->file, data, e->size) != e->size)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of text index");
+		list = fz_malloc_array(ctx, e->count, sizeof(index_posting));
+
+		p = data;
+		end = data + e->size;
+		for (i = 0; i < e->count; i++)
+		{
+			index_posting *q = &list[i];
+			unsigned int delta = get_varint(ctx, &p, end);
+			if (i > 0 && delta == 0)
+			{
+				q->page = list[i-1].page;
+				q->word = add_delta(ctx, list[i-1].word, get_varint(ctx, &p, end));
+				q->pos = add_delta(ctx, list[i-1].pos, get_varint(ctx, &p, end));
+			}
+			else
+			{
+				q->page = add_delta(ctx, i > 0 ? list[i-1].page : 0, delta);
+				q->word = add_delta(ctx, 0, get_varint(ctx, &p, end));
+				q->pos = add_delta(ctx, 0, get_varint(ctx, &p, end));
+			}
+			q->x = unzigzag(get_varint(ctx, &p, end));
+			q->y = unzigzag(get_varint(ctx, &p, end));
+			q->w = get_varint(ctx, &p, end);
+			q->h = get_varint(ctx, &p, end);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+/* Split a query into folded terms, in the same way as page text. */
+static void
+split_terms(fz_context *ctx, const char *needle, char **terms, int *n)
+{
+	char term[MAX_TERM * 4 + 1];
+	int len = 0;
+	int runes = 0;
+	int c;
+
+	do
+	{
+		needle += fz_chartorune(&c, (char *)needle);
+		if (c && is_word_char(c))
+			len = add_term_rune(term, len, &runes, c);
+		else if (len > 0)
+		{
+			term[len] = 0;
+			terms[*n] = fz_strdup(ctx, term);
+			(*n)++;
+			len = runes = 0;
+		}
+	}
+	while (c);
+}
+
+static void
+posting_rect(fz_rect *r, const index_posting *p)
+{
+	r->x0 = (float)p->x / QUANT;
+	r->y0 = (float)p->y / QUANT;
+	r->x1 = ((float)p->x + p->w) / QUANT;
+	r->y1 = ((float)p->y + p->h) / QUANT;
+}
+
+/* Words continue a line when they are level and less than a line
+ * height apart. */
+static int
+same_line(const fz_rect *line, const fz_rect *word)
+{
+	float h = line->y1 - line->y0;
+	return fz_abs(word->y0 - line->y0) < h / 2 && word->x0 >= line->x0 && word->x0 - line->x1 < h;
+}
+
+static int
+add_index_hit(fz_text_index_hit *hits, int hit_count, int hit_max, int page, int pos, const fz_rect *rect)
+{
+	if (hit_count < hit_max)
+	{
+		hits[hit_count].page = page;
+		hits[hit_count].pos = pos;
+		hits[hit_count].rect = *rect;
+		hit_count++;
+	}
+	return hit_count;
+}
+
+int
+fz_search_text_index(fz_context *ctx, fz_text_index *index, const char *needle, fz_text_index_hit *hits, int hit_max)
+{
+	char **terms = NULL;
+	index_posting **lists = NULL;
+	int *counts = NULL;
+	int *cursor = NULL;
+	int n = 0;
+	int hit_count = 0;
+	int i, k;
+
+	if (!index->dict)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot search an index that has not been saved");
+
+	fz_var(terms);
+	fz_var(lists);
+	fz_var(counts);
+	fz_var(cursor);
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		int len = strlen(needle);
+		terms = fz_malloc_array(ctx, len / 2 + 1, sizeof(char *));
+		split_terms(ctx, needle, terms, &n);
+
+		lists = fz_malloc_array(ctx, n + 1, sizeof(index_posting *));
+		memset(lists, 0, (n + 1) * sizeof(index_posting *));
+		counts = fz_malloc_array(ctx, n + 1, sizeof(int));
+		cursor = fz_malloc_array(ctx, n + 1, sizeof(int));
+
+		for (i = 0; i < n; i++)
+		{
+			index_entry *e = find_entry(index, terms[i]);
+			if (!e)
+				break;
+			lists[i] = load_postings(ctx, index, e);
+			counts[i] = e->count;
+			cursor[i] = 0;
+		}
+
+		/* A phrase matches where its terms are consecutive words on
+		 * the same page. The lists are sorted, so walk them together. */
+		if (n > 0 && i == n)
+		{
+			for (k = 0; k < counts[0] && hit_count < hit_max; k++)
+			{
+				const index_posting *first = &lists[0][k];
+				fz_rect linebox, box;
+				int linepos;
+
+				for (i = 1; i < n; i++)
+				{
+					const index_posting *p = lists[i];
+					while (cursor[i] < counts[i] && (p[cursor[i]].page < first->page ||
+							(p[cursor[i]].page == first->page && p[cursor[i]].word - first->word < i)))
+						cursor[i]++;
+					if (cursor[i] == counts[i] || p[cursor[i]].page != first->page || p[cursor[i]].word - first->word != i)
+						break;
+				}
+				if (i < n)
+					continue;
+
+				/* Merge the words of the hit into one box per line */
+				posting_rect(&linebox, first);
+				linepos = first->pos;
+				for (i = 1; i < n; i++)
+				{
+					const index_posting *p = &lists[i][cursor[i]];
+					posting_rect(&box, p);
+					if (!same_line(&linebox, &box))
+					{
+						hit_count = add_index_hit(hits, hit_count, hit_max, first->page, linepos, &linebox);
+						linebox = box;
+						linepos = p->pos;
+					}
+					else
+						fz_union_rect(&linebox, &box);
+				}
+				hit_count = add_index_hit(hits, hit_count, hit_max, first->page, linepos, &linebox);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < n; i++)
+		{
+			fz_free(ctx, terms[i]);
+			if (lists)
+				fz_free(ctx, lists[i]);
+		}
+		fz_free(ctx, terms);
+		fz_free(ctx, lists);
+		fz_free(ctx, counts);
+		fz_free(ctx, cursor);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return hit_count;
+}
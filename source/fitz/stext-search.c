@@ -55,20 +55,6 @@ fz_char_and_box *fz_text_char_at(fz_context *ctx, fz_char_and_box *cab, fz_text_
 	return cab;
 }
 
-static int charat(fz_context *ctx, fz_text_page *page, int idx)
-{
-	fz_char_and_box cab;
-	return fz_text_char_at(ctx, &cab, page, idx)->c;
-}
-
-static fz_rect *bboxat(fz_context *ctx, fz_text_page *page, int idx, fz_rect *bbox)
-{
-	fz_char_and_box cab;
-	/* FIXME: Nasty extra copy */
-	*bbox = fz_text_char_at(ctx, &cab, page, idx)->bbox;
-	return bbox;
-}
-
 static int textlen(fz_context *ctx, fz_text_page *page)
 {
 	int len = 0;
@@ -95,74 +81,219 @@ static int textlen(fz_context *ctx, fz_text_page *page)
 	return len;
 }
 
-static int match(fz_context *ctx, fz_text_page *page, const char *s, int n)
+/*
+	Searching is done over a flattened copy of the page text, built once
+	per search, rather than by walking the blocks, lines and spans of
+	the page again for every character we look at.
+
+	Both the needle and the page text are case folded, and every run of
+	whitespace is collapsed into a single WHITE token. This reproduces
+	the matching rules of the old character at a time matcher (where any
+	run of whitespace in the needle matched any run in the document) in
+	a form that a plain substring search can run over.
+*/
+
+#define WHITE (-1)
+
+typedef struct
+{
+	int len; /* number of tokens */
+	int *tok; /* folded character, or WHITE */
+	int *start; /* index of the first character of each token */
+	int tlen; /* number of characters, including pseudo-newlines */
+	fz_text_span **span; /* span of each character (NULL for pseudo-newlines) */
+	int *idx; /* index of each character within its span */
+} search_text;
+
+static void
+drop_search_text(fz_context *ctx, search_text *st)
+{
+	fz_free(ctx, st->tok);
+	fz_free(ctx, st->start);
+	fz_free(ctx, st->span);
+	fz_free(ctx, st->idx);
+}
+
+static void
+add_search_char(search_text *st, int c, fz_text_span *span, int i)
+{
+	int n = st->tlen++;
+
+	st->span[n] = span;
+	st->idx[n] = i;
+	if (iswhite(c))
+	{
+		if (st->len > 0 && st->tok[st->len-1] == WHITE)
+			return;
+		c = WHITE;
+	}
+	else
+		c = fz_tolower(c);
+	st->tok[st->len] = c;
+	st->start[st->len] = n;
+	st->len++;
+}
+
+static void
+load_search_text(fz_context *ctx, search_text *st, fz_text_page *page)
+{
+	int block_num, len, i;
+
+	memset(st, 0, sizeof *st);
+	len = textlen(ctx, page);
+
+	fz_try(ctx)
+	{
+		st->tok = fz_malloc_array(ctx, len + 1, sizeof(int));
+		st->start = fz_malloc_array(ctx, len + 1, sizeof(int));
+		st->span = fz_malloc_array(ctx, len + 1, sizeof(fz_text_span *));
+		st->idx = fz_malloc_array(ctx, len + 1, sizeof(int));
+	}
+	fz_catch(ctx)
+	{
+		drop_search_text(ctx, st);
+		fz_rethrow(ctx);
+	}
+
+	for (block_num = 0; block_num < page->len; block_num++)
+	{
+		fz_text_block *block;
+		fz_text_line *line;
+		fz_text_span *span;
+
+		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
+			continue;
+		block = page->blocks[block_num].u.text;
+		for (line = block->lines; line < block->lines + block->len; line++)
+		{
+			for (span = line->first_span; span; span = span->next)
+				for (i = 0; i < span->len; i++)
+					add_search_char(st, span->text[i].c, span, i);
+			add_search_char(st, ' ', NULL, 0); /* pseudo-newline */
+		}
+	}
+
+	/* Sentinel, so that the character count of the last token is
+	 * st->start[len] - st->start[len-1]. */
+	st->start[st->len] = st->tlen;
+}
+
+/* Fold and collapse the needle in the same way as the page text. */
+static int
+load_search_needle(const char *s, int *tok)
 {
-	int orig = n;
+	int n = 0;
 	int c;
+
 	while (*s)
 	{
 		s += fz_chartorune(&c, (char *)s);
-		if (iswhite(c) && iswhite(charat(ctx, page, n)))
+		if (iswhite(c))
 		{
-			const char *s_next;
-
-			/* Skip over whitespace in the document */
-			do
-				n++;
-			while (iswhite(charat(ctx, page, n)));
-
-			/* Skip over multiple whitespace in the search string */
-			while (s_next = s + fz_chartorune(&c, (char *)s), iswhite(c))
-				s = s_next;
+			if (n > 0 && tok[n-1] == WHITE)
+				continue;
+			c = WHITE;
 		}
 		else
+			c = fz_tolower(c);
+		tok[n++] = c;
+	}
+	return n;
+}
+
+static int
+add_search_hit(fz_context *ctx, search_text *st, int pos, int end, fz_rect *hit_bbox, int hit_count, int hit_max)
+{
+	fz_rect linebox = fz_empty_rect;
+	int i;
+
+	for (i = pos; i < end; i++)
+	{
+		fz_rect charbox;
+		if (!st->span[i])
+			continue;
+		fz_text_char_bbox(ctx, &charbox, st->span[i], st->idx[i]);
+		if (!fz_is_empty_rect(&charbox))
 		{
-			if (fz_tolower(c) != fz_tolower(charat(ctx, page, n)))
-				return 0;
-			n++;
+			if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
+			{
+				if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+					hit_bbox[hit_count++] = linebox;
+				linebox = charbox;
+			}
+			else
+			{
+				fz_union_rect(&linebox, &charbox);
+			}
 		}
 	}
-	return n - orig;
+	if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+		hit_bbox[hit_count++] = linebox;
+	return hit_count;
 }
 
 int
 fz_search_text_page(fz_context *ctx, fz_text_page *text, const char *needle, fz_rect *hit_bbox, int hit_max)
 {
-	int pos, len, i, n, hit_count;
+	search_text st;
+	int *pat = NULL;
+	int shift[256];
+	int m, j, k, last, hit_count;
 
 	if (strlen(needle) == 0)
 		return 0;
 
+	load_search_text(ctx, &st, text);
+
+	fz_var(pat);
+
 	hit_count = 0;
-	len = textlen(ctx, text);
-	for (pos = 0; pos < len; pos++)
+	fz_try(ctx)
 	{
-		n = match(ctx, text, needle, pos);
-		if (n)
+		pat = fz_malloc_array(ctx, strlen(needle), sizeof(int));
+		m = load_search_needle(needle, pat);
+
+		/* Boyer-Moore-Horspool over the folded tokens. The shift
+		 * table is indexed by the low byte of each token, which
+		 * only ever makes the shifts smaller (and so safe). */
+		last = m - 1;
+		for (k = 0; k < 256; k++)
+			shift[k] = m;
+		for (k = 0; k < last; k++)
+			shift[pat[k] & 255] = last - k;
+
+		j = 0;
+		while (j + m <= st.len && hit_count < hit_max)
 		{
-			fz_rect linebox = fz_empty_rect;
-			for (i = 0; i < n; i++)
+			int c = st.tok[j + last];
+			if (c == pat[last])
 			{
-				fz_rect charbox;
-				bboxat(ctx, text, pos + i, &charbox);
-				if (!fz_is_empty_rect(&charbox))
+				for (k = last - 1; k >= 0 && st.tok[j + k] == pat[k]; k--)
+					;
+				if (k < 0)
 				{
-					if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
-					{
-						if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-							hit_bbox[hit_count++] = linebox;
-						linebox = charbox;
-					}
-					else
-					{
-						fz_union_rect(&linebox, &charbox);
-					}
+					/* A match of tokens j to j+m-1. A leading
+					 * whitespace token also matches from each
+					 * later character of its run. */
+					int end = st.start[j + m];
+					int pos = st.start[j];
+					int pos_end = (pat[0] == WHITE) ? st.start[j + 1] : pos + 1;
+					for (; pos < pos_end; pos++)
+						hit_count = add_search_hit(ctx, &st, pos, end, hit_bbox, hit_count, hit_max);
 				}
 			}
-			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-				hit_bbox[hit_count++] = linebox;
+			j += shift[c & 255];
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, pat);
+		drop_search_text(ctx, &st);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 
 	return hit_count;
 }
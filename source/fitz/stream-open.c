@@ -1,3 +1,8 @@
+#define _LARGEFILE_SOURCE
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "mupdf/fitz.h"
 
 fz_stream *
@@ -81,10 +86,14 @@ static int next_file(fz_context *ctx, fz_stream *stm, int n)
 	return *stm->rp++;
 }
 
-static void seek_file(fz_context *ctx, fz_stream *stm, int offset, int whence)
+static void seek_file(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
 {
 	fz_file_stream *state = stm->state;
-	int n = lseek(state->file, offset, whence);
+#ifdef _WIN32
+	fz_off_t n = _lseeki64(state->file, offset, whence);
+#else
+	fz_off_t n = lseek(state->file, offset, whence);
+#endif
 	if (n < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot lseek: %s", strerror(errno));
 	stm->pos = n;
@@ -163,9 +172,9 @@ static int next_buffer(fz_context *ctx, fz_stream *stm, int max)
 	return EOF;
 }
 
-static void seek_buffer(fz_context *ctx, fz_stream *stm, int offset, int whence)
+static void seek_buffer(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
 {
-	int pos = stm->pos - (stm->wp - stm->rp);
+	fz_off_t pos = stm->pos - (stm->wp - stm->rp);
 	/* Convert to absolute pos */
 	if (whence == 1)
 	{
@@ -66,7 +66,7 @@ static int next_prog(fz_context *ctx, fz_stream *stm, int len)
 	return *stm->rp++;
 }
 
-static void seek_prog(fz_context *ctx, fz_stream *stm, int offset, int whence)
+static void seek_prog(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
 {
 	prog_state *ps = (prog_state *)stm->state;
 	int n;
@@ -16,7 +16,7 @@
 struct zip_entry
 {
 	char *name;
-	int offset, csize, usize;
+	fz_off_t offset, csize, usize;
 };
 
 struct fz_archive_s
@@ -25,6 +25,8 @@ struct fz_archive_s
 	fz_stream *file;
 	int count;
 	struct zip_entry *table;
+	int hash_size; /* a power of two */
+	int *hash; /* index into table, or -1 */
 };
 
 static inline int getshort(fz_context *ctx, fz_stream *file)
@@ -43,11 +45,17 @@ static inline int getlong(fz_context *ctx, fz_stream *file)
 	return a | b << 8 | c << 16 | d << 24;
 }
 
-static inline int getlong64(fz_context *ctx, fz_stream *file)
+static inline fz_off_t getulong(fz_context *ctx, fz_stream *file)
 {
-	int a = getlong(ctx, file);
-	int b = getlong(ctx, file);
-	return b != 0 ? -1 : a;
+	return (unsigned int)getlong(ctx, file);
+}
+
+/* Returns -1 for values that don't fit in a fz_off_t */
+static inline fz_off_t getlong64(fz_context *ctx, fz_stream *file)
+{
+	fz_off_t a = getulong(ctx, file);
+	fz_off_t b = getulong(ctx, file);
+	return b < 0x80000000 ? a | b << 32 : -1;
 }
 
 static inline int zip_isdigit(int c)
@@ -80,29 +88,60 @@ static int case_compare_entries(const void *a_, const void *b_)
 	return zip_strcasecmp(a->name, b->name);
 }
 
-static struct zip_entry *lookup_zip_entry(fz_context *ctx, fz_archive *zip, const char *name)
+/* FNV-1a of the upper-cased name, so that names equal for zip_strcasecmp hash alike */
+static unsigned int zip_hash(const char *s)
+{
+	unsigned int h = 2166136261U;
+	while (*s)
+	{
+		h ^= (unsigned char)zip_toupper(*s++);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void build_zip_hash(fz_context *ctx, fz_archive *zip)
 {
-	int l = 0;
-	int r = zip->count - 1;
-	while (l <= r)
+	int i, k, mask;
+
+	zip->hash_size = 16;
+	while (zip->hash_size / 2 < zip->count)
+		zip->hash_size <<= 1;
+	zip->hash = fz_malloc_array(ctx, zip->hash_size, sizeof *zip->hash);
+	memset(zip->hash, -1, zip->hash_size * sizeof *zip->hash);
+
+	mask = zip->hash_size - 1;
+	for (i = 0; i < zip->count; i++)
 	{
-		int m = (l + r) >> 1;
-		int c = zip_strcasecmp(name, zip->table[m].name);
-		if (c < 0)
-			r = m - 1;
-		else if (c > 0)
-			l = m + 1;
-		else
-			return &zip->table[m];
+		/* Keep the first of any names that only differ in case */
+		k = zip_hash(zip->table[i].name) & mask;
+		while (zip->hash[k] >= 0 && zip_strcasecmp(zip->table[i].name, zip->table[zip->hash[k]].name))
+			k = (k + 1) & mask;
+		if (zip->hash[k] < 0)
+			zip->hash[k] = i;
 	}
+}
+
+static struct zip_entry *lookup_zip_entry(fz_context *ctx, fz_archive *zip, const char *name)
+{
+	int k, mask;
+
+	if (!zip->hash)
+		return NULL;
+
+	mask = zip->hash_size - 1;
+	for (k = zip_hash(name) & mask; zip->hash[k] >= 0; k = (k + 1) & mask)
+		if (!zip_strcasecmp(name, zip->table[zip->hash[k]].name))
+			return &zip->table[zip->hash[k]];
 	return NULL;
 }
 
-static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
+static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, fz_off_t start_offset)
 {
 	fz_stream *file = zip->file;
 	int sig;
-	int offset, count;
+	fz_off_t offset;
+	int count;
 	int namesize, metasize, commentsize;
 	int i;
 
@@ -117,12 +156,12 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 	(void) getshort(ctx, file); /* entries in this disk */
 	count = getshort(ctx, file); /* entries in central directory disk */
 	(void) getlong(ctx, file); /* size of central directory */
-	offset = getlong(ctx, file); /* offset to central directory */
+	offset = getulong(ctx, file); /* offset to central directory */
 
 	/* ZIP64 */
 	if (count == 0xFFFF || offset == 0xFFFFFFFF)
 	{
-		int offset64, count64;
+		fz_off_t offset64, count64;
 
 		fz_seek(ctx, file, start_offset - 20, 0);
 
@@ -133,7 +172,7 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 		(void) getlong(ctx, file); /* start disk */
 		offset64 = getlong64(ctx, file); /* offset to end of central directory record */
 		if (offset64 < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 files larger than 2 GB aren't supported");
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 end of central directory offset out of range");
 
 		fz_seek(ctx, file, offset64, 0);
 
@@ -152,11 +191,15 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 		offset64 = getlong64(ctx, file); /* offset to central directory */
 
 		if (count == 0xFFFF)
+		{
+			if (count64 < 0 || count64 > INT_MAX / (int)sizeof *zip->table)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "too many entries in zip64 central directory");
 			count = count64;
+		}
 		if (offset == 0xFFFFFFFF)
 			offset = offset64;
-		if (count < 0 || offset < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 files larger than 2 GB aren't supported");
+		if (offset < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 central directory offset out of range");
 	}
 
 	zip->count = count;
@@ -178,15 +221,15 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 		(void) getshort(ctx, file); /* last mod file time */
 		(void) getshort(ctx, file); /* last mod file date */
 		(void) getlong(ctx, file); /* crc-32 */
-		zip->table[i].csize = getlong(ctx, file);
-		zip->table[i].usize = getlong(ctx, file);
+		zip->table[i].csize = getulong(ctx, file);
+		zip->table[i].usize = getulong(ctx, file);
 		namesize = getshort(ctx, file);
 		metasize = getshort(ctx, file);
 		commentsize = getshort(ctx, file);
 		(void) getshort(ctx, file); /* disk number start */
 		(void) getshort(ctx, file); /* int file atts */
 		(void) getlong(ctx, file); /* ext file atts */
-		zip->table[i].offset = getlong(ctx, file);
+		zip->table[i].offset = getulong(ctx, file);
 
 		zip->table[i].name = fz_malloc(ctx, namesize + 1);
 		fz_read(ctx, file, (unsigned char*)zip->table[i].name, namesize);
@@ -220,25 +263,28 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 			metasize -= 4 + size;
 		}
 		if (zip->table[i].usize < 0 || zip->table[i].csize < 0 || zip->table[i].offset < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 files larger than 2 GB are not supported");
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zip64 entry size or offset out of range");
 
 		fz_seek(ctx, file, commentsize, 1);
 	}
 
 	qsort(zip->table, count, sizeof *zip->table, case_compare_entries);
+
+	build_zip_hash(ctx, zip);
 }
 
 static void read_zip_dir(fz_context *ctx, fz_archive *zip)
 {
 	fz_stream *file = zip->file;
 	unsigned char buf[512];
-	int size, back, maxback;
+	fz_off_t size;
+	int back, maxback;
 	int i, n;
 
 	fz_seek(ctx, file, 0, SEEK_END);
 	size = fz_tell(ctx, file);
 
-	maxback = fz_mini(size, 0xFFFF + sizeof buf);
+	maxback = size < 0xFFFF + (int)sizeof buf ? (int)size : 0xFFFF + (int)sizeof buf;
 	back = fz_mini(maxback, sizeof buf);
 
 	while (back < maxback)
@@ -293,10 +339,11 @@ static fz_stream *open_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_en
 {
 	fz_stream *file = zip->file;
 	int method = read_zip_entry_header(ctx, zip, ent);
+	/* The filters take ownership of the archive's file */
 	if (method == 0)
-		return fz_open_null(ctx, file, ent->usize, fz_tell(ctx, file));
+		return fz_open_null(ctx, fz_keep_stream(ctx, file), ent->usize, fz_tell(ctx, file));
 	if (method == 8)
-		return fz_open_flated(ctx, file, -15);
+		return fz_open_flated(ctx, fz_keep_stream(ctx, file), -15);
 	fz_throw(ctx, FZ_ERROR_GENERIC, "unknown zip method: %d", method);
 }
 
@@ -309,16 +356,20 @@ static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_en
 	z_stream z;
 	int code;
 
+	/* Larger entries can still be read with fz_open_archive_entry */
+	if (ent->usize >= INT_MAX || ent->csize >= INT_MAX)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zip entry too large to read into memory: '%s'", ent->name);
+
 	method = read_zip_entry_header(ctx, zip, ent);
 
-	ubuf = fz_new_buffer(ctx, ent->usize + 1); /* +1 because many callers will add a terminating zero */
-	ubuf->len = ent->usize;
+	ubuf = fz_new_buffer(ctx, (int)ent->usize + 1); /* +1 because many callers will add a terminating zero */
+	ubuf->len = (int)ent->usize;
 
 	if (method == 0)
 	{
 		fz_try(ctx)
 		{
-			fz_read(ctx, file, ubuf->data, ent->usize);
+			fz_read(ctx, file, ubuf->data, ubuf->len);
 		}
 		fz_catch(ctx)
 		{
@@ -333,15 +384,15 @@ static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_en
 		cbuf = fz_malloc(ctx, ent->csize);
 		fz_try(ctx)
 		{
-			fz_read(ctx, file, cbuf, ent->csize);
+			fz_read(ctx, file, cbuf, (int)ent->csize);
 
 			z.zalloc = (alloc_func) fz_malloc_array;
 			z.zfree = (free_func) fz_free;
 			z.opaque = ctx;
 			z.next_in = cbuf;
-			z.avail_in = ent->csize;
+			z.avail_in = (uInt)ent->csize;
 			z.next_out = ubuf->data;
-			z.avail_out = ent->usize;
+			z.avail_out = (uInt)ent->usize;
 
 			code = inflateInit2(&z, -15);
 			if (code != Z_OK)
@@ -462,6 +513,7 @@ fz_drop_archive(fz_context *ctx, fz_archive *zip)
 		for (i = 0; i < zip->count; ++i)
 			fz_free(ctx, zip->table[i].name);
 		fz_free(ctx, zip->table);
+		fz_free(ctx, zip->hash);
 		fz_free(ctx, zip);
 	}
 }
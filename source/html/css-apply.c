@@ -577,42 +577,346 @@ add_property(fz_css_match *match, const char *name, fz_css_value *value, int spe
 	++match->count;
 }
 
-void
-fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *css, fz_xml *node)
+/*
+ * Rule index. Each selector can only match nodes that carry the id, class
+ * or tag of its rightmost simple selector, so selectors are bucketed by that
+ * key and only the buckets for a node's own id, classes and tag (and the
+ * universal selectors) are tested against it.
+ */
+
+enum { KEY_ID, KEY_CLASS, KEY_TAG, KEY_ANY };
+
+typedef struct css_index_entry_s css_index_entry;
+typedef struct css_inline_style_s css_inline_style;
+
+struct css_index_entry_s
 {
+	int type;
+	const char *key; /* empty for KEY_ANY */
+	int seq; /* position of the selector in the style sheet */
+	int spec;
 	fz_css_rule *rule;
 	fz_css_selector *sel;
-	fz_css_property *prop, *head, *tail;
-	const char *s;
+};
+
+/* Parsed style attributes, shared by all nodes with the same attribute. */
+struct css_inline_style_s
+{
+	char *source;
+	fz_css_property *declaration;
+	css_inline_style *next;
+};
+
+struct fz_css_index_s
+{
+	int len;
+	css_index_entry *entry; /* sorted by type, key and seq */
+	css_index_entry **cand;
+	int style_count, style_size;
+	css_inline_style **style_table;
+};
+
+static int
+index_key(fz_css_selector *sel, const char **key)
+{
+	fz_css_condition *cond;
+	const char *cls = NULL;
+
+	while (sel->combine)
+		sel = sel->right;
+
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		switch (cond->type)
+		{
+		default: return -1; /* can never match */
+		case '#': *key = cond->val; return KEY_ID;
+		case '.': if (!cls) cls = cond->val; break;
+		}
+	}
+
+	if (cls)
+	{
+		*key = cls;
+		return KEY_CLASS;
+	}
+	if (sel->name)
+	{
+		*key = sel->name;
+		return KEY_TAG;
+	}
+	*key = "";
+	return KEY_ANY;
+}
+
+static int
+cmp_index_entry(const void *a_, const void *b_)
+{
+	const css_index_entry *a = a_, *b = b_;
+	int d;
+	if (a->type != b->type)
+		return a->type - b->type;
+	d = strcmp(a->key, b->key);
+	if (d)
+		return d;
+	return a->seq - b->seq;
+}
+
+static int
+cmp_index_seq(const void *a_, const void *b_)
+{
+	const css_index_entry *a = *(css_index_entry * const *)a_;
+	const css_index_entry *b = *(css_index_entry * const *)b_;
+	return a->seq - b->seq;
+}
+
+/* Compare an entry's key against the n bytes at s. */
+static int
+cmp_index_key(css_index_entry *entry, int type, const char *s, int n)
+{
+	int d;
+	if (entry->type != type)
+		return entry->type - type;
+	d = strncmp(entry->key, s, n);
+	if (d)
+		return d;
+	return entry->key[n] != 0;
+}
+
+static int
+find_index_entries(fz_css_index *index, int type, const char *s, int n, int count)
+{
+	int l = 0, r = index->len;
+
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (cmp_index_key(&index->entry[m], type, s, n) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	while (l < index->len && !cmp_index_key(&index->entry[l], type, s, n))
+		index->cand[count++] = &index->entry[l++];
+
+	return count;
+}
+
+/* Has the class name at s already appeared earlier in the class attribute? */
+static int
+seen_class(const char *att, const char *s, int n)
+{
+	while (att < s)
+	{
+		const char *e;
+		while (*att == ' ')
+			++att;
+		e = att;
+		while (*e && *e != ' ')
+			++e;
+		if (att < s && e - att == n && !memcmp(att, s, n))
+			return 1;
+		att = e;
+	}
+	return 0;
+}
+
+fz_css_index *
+fz_new_css_index(fz_context *ctx, fz_css_rule *css)
+{
+	fz_css_index *index;
+	fz_css_rule *rule;
+	fz_css_selector *sel;
+	int n = 0, seq = 0;
+
+	for (rule = css; rule; rule = rule->next)
+		for (sel = rule->selector; sel; sel = sel->next)
+			++n;
+
+	index = fz_malloc_struct(ctx, fz_css_index);
+	fz_try(ctx)
+	{
+		index->entry = fz_malloc_array(ctx, n, sizeof *index->entry);
+		index->cand = fz_malloc_array(ctx, n, sizeof *index->cand);
+		index->style_table = fz_calloc(ctx, 64, sizeof *index->style_table);
+		index->style_size = 64;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_css_index(ctx, index);
+		fz_rethrow(ctx);
+	}
 
 	for (rule = css; rule; rule = rule->next)
 	{
-		sel = rule->selector;
-		while (sel)
+		for (sel = rule->selector; sel; sel = sel->next, ++seq)
 		{
-			if (match_selector(sel, node))
-			{
-				for (prop = rule->declaration; prop; prop = prop->next)
-					add_property(match, prop->name, prop->value, selector_specificity(sel));
-				break;
-			}
-			sel = sel->next;
+			css_index_entry *entry = &index->entry[index->len];
+			entry->type = index_key(sel, &entry->key);
+			if (entry->type < 0)
+				continue;
+			entry->seq = seq;
+			entry->spec = selector_specificity(sel);
+			entry->rule = rule;
+			entry->sel = sel;
+			++index->len;
 		}
 	}
 
-	s = fz_xml_att(node, "style");
+	qsort(index->entry, index->len, sizeof *index->entry, cmp_index_entry);
+
+	return index;
+}
+
+void
+fz_drop_css_index(fz_context *ctx, fz_css_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->style_size; ++i)
+	{
+		css_inline_style *style = index->style_table[i];
+		while (style)
+		{
+			css_inline_style *next = style->next;
+			fz_drop_css_property(ctx, style->declaration);
+			fz_free(ctx, style->source);
+			fz_free(ctx, style);
+			style = next;
+		}
+	}
+	fz_free(ctx, index->style_table);
+	fz_free(ctx, index->cand);
+	fz_free(ctx, index->entry);
+	fz_free(ctx, index);
+}
+
+static unsigned int
+hash_inline_style(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static void
+grow_inline_styles(fz_context *ctx, fz_css_index *index)
+{
+	int new_size = index->style_size * 2;
+	css_inline_style **table = fz_calloc(ctx, new_size, sizeof *table);
+	int i;
+
+	for (i = 0; i < index->style_size; ++i)
+	{
+		css_inline_style *style = index->style_table[i];
+		while (style)
+		{
+			css_inline_style *next = style->next;
+			int k = hash_inline_style(style->source) & (new_size - 1);
+			style->next = table[k];
+			table[k] = style;
+			style = next;
+		}
+	}
+
+	fz_free(ctx, index->style_table);
+	index->style_table = table;
+	index->style_size = new_size;
+}
+
+static fz_css_property *
+lookup_inline_style(fz_context *ctx, fz_css_index *index, const char *source)
+{
+	css_inline_style *style;
+	int k;
+
+	k = hash_inline_style(source) & (index->style_size - 1);
+	for (style = index->style_table[k]; style; style = style->next)
+		if (!strcmp(style->source, source))
+			return style->declaration;
+
+	if (index->style_count >= index->style_size)
+	{
+		grow_inline_styles(ctx, index);
+		k = hash_inline_style(source) & (index->style_size - 1);
+	}
+
+	style = fz_malloc_struct(ctx, css_inline_style);
+	fz_try(ctx)
+	{
+		style->source = fz_strdup(ctx, source);
+		style->declaration = fz_parse_css_properties(ctx, source);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, style->source);
+		fz_free(ctx, style);
+		fz_rethrow(ctx);
+	}
+
+	style->next = index->style_table[k];
+	index->style_table[k] = style;
+	++index->style_count;
+
+	return style->declaration;
+}
+
+void
+fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_index *index, fz_xml *node)
+{
+	fz_css_property *prop;
+	fz_css_rule *matched = NULL;
+	const char *tag = fz_xml_tag(node);
+	const char *cls = fz_xml_att(node, "class");
+	const char *s, *e;
+	int i, n = 0;
+
+	s = fz_xml_att(node, "id");
 	if (s)
+		n = find_index_entries(index, KEY_ID, s, strlen(s), n);
+
+	s = cls;
+	while (s && *s)
+	{
+		while (*s == ' ')
+			++s;
+		e = s;
+		while (*e && *e != ' ')
+			++e;
+		if (e > s && !seen_class(cls, s, e - s))
+			n = find_index_entries(index, KEY_CLASS, s, e - s, n);
+		s = e;
+	}
+
+	n = find_index_entries(index, KEY_TAG, tag, strlen(tag), n);
+	n = find_index_entries(index, KEY_ANY, "", 0, n);
+
+	/* Visit the candidates in style sheet order, and apply the first
+	 * selector of each rule that matches, as a walk over every rule would. */
+	qsort(index->cand, n, sizeof *index->cand, cmp_index_seq);
+	for (i = 0; i < n; ++i)
 	{
-		head = tail = prop = fz_parse_css_properties(ctx, s);
-		while (prop)
+		css_index_entry *entry = index->cand[i];
+		if (entry->rule == matched)
+			continue;
+		if (match_selector(entry->sel, node))
 		{
-			add_property(match, prop->name, prop->value, INLINE_SPECIFICITY);
-			tail = prop;
-			prop = prop->next;
+			for (prop = entry->rule->declaration; prop; prop = prop->next)
+				add_property(match, prop->name, prop->value, entry->spec);
+			matched = entry->rule;
 		}
-		if (tail)
-			tail->next = css->garbage;
-		css->garbage = head;
+	}
+
+	s = fz_xml_att(node, "style");
+	if (s)
+	{
+		for (prop = lookup_inline_style(ctx, index, s); prop; prop = prop->next)
+			add_property(match, prop->name, prop->value, INLINE_SPECIFICITY);
 	}
 }
 
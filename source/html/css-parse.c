@@ -23,7 +23,6 @@ static fz_css_rule *fz_new_css_rule(fz_context *ctx, fz_css_selector *selector,
 	fz_css_rule *rule = fz_malloc_struct(ctx, fz_css_rule);
 	rule->selector = selector;
 	rule->declaration = declaration;
-	rule->garbage = NULL;
 	rule->next = NULL;
 	return rule;
 }
@@ -108,7 +107,7 @@ static void fz_drop_css_selector(fz_context *ctx, fz_css_selector *sel)
 	}
 }
 
-static void fz_drop_css_property(fz_context *ctx, fz_css_property *prop)
+void fz_drop_css_property(fz_context *ctx, fz_css_property *prop)
 {
 	while (prop)
 	{
@@ -127,7 +126,6 @@ void fz_drop_css(fz_context *ctx, fz_css_rule *rule)
 		fz_css_rule *next = rule->next;
 		fz_drop_css_selector(ctx, rule->selector);
 		fz_drop_css_property(ctx, rule->declaration);
-		fz_drop_css_property(ctx, rule->garbage);
 		fz_free(ctx, rule);
 		rule = next;
 	}
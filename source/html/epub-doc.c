@@ -13,15 +13,20 @@ struct epub_document_s
 	fz_html_font_set *set;
 	float page_w, page_h, em;
 	float page_margin[4];
-	int count;
+	int count, cap;
 	epub_chapter *spine;
+	/* Chapters are laid out on demand, in order. The first 'laid_out'
+	 * chapters have exact start pages and hold 'laid_out_pages' pages
+	 * between them; the page counts of the rest are estimated. */
+	int laid_out;
+	int laid_out_pages;
 };
 
 struct epub_chapter_s
 {
+	char *path;
 	int start;
 	fz_html *box;
-	epub_chapter *next;
 };
 
 struct epub_page_s
@@ -35,7 +40,6 @@ static void
 epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_chapter *ch;
 
 	doc->page_margin[T] = em;
 	doc->page_margin[B] = em;
@@ -46,21 +50,96 @@ epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
 	doc->page_h = h - doc->page_margin[T] - doc->page_margin[B];
 	doc->em = em;
 
-	printf("epub: laying out chapters.\n");
-	for (ch = doc->spine; ch; ch = ch->next)
+	/* Chapters are laid out again as their pages are needed. */
+	doc->laid_out = 0;
+	doc->laid_out_pages = 0;
+}
+
+static void
+epub_layout_next_chapter(fz_context *ctx, epub_document *doc)
+{
+	epub_chapter *ch = &doc->spine[doc->laid_out];
+
+	if (!ch->box)
+	{
+		fz_buffer *buf = NULL;
+		char base_uri[2048];
+
+		fz_var(buf);
+
+		fz_dirname(base_uri, ch->path, sizeof base_uri);
+
+		fz_try(ctx)
+		{
+			buf = fz_read_archive_entry(ctx, doc->zip, ch->path);
+			fz_write_buffer_byte(ctx, buf, 0);
+			ch->box = fz_parse_html(ctx, doc->set, doc->zip, base_uri, buf, NULL);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			fz_warn(ctx, "cannot parse chapter: %s", ch->path);
+		}
+	}
+
+	ch->start = doc->laid_out_pages;
+	if (ch->box)
+	{
 		fz_layout_html(ctx, ch->box, doc->page_w, doc->page_h, doc->em);
-	printf("epub: done.\n");
+		doc->laid_out_pages += ceilf(ch->box->h / doc->page_h);
+	}
+	doc->laid_out++;
+}
+
+/* Find the chapter holding page n, laying out chapters up to it as
+ * needed. Returns -1 if the document has fewer pages. */
+static int
+epub_find_chapter(fz_context *ctx, epub_document *doc, int n)
+{
+	int l, r;
+
+	while (n >= doc->laid_out_pages)
+	{
+		if (doc->laid_out == doc->count)
+			return -1;
+		epub_layout_next_chapter(ctx, doc);
+	}
+
+	/* Binary search for the last chapter that starts at or before n. */
+	l = 0;
+	r = doc->laid_out - 1;
+	while (l < r)
+	{
+		int m = (l + r + 1) >> 1;
+		if (doc->spine[m].start <= n)
+			l = m;
+		else
+			r = m - 1;
+	}
+	return l;
 }
 
 static int
 epub_count_pages(fz_context *ctx, fz_document *doc_)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_chapter *ch;
-	int count = 0;
-	for (ch = doc->spine; ch; ch = ch->next)
-		count += ceilf(ch->box->h / doc->page_h);
-	return count;
+	int left = doc->count - doc->laid_out;
+	int estimate;
+
+	/* Assume the chapters not yet laid out are as long as the average
+	 * of those that have been, and at least a page each. */
+	if (doc->laid_out > 0)
+		estimate = ceilf((float)left * doc->laid_out_pages / doc->laid_out);
+	else
+		estimate = left;
+	if (estimate < left)
+		estimate = left;
+
+	return doc->laid_out_pages + estimate;
 }
 
 static void
@@ -88,27 +167,29 @@ epub_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *
 	epub_chapter *ch;
 	fz_matrix local_ctm = *ctm;
 	int n = page->number;
-	int count = 0;
+	int i;
 
 	fz_pre_translate(&local_ctm, doc->page_margin[L], doc->page_margin[T]);
 
-	for (ch = doc->spine; ch; ch = ch->next)
-	{
-		int cn = ceilf(ch->box->h / doc->page_h);
-		if (n < count + cn)
-		{
-			fz_draw_html(ctx, ch->box, (n-count) * doc->page_h, (n-count+1) * doc->page_h, dev, &local_ctm);
-			break;
-		}
-		count += cn;
-	}
+	i = epub_find_chapter(ctx, doc, n);
+	if (i < 0)
+		return;
+	ch = &doc->spine[i];
+	if (ch->box)
+		fz_draw_html(ctx, ch->box, (n - ch->start) * doc->page_h, (n - ch->start + 1) * doc->page_h, dev, &local_ctm);
 }
 
 static fz_page *
 epub_load_page(fz_context *ctx, fz_document *doc_, int number)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_page *page = fz_new_page(ctx, sizeof *page);
+	epub_page *page;
+
+	/* Lay out the chapters up to this page now, so that the page count
+	 * is up to date once the page is loaded. */
+	epub_find_chapter(ctx, doc, number);
+
+	page = fz_new_page(ctx, sizeof *page);
 	page->super.bound_page = epub_bound_page;
 	page->super.run_page_contents = epub_run_page;
 	page->super.drop_page_imp = epub_drop_page_imp;
@@ -121,15 +202,13 @@ static void
 epub_close_document(fz_context *ctx, fz_document *doc_)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_chapter *ch, *next;
-	ch = doc->spine;
-	while (ch)
+	int i;
+	for (i = 0; i < doc->count; i++)
 	{
-		next = ch->next;
-		fz_drop_html(ctx, ch->box);
-		fz_free(ctx, ch);
-		ch = next;
+		fz_drop_html(ctx, doc->spine[i].box);
+		fz_free(ctx, doc->spine[i].path);
 	}
+	fz_free(ctx, doc->spine);
 	fz_drop_archive(ctx, doc->zip);
 	fz_drop_html_font_set(ctx, doc->set);
 	fz_free(ctx, doc);
@@ -167,26 +246,19 @@ path_from_idref(char *path, fz_xml *manifest, const char *base_uri, const char *
 	return fz_cleanname(path);
 }
 
-static epub_chapter *
-epub_parse_chapter(fz_context *ctx, epub_document *doc, const char *path)
+static void
+epub_add_chapter(fz_context *ctx, epub_document *doc, const char *path)
 {
-	fz_archive *zip = doc->zip;
-	fz_buffer *buf;
-	epub_chapter *ch;
-	char base_uri[2048];
-
-	fz_dirname(base_uri, path, sizeof base_uri);
-
-	buf = fz_read_archive_entry(ctx, zip, path);
-	fz_write_buffer_byte(ctx, buf, 0);
-
-	ch = fz_malloc_struct(ctx, epub_chapter);
-	ch->box = fz_parse_html(ctx, doc->set, zip, base_uri, buf, NULL);
-	ch->next = NULL;
-
-	fz_drop_buffer(ctx, buf);
-
-	return ch;
+	if (doc->count == doc->cap)
+	{
+		int new_cap = doc->cap ? doc->cap * 2 : 32;
+		doc->spine = fz_resize_array(ctx, doc->spine, new_cap, sizeof *doc->spine);
+		doc->cap = new_cap;
+	}
+	doc->spine[doc->count].path = fz_strdup(ctx, path);
+	doc->spine[doc->count].start = 0;
+	doc->spine[doc->count].box = NULL;
+	doc->count++;
 }
 
 static void
@@ -200,8 +272,7 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 	char base_uri[2048];
 	const char *full_path;
 	const char *version;
-	char ncx[2048], s[2048];
-	epub_chapter *head, *tail;
+	char s[2048];
 
 	/* parse META-INF/container.xml to find OPF */
 
@@ -217,8 +288,6 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 	if (!full_path)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find root file in EPUB");
 
-	printf("epub: found root: %s\n", full_path);
-
 	fz_dirname(base_uri, full_path, sizeof base_uri);
 
 	/* parse OPF to find NCX and spine */
@@ -236,31 +305,16 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 	manifest = fz_xml_find_down(package, "manifest");
 	spine = fz_xml_find_down(package, "spine");
 
-	if (path_from_idref(ncx, manifest, base_uri, fz_xml_att(spine, "toc"), sizeof ncx))
-	{
-		/* TODO: parse NCX to create fz_outline */
-		printf("epub: found outline: %s\n", ncx);
-	}
+	/* TODO: parse NCX to create fz_outline */
 
-	head = tail = NULL;
 	itemref = fz_xml_find_down(spine, "itemref");
 	while (itemref)
 	{
 		if (path_from_idref(s, manifest, base_uri, fz_xml_att(itemref, "idref"), sizeof s))
-		{
-			printf("epub: found spine %s\n", s);
-			if (!head)
-				head = tail = epub_parse_chapter(ctx, doc, s);
-			else
-				tail = tail->next = epub_parse_chapter(ctx, doc, s);
-		}
+			epub_add_chapter(ctx, doc, s);
 		itemref = fz_xml_find_next(itemref, "itemref");
 	}
 
-	doc->spine = head;
-
-	printf("epub: done.\n");
-
 	fz_drop_xml(ctx, container_xml);
 	fz_drop_xml(ctx, content_opf);
 }
@@ -270,7 +324,7 @@ epub_init(fz_context *ctx, fz_archive *zip)
 {
 	epub_document *doc;
 
-	doc = fz_malloc_struct(ctx, epub_document);
+	doc = fz_new_document(ctx, sizeof *doc);
 	doc->zip = zip;
 	doc->set = fz_new_html_font_set(ctx);
 
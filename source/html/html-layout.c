@@ -59,6 +59,7 @@ static fz_html_flow *add_flow(fz_context *ctx, fz_html *top, fz_css_style *style
 	fz_html_flow *flow = fz_malloc_struct(ctx, fz_html_flow);
 	flow->type = type;
 	flow->style = style;
+	flow->unit_w = -1;
 	*top->flow_tail = flow;
 	top->flow_tail = &flow->next;
 	return flow;
@@ -161,6 +162,9 @@ static void init_box(fz_context *ctx, fz_html *box)
 	box->flow_head = NULL;
 	box->flow_tail = &box->flow_head;
 
+	box->page_count = 0;
+	box->pages = NULL;
+
 	fz_default_css_style(ctx, &box->style);
 }
 
@@ -171,6 +175,7 @@ void fz_drop_html(fz_context *ctx, fz_html *box)
 		fz_html *next = box->next;
 		fz_drop_html_flow(ctx, box->flow_head);
 		fz_drop_html(ctx, box->down);
+		fz_free(ctx, box->pages);
 		fz_free(ctx, box);
 		box = next;
 	}
@@ -271,14 +276,48 @@ static void insert_inline_box(fz_context *ctx, fz_html *box, fz_html *top)
 	}
 }
 
+static int same_css_match(fz_css_match *a, fz_css_match *b)
+{
+	int i;
+	if (a->up != b->up || a->count != b->count)
+		return 0;
+	for (i = 0; i < a->count; ++i)
+		if (a->prop[i].name != b->prop[i].name || a->prop[i].value != b->prop[i].value)
+			return 0;
+	return 1;
+}
+
+/* Siblings often match exactly the same properties; reuse the style computed
+ * for the last sibling that was styled rather than computing it again. */
+static void apply_css_style(fz_context *ctx, fz_html_font_set *set, fz_css_style *style, fz_css_match *match,
+	fz_css_match *last_match, fz_css_style *last_style)
+{
+	if (same_css_match(match, last_match))
+	{
+		*style = *last_style;
+		return;
+	}
+
+	fz_apply_css_style(ctx, set, style, match);
+
+	last_match->up = match->up;
+	last_match->count = match->count;
+	memcpy(last_match->prop, match->prop, match->count * sizeof match->prop[0]);
+	*last_style = *style;
+}
+
 static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const char *base_uri,
-	fz_xml *node, fz_html *top, fz_css_rule *rule, fz_css_match *up_match, int list_counter)
+	fz_xml *node, fz_html *top, fz_css_index *css, fz_css_match *up_match, int list_counter)
 {
-	fz_css_match match;
+	fz_css_match match, last_match;
+	fz_css_style last_style;
 	fz_html *box;
 	const char *tag;
 	int display;
 
+	last_match.up = NULL;
+	last_match.count = -1;
+
 	while (node)
 	{
 		match.up = up_match;
@@ -287,14 +326,14 @@ static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *z
 		tag = fz_xml_tag(node);
 		if (tag)
 		{
-			fz_match_css(ctx, &match, rule, node);
+			fz_match_css(ctx, &match, css, node);
 
 			display = fz_get_css_match_display(&match);
 
 			if (!strcmp(tag, "br"))
 			{
 				box = new_box(ctx);
-				fz_apply_css_style(ctx, set, &box->style, &match);
+				apply_css_style(ctx, set, &box->style, &match, &last_match, &last_style);
 				top = insert_break_box(ctx, box, top);
 			}
 
@@ -304,7 +343,7 @@ static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *z
 				if (src)
 				{
 					box = new_box(ctx);
-					fz_apply_css_style(ctx, set, &box->style, &match);
+					apply_css_style(ctx, set, &box->style, &match, &last_match, &last_style);
 					insert_inline_box(ctx, box, top);
 					generate_image(ctx, zip, base_uri, box, src);
 				}
@@ -313,7 +352,7 @@ static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *z
 			else if (display != DIS_NONE)
 			{
 				box = new_box(ctx);
-				fz_apply_css_style(ctx, set, &box->style, &match);
+				apply_css_style(ctx, set, &box->style, &match, &last_match, &last_style);
 
 				if (display == DIS_BLOCK)
 				{
@@ -339,7 +378,7 @@ static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *z
 					int child_counter = list_counter;
 					if (!strcmp(tag, "ul") || !strcmp(tag, "ol"))
 						child_counter = 0;
-					generate_boxes(ctx, set, zip, base_uri, fz_xml_down(node), box, rule, &match, child_counter);
+					generate_boxes(ctx, set, zip, base_uri, fz_xml_down(node), box, css, &match, child_counter);
 				}
 
 				// TODO: remove empty flow boxes
@@ -382,6 +421,8 @@ static void measure_image(fz_context *ctx, fz_html_flow *node, float w, float h)
 	node->h = node->image->h * s;
 }
 
+/* The glyph advances only depend on the font and the text, so they are
+ * summed once and scaled to the em size on each layout. */
 static void measure_word(fz_context *ctx, fz_html_flow *node, float em)
 {
 	const char *s;
@@ -393,15 +434,19 @@ static void measure_word(fz_context *ctx, fz_html_flow *node, float em)
 	node->y = 0;
 	node->h = fz_from_css_number_scale(node->style->line_height, em, em, em);
 
-	w = 0;
-	s = node->text;
-	while (*s)
+	if (node->unit_w < 0)
 	{
-		s += fz_chartorune(&c, s);
-		g = fz_encode_character(ctx, node->style->font, c);
-		w += fz_advance_glyph(ctx, node->style->font, g) * em;
+		w = 0;
+		s = node->text;
+		while (*s)
+		{
+			s += fz_chartorune(&c, s);
+			g = fz_encode_character(ctx, node->style->font, c);
+			w += fz_advance_glyph(ctx, node->style->font, g);
+		}
+		node->unit_w = w;
 	}
-	node->w = w;
+	node->w = node->unit_w * em;
 	node->em = em;
 }
 
@@ -693,7 +738,7 @@ static void layout_block(fz_context *ctx, fz_html *box, fz_html *top, float em,
 	}
 }
 
-static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm)
+static int draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, fz_html_page *page)
 {
 	fz_html_flow *node;
 	fz_text *text;
@@ -701,10 +746,25 @@ static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float p
 	const char *s;
 	float color[3];
 	float x, y;
-	int c, g;
+	int c, g, seq;
 
-	for (node = box->flow_head; node; node = node->next)
+	node = box->flow_head;
+	seq = box->seq + 1;
+	if (page && page->start == box)
+	{
+		if (page->start_flow)
+		{
+			node = page->start_flow;
+			seq = page->start_seq;
+		}
+		page->start = NULL;
+	}
+
+	for (; node; node = node->next, seq++)
 	{
+		if (page && seq > page->end)
+			return 1;
+
 		if (node->type == FLOW_IMAGE)
 		{
 			if (node->y >= page_bot || node->y + node->h <= page_top)
@@ -748,6 +808,8 @@ static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float p
 			fz_fill_image(ctx, dev, node->image, &local_ctm, 1);
 		}
 	}
+
+	return 0;
 }
 
 static void draw_rect(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, fz_css_color color, float x0, float y0, float x1, float y1)
@@ -900,20 +962,44 @@ static void draw_list_mark(fz_context *ctx, fz_html *box, float page_top, float
 	fz_drop_text(ctx, text);
 }
 
-static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm)
+/* The child of box to start drawing at: the one leading to the start of the page, if it is inside box. */
+static fz_html *first_child_to_draw(fz_html *box, fz_html_page *page)
+{
+	fz_html *child;
+
+	if (!page || !page->start)
+		return box->down;
+
+	if (page->start == box)
+	{
+		page->start = NULL;
+		return box->down;
+	}
+
+	child = page->start;
+	while (child->up != box)
+		child = child->up;
+	return child;
+}
+
+/* Returns 1 when the end of the page has been reached, and nothing after it needs drawing. */
+static int draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, fz_html_page *page)
 {
 	float x0, y0, x1, y1;
 
 	float *border = box->border;
 	float *padding = box->padding;
 
+	if (page && box->seq > page->end)
+		return 1;
+
 	x0 = box->x - padding[L];
 	y0 = box->y - padding[T];
 	x1 = box->x + box->w + padding[R];
 	y1 = box->y + box->h + padding[B];
 
 	if (y0 > page_bot || y1 < page_top)
-		return;
+		return 0;
 
 	draw_rect(ctx, dev, ctm, box->style.background_color, x0, y0, x1, y1);
 
@@ -931,22 +1017,50 @@ static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float
 		draw_list_mark(ctx, box, page_top, page_bot, dev, ctm, box->list_item);
 	}
 
-	for (box = box->down; box; box = box->next)
+	for (box = first_child_to_draw(box, page); box; box = box->next)
 	{
 		switch (box->type)
 		{
-		case BOX_BLOCK: draw_block_box(ctx, box, page_top, page_bot, dev, ctm); break;
-		case BOX_FLOW: draw_flow_box(ctx, box, page_top, page_bot, dev, ctm); break;
+		case BOX_BLOCK:
+			if (draw_block_box(ctx, box, page_top, page_bot, dev, ctm, page))
+				return 1;
+			break;
+		case BOX_FLOW:
+			if (draw_flow_box(ctx, box, page_top, page_bot, dev, ctm, page))
+				return 1;
+			break;
 		}
+		/* Whether or not it was reached, the start of the page has been passed */
+		if (page)
+			page->start = NULL;
 	}
+
+	return 0;
 }
 
 void
 fz_draw_html(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *inctm)
 {
 	fz_matrix ctm = *inctm;
+	fz_html_page page;
+	float h = box->page_h;
+	int n;
+
 	fz_pre_translate(&ctm, 0, -page_top);
-	draw_block_box(ctx, box, page_top, page_bot, dev, &ctm);
+
+	/* Use the page index when drawing exactly one of the pages it was built for */
+	if (box->pages && h > 0 && page_top >= 0 && page_top / h < box->page_count)
+	{
+		n = page_top / h + 0.5f;
+		if (n * h == page_top && (n + 1) * h == page_bot)
+		{
+			page = box->pages[n];
+			draw_block_box(ctx, box, page_top, page_bot, dev, &ctm, &page);
+			return;
+		}
+	}
+
+	draw_block_box(ctx, box, page_top, page_bot, dev, &ctm, NULL);
 }
 
 static char *concat_text(fz_context *ctx, fz_xml *root)
@@ -1026,6 +1140,192 @@ html_load_css(fz_context *ctx, fz_archive *zip, const char *base_uri, fz_css_rul
 	return css;
 }
 
+/*
+ * The page index. Pages are drawn with page_top = n * page_h, and everything
+ * in the tree that lies wholly above or below a page is culled when drawing it.
+ * Seen in drawing order, the first boxes and nodes are above a page, and the last
+ * are below it, so layout records where the page's content starts and ends.
+ *
+ * The tests mirror those in draw_flow_box and draw_block_box exactly, so the
+ * index skips only what a full walk of the tree would have culled.
+ */
+
+/* The last page whose top is above v (or at v, if !strict), or -1 if there is none. */
+static int last_page_above(float v, float page_h, int count, int strict)
+{
+	float f = v / page_h;
+	int p;
+
+	if (v != v)
+		return count - 1;
+	if (!(f > -1))
+		return -1;
+	if (f >= count)
+		return count - 1;
+
+	p = f;
+	while (p >= 0 && !(strict ? p * page_h < v : p * page_h <= v))
+		p--;
+	while (p + 1 < count && (strict ? (p + 1) * page_h < v : (p + 1) * page_h <= v))
+		p++;
+	return p;
+}
+
+/* The first page whose bottom is below v (or at v, if !strict), or count if there is none. */
+static int first_page_below(float v, float page_h, int count, int strict)
+{
+	float f = v / page_h;
+	int p;
+
+	if (v != v)
+		return 0;
+	if (!(f < count))
+		return count;
+	if (f < 0)
+		return 0;
+
+	p = f;
+	while (p > 0 && (strict ? p * page_h > v : p * page_h >= v))
+		p--;
+	while (p < count && !(strict ? (p + 1) * page_h > v : (p + 1) * page_h >= v))
+		p++;
+	return p;
+}
+
+static void note_page_end(fz_html_page *pages, int count, int first, int seq)
+{
+	if (first < count && seq > pages[first].end)
+		pages[first].end = seq;
+}
+
+/* Number the boxes and nodes in drawing order, and find the last page each box reaches. */
+static void index_box_pages(fz_html *box, fz_html_page *pages, int count, float page_h, int *seq)
+{
+	fz_html *child;
+	fz_html_flow *node;
+	float y0, y1;
+	int last = -1;
+
+	box->seq = (*seq)++;
+
+	if (box->type == BOX_FLOW)
+	{
+		for (node = box->flow_head; node; node = node->next)
+		{
+			int node_seq = (*seq)++;
+			if (node->type == FLOW_WORD)
+			{
+				last = fz_maxi(last, last_page_above(node->y, page_h, count, 0));
+				note_page_end(pages, count, first_page_below(node->y, page_h, count, 0), node_seq);
+			}
+			else if (node->type == FLOW_IMAGE)
+			{
+				last = fz_maxi(last, last_page_above(node->y + node->h, page_h, count, 1));
+				note_page_end(pages, count, first_page_below(node->y, page_h, count, 1), node_seq);
+			}
+		}
+	}
+	else
+	{
+		y0 = box->y - box->padding[T];
+		y1 = box->y + box->h + box->padding[B];
+		last = last_page_above(y1, page_h, count, 0);
+		note_page_end(pages, count, first_page_below(y0, page_h, count, 0), box->seq);
+
+		for (child = box->down; child; child = child->next)
+		{
+			if (child->type == BOX_BLOCK || child->type == BOX_FLOW)
+			{
+				index_box_pages(child, pages, count, page_h, seq);
+				last = fz_maxi(last, child->last_page);
+			}
+		}
+	}
+
+	box->last_page = last;
+}
+
+/* Each page in lo..hi starts inside box; find the child or node it starts at. */
+static void assign_page_starts(fz_html *box, fz_html_page *pages, int lo, int hi, float page_h, int count)
+{
+	fz_html *child;
+	fz_html_flow *node;
+	int last, seq;
+
+	if (box->type == BOX_FLOW)
+	{
+		seq = box->seq + 1;
+		for (node = box->flow_head; node && lo <= hi; node = node->next, seq++)
+		{
+			if (node->type == FLOW_WORD)
+				last = last_page_above(node->y, page_h, count, 0);
+			else if (node->type == FLOW_IMAGE)
+				last = last_page_above(node->y + node->h, page_h, count, 1);
+			else
+				continue;
+			for (; lo <= last && lo <= hi; lo++)
+			{
+				pages[lo].start = box;
+				pages[lo].start_flow = node;
+				pages[lo].start_seq = seq;
+			}
+		}
+	}
+	else
+	{
+		for (child = box->down; child && lo <= hi; child = child->next)
+		{
+			if (child->type == BOX_BLOCK || child->type == BOX_FLOW)
+			{
+				last = fz_mini(hi, child->last_page);
+				if (last >= lo)
+				{
+					assign_page_starts(child, pages, lo, last, page_h, count);
+					lo = last + 1;
+				}
+			}
+		}
+	}
+
+	/* Nothing in box reaches the remaining pages */
+	for (; lo <= hi; lo++)
+	{
+		pages[lo].start = box;
+		pages[lo].start_flow = NULL;
+		pages[lo].start_seq = 0;
+	}
+}
+
+static void index_pages(fz_context *ctx, fz_html *box, float page_h)
+{
+	float n = ceilf(box->h / page_h);
+	int i, count, seq = 0;
+
+	if (!(n > 0 && n <= INT_MAX / (int)sizeof(fz_html_page)))
+		return;
+	count = n;
+
+	fz_try(ctx)
+		box->pages = fz_malloc_array(ctx, count, sizeof(fz_html_page));
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot index pages for layout");
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		box->pages[i].end = -1;
+
+	index_box_pages(box, box->pages, count, page_h, &seq);
+
+	/* Whatever reaches below the bottom of one page also reaches below the next */
+	for (i = 1; i < count; i++)
+		box->pages[i].end = fz_maxi(box->pages[i].end, box->pages[i - 1].end);
+
+	assign_page_starts(box, box->pages, 0, count - 1, page_h, count);
+	box->page_count = count;
+}
+
 void
 fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em)
 {
@@ -1036,6 +1336,13 @@ fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em)
 	page_box.h = 0;
 
 	layout_block(ctx, box, &page_box, em, 0, h);
+
+	fz_free(ctx, box->pages);
+	box->pages = NULL;
+	box->page_count = 0;
+	box->page_h = h;
+	if (h > 0 && box->h > 0)
+		index_pages(ctx, box, h);
 }
 
 fz_html *
@@ -1043,6 +1350,7 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 {
 	fz_xml *xml;
 	fz_css_rule *css;
+	fz_css_index *index;
 	fz_css_match match;
 	fz_html *box;
 
@@ -1055,13 +1363,16 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 
 	// print_rules(css);
 
+	index = fz_new_css_index(ctx, css);
+
 	box = new_box(ctx);
 
 	match.up = NULL;
 	match.count = 0;
 
-	generate_boxes(ctx, set, zip, base_uri, xml, box, css, &match, 0);
+	generate_boxes(ctx, set, zip, base_uri, xml, box, index, &match, 0);
 
+	fz_drop_css_index(ctx, index);
 	fz_drop_css(ctx, css);
 	fz_drop_xml(ctx, xml);
 
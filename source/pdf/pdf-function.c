@@ -1,6 +1,8 @@
 #include "mupdf/pdf.h"
 
 typedef struct psobj_s psobj;
+typedef struct psinsn_s psinsn;
+typedef union psval_u psval;
 
 enum
 {
@@ -46,12 +48,18 @@ struct pdf_function_s
 		struct {
 			psobj *code;
 			int cap;
+			psinsn *prog; /* compiled form, if any */
+			int nregs;
+			psval *regs; /* initial register values */
 		} p;
 	} u;
 };
 
 #define RADIAN 57.2957795
 
+/* Number of points the batch evaluators work on at a time */
+#define BATCH_SIZE 64
+
 static inline float lerp(float x, float xmin, float xmax, float ymin, float ymax)
 {
 	if (xmin == xmax)
@@ -191,19 +199,25 @@ ps_push_int(ps_stack *st, int n)
 	}
 }
 
+static inline float
+ps_real(float n)
+{
+	if (isnan(n))
+	{
+		/* Push 1.0, as it's a small known value that won't
+		 * cause a divide by 0. Same reason as in fz_atof. */
+		n = 1.0;
+	}
+	return fz_clamp(n, -FLT_MAX, FLT_MAX);
+}
+
 static void
 ps_push_real(ps_stack *st, float n)
 {
 	if (!ps_overflow(st, 1))
 	{
 		st->stack[st->sp].type = PS_REAL;
-		if (isnan(n))
-		{
-			/* Push 1.0, as it's a small known value that won't
-			 * cause a divide by 0. Same reason as in fz_atof. */
-			n = 1.0;
-		}
-		st->stack[st->sp].u.f = fz_clamp(n, -FLT_MAX, FLT_MAX);
+		st->stack[st->sp].u.f = ps_real(n);
 		st->sp++;
 	}
 }
@@ -469,7 +483,9 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 			case PS_OP_IDIV:
 				i2 = ps_pop_int(st);
 				i1 = ps_pop_int(st);
-				if (i2 != 0)
+				if (i2 == -1)
+					ps_push_int(st, i1 == INT_MIN ? INT_MIN : -i1); /* INT_MIN / -1 traps */
+				else if (i2 != 0)
 					ps_push_int(st, i1 / i2);
 				else
 					ps_push_int(st, DIV_BY_ZERO(i1, i2, INT_MIN, INT_MAX));
@@ -520,7 +536,9 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 			case PS_OP_MOD:
 				i2 = ps_pop_int(st);
 				i1 = ps_pop_int(st);
-				if (i2 != 0)
+				if (i2 == -1)
+					ps_push_int(st, 0);
+				else if (i2 != 0)
 					ps_push_int(st, i1 % i2);
 				else
 					ps_push_int(st, DIV_BY_ZERO(i1, i2, INT_MIN, INT_MAX));
@@ -681,6 +699,827 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 	}
 }
 
+/*
+ * Compiled calculator functions.
+ *
+ * Along any one path through a calculator function the depth of the
+ * operand stack, and the type of each entry on it, is the same at each
+ * point whatever the inputs. We use this to translate the code once,
+ * at load time, into a flat program over numbered registers: stack
+ * manipulation is resolved at compile time, operators are specialised
+ * for their operand types, and operations on constants are folded.
+ * Functions we cannot compile this way (such as those that underflow
+ * the stack, or that apply arithmetic to booleans) are left to ps_run.
+ */
+
+#define PS_MAX_REGS 256
+#define PS_MAX_PROG 65535
+#define PS_MAX_NEST 16
+
+union psval_u
+{
+	int i; /* integers and booleans */
+	float f;
+};
+
+enum
+{
+	PC_ABS_I, PC_ABS_R, PC_NEG_I, PC_NEG_R, PC_NOT_B, PC_NOT_I,
+	PC_CEILING, PC_FLOOR, PC_ROUND, PC_TRUNCATE,
+	PC_COS, PC_SIN, PC_SQRT, PC_LN, PC_LOG, PC_CVI, PC_CVR,
+	PC_ADD_I, PC_ADD_R, PC_SUB_I, PC_SUB_R, PC_MUL_I, PC_MUL_R,
+	PC_DIV, PC_IDIV, PC_MOD, PC_ATAN, PC_EXP, PC_BITSHIFT,
+	PC_AND_I, PC_AND_B, PC_OR_I, PC_OR_B, PC_XOR,
+	PC_EQ_I, PC_EQ_R, PC_NE_I, PC_NE_R, PC_GE_I, PC_GE_R,
+	PC_GT_I, PC_GT_R, PC_LE_I, PC_LE_R, PC_LT_I, PC_LT_R,
+	PC_MOV, PC_JZ, PC_JMP, PC_END
+};
+
+struct psinsn_s
+{
+	unsigned short op;
+	unsigned short d; /* destination register, or jump target */
+	unsigned short a, b;
+};
+
+/* Must match the operators in ps_run exactly, including the
+ * normalisation that ps_push_real applies to every real result. */
+static inline psval
+ps_exec(int op, psval a, psval b)
+{
+	psval r;
+
+	switch (op)
+	{
+	default:
+	case PC_ABS_I: r.i = abs(a.i); break;
+	case PC_ABS_R: r.f = ps_real(fabsf(a.f)); break;
+	case PC_NEG_I: r.i = -a.i; break;
+	case PC_NEG_R: r.f = ps_real(-a.f); break;
+	case PC_NOT_B: r.i = !a.i; break;
+	case PC_NOT_I: r.i = ~a.i; break;
+	case PC_CEILING: r.f = ps_real(ceilf(a.f)); break;
+	case PC_FLOOR: r.f = ps_real(floorf(a.f)); break;
+	case PC_ROUND: r.f = ps_real((a.f >= 0) ? floorf(a.f + 0.5f) : ceilf(a.f - 0.5f)); break;
+	case PC_TRUNCATE: r.f = ps_real((a.f >= 0) ? floorf(a.f) : ceilf(a.f)); break;
+	case PC_COS: r.f = ps_real(cosf(a.f/RADIAN)); break;
+	case PC_SIN: r.f = ps_real(sinf(a.f/RADIAN)); break;
+	case PC_SQRT: r.f = ps_real(sqrtf(a.f)); break;
+	case PC_LN:
+		/* Bug 692941 - logf as separate statement */
+		r.f = logf(a.f);
+		r.f = ps_real(r.f);
+		break;
+	case PC_LOG: r.f = ps_real(log10f(a.f)); break;
+	case PC_CVI: r.i = a.f; break;
+	case PC_CVR: r.f = a.i; break;
+	case PC_ADD_I: r.i = a.i + b.i; break;
+	case PC_ADD_R: r.f = ps_real(a.f + b.f); break;
+	case PC_SUB_I: r.i = a.i - b.i; break;
+	case PC_SUB_R: r.f = ps_real(a.f - b.f); break;
+	case PC_MUL_I: r.i = a.i * b.i; break;
+	case PC_MUL_R: r.f = ps_real(a.f * b.f); break;
+	case PC_DIV:
+		if (fabsf(b.f) >= FLT_EPSILON)
+			r.f = ps_real(a.f / b.f);
+		else
+			r.f = ps_real(DIV_BY_ZERO(a.f, b.f, -FLT_MAX, FLT_MAX));
+		break;
+	case PC_IDIV:
+		if (b.i == -1)
+			r.i = a.i == INT_MIN ? INT_MIN : -a.i;
+		else if (b.i != 0)
+			r.i = a.i / b.i;
+		else
+			r.i = DIV_BY_ZERO(a.i, b.i, INT_MIN, INT_MAX);
+		break;
+	case PC_MOD:
+		if (b.i == -1)
+			r.i = 0;
+		else if (b.i != 0)
+			r.i = a.i % b.i;
+		else
+			r.i = DIV_BY_ZERO(a.i, b.i, INT_MIN, INT_MAX);
+		break;
+	case PC_ATAN:
+		r.f = atan2f(a.f, b.f) * RADIAN;
+		if (r.f < 0)
+			r.f += 360;
+		r.f = ps_real(r.f);
+		break;
+	case PC_EXP: r.f = ps_real(powf(a.f, b.f)); break;
+	case PC_BITSHIFT:
+		if (b.i > 0 && b.i < 8 * sizeof (b.i))
+			r.i = a.i << b.i;
+		else if (b.i < 0 && b.i > -8 * (int)sizeof (b.i))
+			r.i = (int)((unsigned int)a.i >> -b.i);
+		else
+			r.i = a.i;
+		break;
+	case PC_AND_I: r.i = a.i & b.i; break;
+	case PC_AND_B: r.i = a.i && b.i; break;
+	case PC_OR_I: r.i = a.i | b.i; break;
+	case PC_OR_B: r.i = a.i || b.i; break;
+	case PC_XOR: r.i = a.i ^ b.i; break;
+	case PC_EQ_I: r.i = a.i == b.i; break;
+	case PC_EQ_R: r.i = a.f == b.f; break;
+	case PC_NE_I: r.i = a.i != b.i; break;
+	case PC_NE_R: r.i = a.f != b.f; break;
+	case PC_GE_I: r.i = a.i >= b.i; break;
+	case PC_GE_R: r.i = a.f >= b.f; break;
+	case PC_GT_I: r.i = a.i > b.i; break;
+	case PC_GT_R: r.i = a.f > b.f; break;
+	case PC_LE_I: r.i = a.i <= b.i; break;
+	case PC_LE_R: r.i = a.f <= b.f; break;
+	case PC_LT_I: r.i = a.i < b.i; break;
+	case PC_LT_R: r.i = a.f < b.f; break;
+	}
+
+	return r;
+}
+
+typedef struct ps_entry_s ps_entry;
+
+struct ps_entry_s
+{
+	int type;
+	int reg; /* or -1 for a constant */
+	psval k;
+};
+
+typedef struct ps_compiler_s ps_compiler;
+
+struct ps_compiler_s
+{
+	psobj *code;
+	psinsn *prog;
+	int len, cap;
+	int nregs;
+	psval regs[PS_MAX_REGS];
+	ps_entry stack[100];
+	int sp;
+	int nest;
+	int out, nout; /* output registers */
+};
+
+static int
+ps_new_reg(ps_compiler *cc)
+{
+	if (cc->nregs >= PS_MAX_REGS)
+		return -1;
+	cc->regs[cc->nregs].i = 0;
+	return cc->nregs++;
+}
+
+/* Put a constant into a register of its own, initialised before the
+ * program runs. */
+static int
+ps_reg(ps_compiler *cc, ps_entry *e)
+{
+	if (e->reg < 0)
+	{
+		e->reg = ps_new_reg(cc);
+		if (e->reg < 0)
+			return -1;
+		cc->regs[e->reg] = e->k;
+	}
+	return e->reg;
+}
+
+static int
+ps_emit(fz_context *ctx, ps_compiler *cc, int op, int d, int a, int b)
+{
+	if (d < 0 || a < 0 || b < 0 || cc->len >= PS_MAX_PROG)
+		return -1;
+	if (cc->len == cc->cap)
+	{
+		int new_cap = cc->cap + 64;
+		cc->prog = fz_resize_array(ctx, cc->prog, new_cap, sizeof(psinsn));
+		cc->cap = new_cap;
+	}
+	cc->prog[cc->len].op = op;
+	cc->prog[cc->len].d = d;
+	cc->prog[cc->len].a = a;
+	cc->prog[cc->len].b = b;
+	return cc->len++;
+}
+
+/* Compute op into e, from e (and b for binary operators). */
+static int
+ps_apply(fz_context *ctx, ps_compiler *cc, int op, int type, ps_entry *e, ps_entry *b)
+{
+	if (e->reg < 0 && (!b || b->reg < 0))
+	{
+		e->k = ps_exec(op, e->k, b ? b->k : e->k);
+	}
+	else
+	{
+		int ra = ps_reg(cc, e);
+		int rb = b ? ps_reg(cc, b) : 0;
+		int d = ps_new_reg(cc);
+		if (ps_emit(ctx, cc, op, d, ra, rb) < 0)
+			return 0;
+		e->reg = d;
+	}
+	e->type = type;
+	return 1;
+}
+
+/* The conversions done by ps_pop_real and ps_pop_int. */
+static int
+ps_to_real(fz_context *ctx, ps_compiler *cc, ps_entry *e)
+{
+	if (e->type == PS_REAL)
+		return 1;
+	if (e->type == PS_INT)
+		return ps_apply(ctx, cc, PC_CVR, PS_REAL, e, NULL);
+	return 0;
+}
+
+static int
+ps_to_int(fz_context *ctx, ps_compiler *cc, ps_entry *e)
+{
+	if (e->type == PS_INT)
+		return 1;
+	if (e->type == PS_REAL)
+		return ps_apply(ctx, cc, PC_CVI, PS_INT, e, NULL);
+	return 0;
+}
+
+/* A constant integer operand, for copy, index and roll. */
+static int
+ps_const_int(ps_compiler *cc, int *n)
+{
+	ps_entry *e;
+
+	if (cc->sp < 1)
+		return 0;
+	e = &cc->stack[cc->sp - 1];
+	if (e->reg >= 0 || e->type == PS_BOOL)
+		return 0;
+	*n = e->type == PS_INT ? e->k.i : (int)e->k.f;
+	cc->sp--;
+	return 1;
+}
+
+typedef struct ps_cont_s ps_cont;
+
+/* Where to carry on once the current block returns. */
+struct ps_cont_s
+{
+	int pc;
+	ps_cont *next;
+};
+
+/* The compile functions below return 0 if the code cannot be
+ * compiled, 1 at the end of a block, and 2 once the rest of the
+ * function has been compiled along the current path. */
+static int ps_compile_block(fz_context *ctx, ps_compiler *cc, int pc, ps_cont *cont);
+
+static int
+ps_compile_end(fz_context *ctx, ps_compiler *cc)
+{
+	int i;
+
+	if (cc->sp < cc->nout)
+		return 0;
+
+	for (i = 0; i < cc->nout; i++)
+	{
+		ps_entry *e = &cc->stack[cc->sp - cc->nout + i];
+		if (!ps_to_real(ctx, cc, e))
+			return 0;
+		if (ps_emit(ctx, cc, PC_MOV, cc->out + i, ps_reg(cc, e), 0) < 0)
+			return 0;
+	}
+
+	if (ps_emit(ctx, cc, PC_END, 0, 0, 0) < 0)
+		return 0;
+	return 2;
+}
+
+/* Compile the rest of the function, starting at pc (or at cont if pc
+ * is negative). */
+static int
+ps_compile_path(fz_context *ctx, ps_compiler *cc, int pc, ps_cont *cont)
+{
+	int r = pc < 0 ? 1 : ps_compile_block(ctx, cc, pc, cont);
+
+	while (r == 1 && cont)
+	{
+		r = ps_compile_block(ctx, cc, cont->pc, cont->next);
+		cont = cont->next;
+	}
+	if (r == 1)
+		r = ps_compile_end(ctx, cc);
+	return r;
+}
+
+/* Compile one or other block depending on a run time condition. */
+static int
+ps_compile_branch(fz_context *ctx, ps_compiler *cc, int cond, int if_pc, int else_pc, ps_cont *next)
+{
+	ps_entry saved[100], taken[100];
+	int depth = cc->sp, len = cc->len, nregs = cc->nregs;
+	int jz, jmp_taken = -1, jmp_end, taken_sp = 0;
+	int merge[100];
+	int t, e, i, r;
+
+	memcpy(saved, cc->stack, depth * sizeof(ps_entry));
+
+	/* Try to compile each block separately and merge the stacks
+	 * they leave into a common set of registers. */
+	jz = ps_emit(ctx, cc, PC_JZ, 0, cond, 0);
+	if (jz < 0)
+		return 0;
+	t = ps_compile_block(ctx, cc, if_pc, next);
+	if (t == 0)
+		goto duplicate;
+	if (t == 1)
+	{
+		jmp_taken = ps_emit(ctx, cc, PC_JMP, 0, 0, 0);
+		if (jmp_taken < 0)
+			goto duplicate;
+		taken_sp = cc->sp;
+		memcpy(taken, cc->stack, taken_sp * sizeof(ps_entry));
+	}
+
+	cc->prog[jz].d = cc->len;
+	memcpy(cc->stack, saved, depth * sizeof(ps_entry));
+	cc->sp = depth;
+	e = else_pc < 0 ? 1 : ps_compile_block(ctx, cc, else_pc, next);
+	if (e == 0)
+		goto duplicate;
+
+	/* If one path has already run to the end of the function, the
+	 * other simply carries on. */
+	if (t == 2)
+		return e;
+	if (e == 2)
+	{
+		memcpy(cc->stack, taken, taken_sp * sizeof(ps_entry));
+		cc->sp = taken_sp;
+		cc->prog[jmp_taken].d = cc->len;
+		return 1;
+	}
+
+	if (cc->sp != taken_sp)
+		goto duplicate;
+	for (i = 0; i < taken_sp; i++)
+		if (taken[i].type != cc->stack[i].type)
+			goto duplicate;
+
+	for (i = 0; i < taken_sp; i++)
+	{
+		ps_entry *a = &taken[i];
+		ps_entry *b = &cc->stack[i];
+
+		merge[i] = -1;
+		if (a->reg == b->reg && (a->reg >= 0 || a->k.i == b->k.i))
+			continue;
+		merge[i] = ps_new_reg(cc);
+		if (ps_emit(ctx, cc, PC_MOV, merge[i], ps_reg(cc, b), 0) < 0)
+			goto duplicate;
+	}
+	jmp_end = ps_emit(ctx, cc, PC_JMP, 0, 0, 0);
+	if (jmp_end < 0)
+		goto duplicate;
+
+	cc->prog[jmp_taken].d = cc->len;
+	for (i = 0; i < taken_sp; i++)
+	{
+		if (merge[i] < 0)
+			continue;
+		r = ps_reg(cc, &taken[i]);
+		if (ps_emit(ctx, cc, PC_MOV, merge[i], r, 0) < 0)
+			goto duplicate;
+		cc->stack[i].reg = merge[i];
+	}
+	cc->prog[jmp_end].d = cc->len;
+
+	return 1;
+
+duplicate:
+	/* The blocks leave stacks of different shapes or types, so
+	 * compile the rest of the function after each of them. */
+	cc->len = len;
+	cc->nregs = nregs;
+	memcpy(cc->stack, saved, depth * sizeof(ps_entry));
+	cc->sp = depth;
+
+	jz = ps_emit(ctx, cc, PC_JZ, 0, cond, 0);
+	if (jz < 0 || ps_compile_path(ctx, cc, if_pc, next) != 2)
+		return 0;
+
+	cc->prog[jz].d = cc->len;
+	memcpy(cc->stack, saved, depth * sizeof(ps_entry));
+	cc->sp = depth;
+	if (ps_compile_path(ctx, cc, else_pc, next) != 2)
+		return 0;
+
+	return 2;
+}
+
+static int
+ps_compile_ops(fz_context *ctx, ps_compiler *cc, int pc, ps_cont *cont)
+{
+	psobj *code = cc->code;
+	ps_entry *a, *b, cond;
+	ps_cont next;
+	int n, j, ok;
+
+	while (1)
+	{
+		switch (code[pc].type)
+		{
+		case PS_INT:
+			if (cc->sp + 1 >= nelem(cc->stack))
+				return 0;
+			a = &cc->stack[cc->sp++];
+			a->type = PS_INT;
+			a->reg = -1;
+			a->k.i = code[pc++].u.i;
+			break;
+
+		case PS_REAL:
+			if (cc->sp + 1 >= nelem(cc->stack))
+				return 0;
+			a = &cc->stack[cc->sp++];
+			a->type = PS_REAL;
+			a->reg = -1;
+			a->k.f = ps_real(code[pc++].u.f);
+			break;
+
+		case PS_OPERATOR:
+			/* Operands: a is the first pushed, b is on top. */
+			b = cc->sp >= 1 ? &cc->stack[cc->sp - 1] : NULL;
+			a = cc->sp >= 2 ? &cc->stack[cc->sp - 2] : NULL;
+
+			switch (code[pc++].u.op)
+			{
+			case PS_OP_ABS:
+			case PS_OP_NEG:
+				if (!b)
+					return 0;
+				if (b->type == PS_INT)
+					ok = ps_apply(ctx, cc, code[pc-1].u.op == PS_OP_ABS ? PC_ABS_I : PC_NEG_I, PS_INT, b, NULL);
+				else
+					ok = ps_to_real(ctx, cc, b) && ps_apply(ctx, cc, code[pc-1].u.op == PS_OP_ABS ? PC_ABS_R : PC_NEG_R, PS_REAL, b, NULL);
+				if (!ok)
+					return 0;
+				break;
+
+			case PS_OP_ADD:
+			case PS_OP_SUB:
+			case PS_OP_MUL:
+				if (!a)
+					return 0;
+				n = code[pc-1].u.op;
+				if (a->type == PS_INT && b->type == PS_INT)
+					ok = ps_apply(ctx, cc, n == PS_OP_ADD ? PC_ADD_I : n == PS_OP_SUB ? PC_SUB_I : PC_MUL_I, PS_INT, a, b);
+				else
+					ok = ps_to_real(ctx, cc, a) && ps_to_real(ctx, cc, b) &&
+						ps_apply(ctx, cc, n == PS_OP_ADD ? PC_ADD_R : n == PS_OP_SUB ? PC_SUB_R : PC_MUL_R, PS_REAL, a, b);
+				if (!ok)
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_AND:
+			case PS_OP_OR:
+			case PS_OP_XOR:
+				if (!a || a->type != b->type || a->type == PS_REAL)
+					return 0;
+				n = code[pc-1].u.op;
+				if (n == PS_OP_XOR)
+					j = PC_XOR;
+				else if (a->type == PS_INT)
+					j = n == PS_OP_AND ? PC_AND_I : PC_OR_I;
+				else
+					j = n == PS_OP_AND ? PC_AND_B : PC_OR_B;
+				if (!ps_apply(ctx, cc, j, a->type, a, b))
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_ATAN:
+			case PS_OP_DIV:
+			case PS_OP_EXP:
+				if (!a)
+					return 0;
+				n = code[pc-1].u.op;
+				j = n == PS_OP_ATAN ? PC_ATAN : n == PS_OP_DIV ? PC_DIV : PC_EXP;
+				if (!ps_to_real(ctx, cc, a) || !ps_to_real(ctx, cc, b) || !ps_apply(ctx, cc, j, PS_REAL, a, b))
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_BITSHIFT:
+			case PS_OP_IDIV:
+			case PS_OP_MOD:
+				if (!a)
+					return 0;
+				n = code[pc-1].u.op;
+				j = n == PS_OP_BITSHIFT ? PC_BITSHIFT : n == PS_OP_IDIV ? PC_IDIV : PC_MOD;
+				if (!ps_to_int(ctx, cc, b) || !ps_to_int(ctx, cc, a) || !ps_apply(ctx, cc, j, PS_INT, a, b))
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_CEILING:
+			case PS_OP_FLOOR:
+			case PS_OP_COS:
+			case PS_OP_SIN:
+			case PS_OP_SQRT:
+			case PS_OP_LN:
+			case PS_OP_LOG:
+				if (!b)
+					return 0;
+				switch (code[pc-1].u.op)
+				{
+				default:
+				case PS_OP_CEILING: j = PC_CEILING; break;
+				case PS_OP_FLOOR: j = PC_FLOOR; break;
+				case PS_OP_COS: j = PC_COS; break;
+				case PS_OP_SIN: j = PC_SIN; break;
+				case PS_OP_SQRT: j = PC_SQRT; break;
+				case PS_OP_LN: j = PC_LN; break;
+				case PS_OP_LOG: j = PC_LOG; break;
+				}
+				if (!ps_to_real(ctx, cc, b) || !ps_apply(ctx, cc, j, PS_REAL, b, NULL))
+					return 0;
+				break;
+
+			case PS_OP_ROUND:
+			case PS_OP_TRUNCATE:
+				if (!b)
+					return 0;
+				if (b->type == PS_INT)
+					break;
+				j = code[pc-1].u.op == PS_OP_ROUND ? PC_ROUND : PC_TRUNCATE;
+				if (!ps_to_real(ctx, cc, b) || !ps_apply(ctx, cc, j, PS_REAL, b, NULL))
+					return 0;
+				break;
+
+			case PS_OP_CVI:
+				if (!b || !ps_to_int(ctx, cc, b))
+					return 0;
+				break;
+
+			case PS_OP_CVR:
+				if (!b || !ps_to_real(ctx, cc, b))
+					return 0;
+				break;
+
+			case PS_OP_NOT:
+				if (!b)
+					return 0;
+				if (b->type == PS_BOOL)
+					ok = ps_apply(ctx, cc, PC_NOT_B, PS_BOOL, b, NULL);
+				else
+					ok = ps_to_int(ctx, cc, b) && ps_apply(ctx, cc, PC_NOT_I, PS_INT, b, NULL);
+				if (!ok)
+					return 0;
+				break;
+
+			case PS_OP_EQ:
+			case PS_OP_NE:
+			case PS_OP_GE:
+			case PS_OP_GT:
+			case PS_OP_LE:
+			case PS_OP_LT:
+				if (!a)
+					return 0;
+				switch (code[pc-1].u.op)
+				{
+				default:
+				case PS_OP_EQ: j = PC_EQ_I; break;
+				case PS_OP_NE: j = PC_NE_I; break;
+				case PS_OP_GE: j = PC_GE_I; break;
+				case PS_OP_GT: j = PC_GT_I; break;
+				case PS_OP_LE: j = PC_LE_I; break;
+				case PS_OP_LT: j = PC_LT_I; break;
+				}
+				if (a->type == PS_INT && b->type == PS_INT)
+					ok = 1;
+				else if (a->type == PS_BOOL && b->type == PS_BOOL)
+					ok = j == PC_EQ_I || j == PC_NE_I;
+				else
+				{
+					ok = ps_to_real(ctx, cc, a) && ps_to_real(ctx, cc, b);
+					j++; /* the _R variant follows the _I */
+				}
+				if (!ok || !ps_apply(ctx, cc, j, PS_BOOL, a, b))
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_TRUE:
+			case PS_OP_FALSE:
+				if (cc->sp + 1 >= nelem(cc->stack))
+					return 0;
+				a = &cc->stack[cc->sp++];
+				a->type = PS_BOOL;
+				a->reg = -1;
+				a->k.i = code[pc-1].u.op == PS_OP_TRUE;
+				break;
+
+			case PS_OP_DUP:
+				if (cc->sp < 1 || cc->sp + 1 >= nelem(cc->stack))
+					return 0;
+				cc->stack[cc->sp] = cc->stack[cc->sp - 1];
+				cc->sp++;
+				break;
+
+			case PS_OP_COPY:
+				if (!ps_const_int(cc, &n))
+					return 0;
+				if (n < 0 || n > cc->sp || cc->sp + n >= nelem(cc->stack))
+					return 0;
+				memcpy(cc->stack + cc->sp, cc->stack + cc->sp - n, n * sizeof(ps_entry));
+				cc->sp += n;
+				break;
+
+			case PS_OP_INDEX:
+				if (!ps_const_int(cc, &n))
+					return 0;
+				if (n < 0 || n >= cc->sp || cc->sp + 1 >= nelem(cc->stack))
+					return 0;
+				cc->stack[cc->sp] = cc->stack[cc->sp - n - 1];
+				cc->sp++;
+				break;
+
+			case PS_OP_EXCH:
+				if (!a)
+					return 0;
+				{
+					ps_entry tmp = *a;
+					*a = *b;
+					*b = tmp;
+				}
+				break;
+
+			case PS_OP_ROLL:
+				if (!ps_const_int(cc, &j) || !ps_const_int(cc, &n))
+					return 0;
+				if (n < 0 || n > cc->sp)
+					return 0;
+				if (j == 0 || n == 0)
+					break;
+				if (j >= 0)
+					j %= n;
+				else
+				{
+					j = -j % n;
+					if (j != 0)
+						j = n - j;
+				}
+				while (j-- > 0)
+				{
+					ps_entry tmp = cc->stack[cc->sp - 1];
+					memmove(cc->stack + cc->sp - n + 1, cc->stack + cc->sp - n, (n - 1) * sizeof(ps_entry));
+					cc->stack[cc->sp - n] = tmp;
+				}
+				break;
+
+			case PS_OP_POP:
+				if (cc->sp < 1)
+					return 0;
+				cc->sp--;
+				break;
+
+			case PS_OP_IF:
+			case PS_OP_IFELSE:
+				if (!b || b->type != PS_BOOL)
+					return 0;
+				cond = *b;
+				cc->sp--;
+				n = code[pc-1].u.op == PS_OP_IFELSE ? code[pc].u.block : -1;
+				next.pc = code[pc + 2].u.block;
+				next.next = cont;
+				if (cond.reg >= 0)
+					ok = ps_compile_branch(ctx, cc, cond.reg, code[pc + 1].u.block, n, &next);
+				else if (cond.k.i)
+					ok = ps_compile_block(ctx, cc, code[pc + 1].u.block, &next);
+				else
+					ok = n < 0 ? 1 : ps_compile_block(ctx, cc, n, &next);
+				if (ok != 1)
+					return ok;
+				pc = next.pc;
+				break;
+
+			case PS_OP_RETURN:
+				return 1;
+
+			default:
+				return 0;
+			}
+			break;
+
+		default:
+			return 0;
+		}
+	}
+}
+
+static int
+ps_compile_block(fz_context *ctx, ps_compiler *cc, int pc, ps_cont *cont)
+{
+	int r = 0;
+
+	if (cc->nest < PS_MAX_NEST)
+	{
+		cc->nest++;
+		r = ps_compile_ops(ctx, cc, pc, cont);
+		cc->nest--;
+	}
+	return r;
+}
+
+static void
+compile_postscript_func(fz_context *ctx, pdf_function *func)
+{
+	ps_compiler *cc;
+	int i;
+
+	cc = fz_malloc_struct(ctx, ps_compiler);
+	cc->code = func->u.p.code;
+
+	fz_try(ctx)
+	{
+		/* Registers for the inputs, then for the outputs. */
+		for (i = 0; i < func->base.m; i++)
+		{
+			cc->stack[i].type = PS_REAL;
+			cc->stack[i].reg = ps_new_reg(cc);
+		}
+		cc->sp = func->base.m;
+		cc->out = cc->nregs;
+		cc->nout = func->base.n;
+		for (i = 0; i < func->base.n; i++)
+			ps_new_reg(cc);
+
+		if (ps_compile_path(ctx, cc, 0, NULL) == 2)
+		{
+			func->u.p.regs = fz_malloc_array(ctx, cc->nregs, sizeof(psval));
+			memcpy(func->u.p.regs, cc->regs, cc->nregs * sizeof(psval));
+			func->u.p.nregs = cc->nregs;
+			func->u.p.prog = cc->prog;
+			cc->prog = NULL;
+			func->base.size += cc->cap * sizeof(psinsn) + cc->nregs * sizeof(psval);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, cc->prog);
+		fz_free(ctx, cc);
+	}
+	fz_catch(ctx)
+	{
+		/* Not fatal; we can always interpret the code instead. */
+		fz_warn(ctx, "cannot compile calculator function");
+	}
+}
+
+static void
+eval_compiled_func(pdf_function *func, const float *in, float *out)
+{
+	psval regs[PS_MAX_REGS];
+	psinsn *prog = func->u.p.prog;
+	int pc, i;
+
+	memcpy(regs, func->u.p.regs, func->u.p.nregs * sizeof(psval));
+
+	for (i = 0; i < func->base.m; i++)
+		regs[i].f = ps_real(fz_clamp(in[i], func->domain[i][0], func->domain[i][1]));
+
+	pc = 0;
+	while (prog[pc].op != PC_END)
+	{
+		psinsn *p = &prog[pc++];
+
+		switch (p->op)
+		{
+		case PC_MOV:
+			regs[p->d] = regs[p->a];
+			break;
+		case PC_JZ:
+			if (!regs[p->a].i)
+				pc = p->d;
+			break;
+		case PC_JMP:
+			pc = p->d;
+			break;
+		default:
+			regs[p->d] = ps_exec(p->op, regs[p->a], regs[p->b]);
+			break;
+		}
+	}
+
+	for (i = 0; i < func->base.n; i++)
+		out[i] = fz_clamp(regs[func->base.m + i].f, func->range[i][0], func->range[i][1]);
+}
+
 static void
 resize_code(fz_context *ctx, pdf_function *func, int newsize)
 {
@@ -874,6 +1713,8 @@ load_postscript_func(fz_context *ctx, pdf_document *doc, pdf_function *func, pdf
 	}
 
 	func->base.size += func->u.p.cap * sizeof(psobj);
+
+	compile_postscript_func(ctx, func);
 }
 
 static void
@@ -883,6 +1724,12 @@ eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float
 	float x;
 	int i;
 
+	if (func->u.p.regs)
+	{
+		eval_compiled_func(func, in, out);
+		return;
+	}
+
 	ps_init_stack(&st);
 
 	for (i = 0; i < func->base.m; i++)
@@ -900,6 +1747,19 @@ eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float
 	}
 }
 
+static void
+eval_postscript_func_batch(fz_context *ctx, pdf_function *func, int count, const float *in, float *out, int outstride)
+{
+	int j;
+
+	if (func->u.p.regs)
+		for (j = 0; j < count; j++)
+			eval_compiled_func(func, in + j * func->base.m, out + j * outstride);
+	else
+		for (j = 0; j < count; j++)
+			eval_postscript_func(ctx, func, in + j * func->base.m, out + j * outstride);
+}
+
 /*
  * Sample function
  */
@@ -1127,6 +1987,100 @@ eval_sample_func(fz_context *ctx, pdf_function *func, const float *in, float *ou
 	}
 }
 
+/* Encode one input dimension of a batch of points, as eval_sample_func does. */
+static void
+encode_sample_batch(pdf_function *func, int dim, int len, const float *in, int *e0, int *e1, float *efrac)
+{
+	float dmin = func->domain[dim][0];
+	float dmax = func->domain[dim][1];
+	float emin = func->u.sa.encode[dim][0];
+	float emax = func->u.sa.encode[dim][1];
+	float smax = func->u.sa.size[dim] - 1;
+	int m = func->base.m;
+	int j;
+
+	for (j = 0; j < len; j++)
+	{
+		float x = fz_clamp(in[j * m + dim], dmin, dmax);
+		x = lerp(x, dmin, dmax, emin, emax);
+		x = fz_clamp(x, 0, smax);
+		/* x is not negative, so truncation gives floorf(x) */
+		e0[j] = (int)x;
+		efrac[j] = x - e0[j];
+		e1[j] = e0[j] + (efrac[j] > 0);
+	}
+}
+
+static void
+eval_sample_func_batch(fz_context *ctx, pdf_function *func, int count, const float *in, float *out, int outstride)
+{
+	int e0[2][BATCH_SIZE], e1[2][BATCH_SIZE];
+	float efrac[2][BATCH_SIZE];
+	float *samples = func->u.sa.samples;
+	int m = func->base.m;
+	int n = func->base.n;
+	int len, i, j;
+
+	if (m > 2)
+	{
+		for (j = 0; j < count; j++)
+			eval_sample_func(ctx, func, in + j * m, out + j * outstride);
+		return;
+	}
+
+	while (count > 0)
+	{
+		len = fz_mini(count, BATCH_SIZE);
+
+		for (i = 0; i < m; i++)
+			encode_sample_batch(func, i, len, in, e0[i], e1[i], efrac[i]);
+
+		for (i = 0; i < n; i++)
+		{
+			float d0 = func->u.sa.decode[i][0];
+			float d1 = func->u.sa.decode[i][1];
+			float r0 = func->range[i][0];
+			float r1 = func->range[i][1];
+
+			if (m == 1)
+			{
+				for (j = 0; j < len; j++)
+				{
+					float a = samples[e0[0][j] * n + i];
+					float b = samples[e1[0][j] * n + i];
+
+					float ab = a + (b - a) * efrac[0][j];
+
+					out[j * outstride + i] = fz_clamp(lerp(ab, 0, 1, d0, d1), r0, r1);
+				}
+			}
+			else
+			{
+				int s0 = n;
+				int s1 = s0 * func->u.sa.size[0];
+
+				for (j = 0; j < len; j++)
+				{
+					float a = samples[e0[0][j] * s0 + e0[1][j] * s1 + i];
+					float b = samples[e1[0][j] * s0 + e0[1][j] * s1 + i];
+					float c = samples[e0[0][j] * s0 + e1[1][j] * s1 + i];
+					float d = samples[e1[0][j] * s0 + e1[1][j] * s1 + i];
+
+					float ab = a + (b - a) * efrac[0][j];
+					float cd = c + (d - c) * efrac[0][j];
+					float abcd = ab + (cd - ab) * efrac[1][j];
+
+					out[j * outstride + i] = fz_clamp(lerp(abcd, 0, 1, d0, d1), r0, r1);
+				}
+			}
+		}
+
+		in += len * m;
+		out += len * outstride;
+		count -= len;
+	}
+}
+
 /*
  * Exponential function
  */
@@ -1201,7 +2155,11 @@ eval_exponential_func(fz_context *ctx, pdf_function *func, float in, float *out)
 
 	/* Default output is zero, which is suitable for violated constraints */
 	if ((func->u.e.n != (int)func->u.e.n && x < 0) || (func->u.e.n < 0 && x == 0))
+	{
+		for (i = 0; i < func->base.n; i++)
+			out[i] = 0;
 		return;
+	}
 
 	tmp = powf(x, func->u.e.n);
 	for (i = 0; i < func->base.n; i++)
@@ -1212,6 +2170,58 @@ eval_exponential_func(fz_context *ctx, pdf_function *func, float in, float *out)
 	}
 }
 
+static void
+eval_exponential_func_batch(fz_context *ctx, pdf_function *func, int count, const float *in, float *out, int outstride)
+{
+	float tmp[BATCH_SIZE];
+	float e = func->u.e.n;
+	float d0 = func->domain[0][0];
+	float d1 = func->domain[0][1];
+	int fractional = (e != (int)e);
+	int len, i, j;
+
+	while (count > 0)
+	{
+		len = fz_mini(count, BATCH_SIZE);
+
+		for (j = 0; j < len; j++)
+			tmp[j] = fz_clamp(in[j], d0, d1);
+
+		/* N = 1 (plain linear interpolation) is by far the most common */
+		if (e != 1)
+			for (j = 0; j < len; j++)
+				tmp[j] = powf(tmp[j], e);
+
+		for (i = 0; i < func->base.n; i++)
+		{
+			float c0 = func->u.e.c0[i];
+			float dc = func->u.e.c1[i] - c0;
+
+			for (j = 0; j < len; j++)
+				out[j * outstride + i] = c0 + tmp[j] * dc;
+			if (func->has_range)
+				for (j = 0; j < len; j++)
+					out[j * outstride + i] = fz_clamp(out[j * outstride + i], func->range[i][0], func->range[i][1]);
+		}
+
+		/* Default output is zero, which is suitable for violated constraints */
+		if (fractional || e < 0)
+		{
+			for (j = 0; j < len; j++)
+			{
+				float x = fz_clamp(in[j], d0, d1);
+				if ((fractional && x < 0) || (e < 0 && x == 0))
+					for (i = 0; i < func->base.n; i++)
+						out[j * outstride + i] = 0;
+			}
+		}
+
+		in += len;
+		out += len * outstride;
+		count -= len;
+	}
+}
+
 /*
  * Stitching function
  */
@@ -1312,8 +2322,9 @@ load_stitching_func(fz_context *ctx, pdf_document *doc, pdf_function *func, pdf_
 	}
 }
 
-static void
-eval_stitching_func(fz_context *ctx, pdf_function *func, float in, float *out)
+/* Find the subdomain containing in, and map in to its subfunction's input. */
+static int
+stitching_segment(pdf_function *func, float in, float *t)
 {
 	float low, high;
 	int k = func->u.st.k;
@@ -1349,11 +2360,43 @@ eval_stitching_func(fz_context *ctx, pdf_function *func, float in, float *out)
 		high = bounds[i];
 	}
 
-	in = lerp(in, low, high, func->u.st.encode[i * 2 + 0], func->u.st.encode[i * 2 + 1]);
+	*t = lerp(in, low, high, func->u.st.encode[i * 2 + 0], func->u.st.encode[i * 2 + 1]);
+	return i;
+}
+
+static void
+eval_stitching_func(fz_context *ctx, pdf_function *func, float in, float *out)
+{
+	int i = stitching_segment(func, in, &in);
 
 	fz_eval_function(ctx, func->u.st.funcs[i], &in, 1, out, func->u.st.funcs[i]->n);
 }
 
+static void
+eval_stitching_func_batch(fz_context *ctx, pdf_function *func, int count, const float *in, float *out, int outstride)
+{
+	float t[BATCH_SIZE];
+	fz_function *sub;
+	int len, i;
+
+	/* Hand each run of points that fall in the same subdomain (as
+	 * consecutive points usually do) to its subfunction in one go. */
+	while (count > 0)
+	{
+		i = stitching_segment(func, in[0], &t[0]);
+		len = 1;
+		while (len < count && len < BATCH_SIZE && stitching_segment(func, in[len], &t[len]) == i)
+			len++;
+
+		sub = func->u.st.funcs[i];
+		fz_eval_function_batch(ctx, sub, len, t, 1, out, sub->n, outstride);
+
+		in += len;
+		out += len * outstride;
+		count -= len;
+	}
+}
+
 /*
  * Common
  */
@@ -1380,6 +2423,8 @@ pdf_drop_function_imp(fz_context *ctx, fz_storable *func_)
 		break;
 	case POSTSCRIPT:
 		fz_free(ctx, func->u.p.code);
+		fz_free(ctx, func->u.p.prog);
+		fz_free(ctx, func->u.p.regs);
 		break;
 	}
 	fz_free(ctx, func);
@@ -1399,6 +2444,20 @@ pdf_eval_function(fz_context *ctx, fz_function *func_, const float *in, float *o
 	}
 }
 
+static void
+pdf_eval_function_batch(fz_context *ctx, fz_function *func_, int count, const float *in, float *out, int outstride)
+{
+	pdf_function *func = (pdf_function *)func_;
+
+	switch (func->type)
+	{
+	case SAMPLE: eval_sample_func_batch(ctx, func, count, in, out, outstride); break;
+	case EXPONENTIAL: eval_exponential_func_batch(ctx, func, count, in, out, outstride); break;
+	case STITCHING: eval_stitching_func_batch(ctx, func, count, in, out, outstride); break;
+	case POSTSCRIPT: eval_postscript_func_batch(ctx, func, count, in, out, outstride); break;
+	}
+}
+
 /*
  * Debugging prints
  */
@@ -1641,6 +2700,7 @@ pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int
 	FZ_INIT_STORABLE(&func->base, 1, pdf_drop_function_imp);
 	func->base.size = sizeof(*func);
 	func->base.evaluate = pdf_eval_function;
+	func->base.evaluate_batch = pdf_eval_function_batch;
 #ifndef NDEBUG
 	func->base.debug = pdf_debug_function;
 #endif
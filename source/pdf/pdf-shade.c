@@ -6,42 +6,40 @@
 /* Sample various functions into lookup tables */
 
 static void
-pdf_sample_composite_shade_function(fz_context *ctx, fz_shade *shade, fz_function *func, float t0, float t1)
+pdf_sample_composite_shade_function(fz_context *ctx, fz_shade *shade, fz_function *func, float *t)
 {
 	int i;
-	float t;
 
+	fz_eval_function_batch(ctx, func, 256, t, 1, shade->function[0], shade->colorspace->n, nelem(shade->function[0]));
 	for (i = 0; i < 256; i++)
-	{
-		t = t0 + (i / 255.0f) * (t1 - t0);
-		fz_eval_function(ctx, func, &t, 1, shade->function[i], shade->colorspace->n);
 		shade->function[i][shade->colorspace->n] = 1;
-	}
 }
 
 static void
-pdf_sample_component_shade_function(fz_context *ctx, fz_shade *shade, int funcs, fz_function **func, float t0, float t1)
+pdf_sample_component_shade_function(fz_context *ctx, fz_shade *shade, int funcs, fz_function **func, float *t)
 {
 	int i, k;
-	float t;
 
+	for (k = 0; k < funcs; k++)
+		fz_eval_function_batch(ctx, func[k], 256, t, 1, &shade->function[0][k], 1, nelem(shade->function[0]));
 	for (i = 0; i < 256; i++)
-	{
-		t = t0 + (i / 255.0f) * (t1 - t0);
-		for (k = 0; k < funcs; k++)
-			fz_eval_function(ctx, func[k], &t, 1, &shade->function[i][k], 1);
-		shade->function[i][k] = 1;
-	}
+		shade->function[i][funcs] = 1;
 }
 
 static void
 pdf_sample_shade_function(fz_context *ctx, fz_shade *shade, int funcs, fz_function **func, float t0, float t1)
 {
+	float t[256];
+	int i;
+
+	for (i = 0; i < 256; i++)
+		t[i] = t0 + (i / 255.0f) * (t1 - t0);
+
 	shade->use_function = 1;
 	if (funcs == 1)
-		pdf_sample_composite_shade_function(ctx, shade, func[0], t0, t1);
+		pdf_sample_composite_shade_function(ctx, shade, func[0], t);
 	else
-		pdf_sample_component_shade_function(ctx, shade, funcs, func, t0, t1);
+		pdf_sample_component_shade_function(ctx, shade, funcs, func, t);
 }
 
 /* Type 1-3 -- Function-based, linear and radial shadings */
@@ -51,7 +49,7 @@ pdf_load_function_based_shading(fz_context *ctx, pdf_document *doc, fz_shade *sh
 {
 	pdf_obj *obj;
 	float x0, y0, x1, y1;
-	float fv[2];
+	float fv[(FUNSEGS+1)*2];
 	fz_matrix matrix;
 	int xx, yy;
 	float *p;
@@ -84,15 +82,14 @@ pdf_load_function_based_shading(fz_context *ctx, pdf_document *doc, fz_shade *sh
 	p = shade->u.f.fn_vals;
 	for (yy = 0; yy <= FUNSEGS; yy++)
 	{
-		fv[1] = y0 + (y1 - y0) * yy / FUNSEGS;
-
 		for (xx = 0; xx <= FUNSEGS; xx++)
 		{
-			fv[0] = x0 + (x1 - x0) * xx / FUNSEGS;
-
-			fz_eval_function(ctx, func, fv, 2, p, shade->colorspace->n);
-			p += shade->colorspace->n;
+			fv[xx*2+0] = x0 + (x1 - x0) * xx / FUNSEGS;
+			fv[xx*2+1] = y0 + (y1 - y0) * yy / FUNSEGS;
 		}
+
+		fz_eval_function_batch(ctx, func, FUNSEGS+1, fv, 2, p, shade->colorspace->n, shade->colorspace->n);
+		p += (FUNSEGS+1) * shade->colorspace->n;
 	}
 }
 
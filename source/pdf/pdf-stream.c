@@ -525,12 +525,52 @@ can_reuse_buffer(fz_context *ctx, pdf_xref_entry *entry, fz_compression_params *
 
 }
 
+/*
+ * Check if a stream is compressed with nothing but an unpredicted
+ * FlateDecode filter, so that it can be inflated in one go from
+ * its raw data.
+ */
+static int
+pdf_is_plain_flate_stream(fz_context *ctx, pdf_obj *dict)
+{
+	pdf_obj *f = pdf_dict_geta(ctx, dict, PDF_NAME_Filter, PDF_NAME_F);
+	pdf_obj *p = pdf_dict_geta(ctx, dict, PDF_NAME_DecodeParms, PDF_NAME_DP);
+
+	if (pdf_is_array(ctx, f))
+	{
+		if (pdf_array_len(ctx, f) != 1)
+			return 0;
+		f = pdf_array_get(ctx, f, 0);
+		p = pdf_array_get(ctx, p, 0);
+	}
+	if (!pdf_name_eq(ctx, f, PDF_NAME_FlateDecode) && !pdf_name_eq(ctx, f, PDF_NAME_Fl))
+		return 0;
+	return pdf_to_int(ctx, pdf_dict_get(ctx, p, PDF_NAME_Predictor)) <= 1;
+}
+
+static fz_buffer *
+pdf_load_flate_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen, int len)
+{
+	fz_buffer *raw;
+	fz_buffer *buf = NULL;
+
+	raw = pdf_load_raw_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen);
+	fz_try(ctx)
+		buf = fz_inflate_buffer(ctx, raw->data, raw->len, 15, len);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, raw);
+	fz_catch(ctx)
+		fz_rethrow_message(ctx, "cannot inflate stream (%d %d R)", num, gen);
+
+	return buf;
+}
+
 static fz_buffer *
 pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen, fz_compression_params *params, int *truncated)
 {
 	fz_stream *stm = NULL;
 	pdf_obj *dict, *obj;
-	int i, len, n;
+	int i, raw_len, len, dl, n, flate;
 	fz_buffer *buf;
 
 	fz_var(buf);
@@ -546,15 +586,28 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int
 
 	dict = pdf_load_object(ctx, doc, num, gen);
 
-	len = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Length));
+	raw_len = len = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Length));
 	obj = pdf_dict_get(ctx, dict, PDF_NAME_Filter);
 	len = pdf_guess_filter_length(len, pdf_to_name(ctx, obj));
 	n = pdf_array_len(ctx, obj);
 	for (i = 0; i < n; i++)
 		len = pdf_guess_filter_length(len, pdf_to_name(ctx, pdf_array_get(ctx, obj, i)));
 
+	/* Decoded length hint, if the producer told us. It sizes the first
+	 * allocation, so beyond the first megabyte ignore values past the
+	 * 200:1 expansion at which the decoders treat a stream as a bomb. */
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_DL);
+	dl = pdf_is_int(ctx, obj) ? pdf_to_int(ctx, obj) : 0;
+	if (dl > 0 && (dl <= (1 << 20) || dl / 200 <= raw_len))
+		len = dl;
+
+	flate = !params && !truncated && pdf_is_plain_flate_stream(ctx, dict);
+
 	pdf_drop_obj(ctx, dict);
 
+	if (flate)
+		return pdf_load_flate_stream(ctx, doc, num, gen, orig_num, orig_gen, len);
+
 	stm = pdf_open_image_stream(ctx, doc, num, gen, orig_num, orig_gen, params);
 
 	fz_try(ctx)
@@ -608,6 +661,46 @@ pdf_load_compressed_stream(fz_context *ctx, pdf_document *doc, int num, int gen)
 	return bc;
 }
 
+/*
+ * Open a content stream. Plain Flate compressed streams are inflated in
+ * one pass into memory, which is much faster than inflating in small
+ * chunks as the interpreter reads. If that fails for any reason we fall
+ * back to the ordinary stream so that damaged data is handled as before.
+ */
+static fz_stream *
+pdf_open_contents_part(fz_context *ctx, pdf_document *doc, int num, int gen)
+{
+	pdf_xref_entry *x;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+
+	fz_var(buf);
+	fz_var(stm);
+
+	x = pdf_cache_object(ctx, doc, num, gen);
+	if (pdf_is_plain_flate_stream(ctx, x->obj))
+	{
+		fz_try(ctx)
+		{
+			buf = pdf_load_stream(ctx, doc, num, gen);
+			stm = fz_open_buffer(ctx, buf);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			stm = NULL;
+		}
+		if (stm)
+			return stm;
+	}
+
+	return pdf_open_image_stream(ctx, doc, num, gen, num, gen, NULL);
+}
+
 static fz_stream *
 pdf_open_object_array(fz_context *ctx, pdf_document *doc, pdf_obj *list)
 {
@@ -623,7 +716,7 @@ pdf_open_object_array(fz_context *ctx, pdf_document *doc, pdf_obj *list)
 		pdf_obj *obj = pdf_array_get(ctx, list, i);
 		fz_try(ctx)
 		{
-			fz_concat_push(ctx, stm, pdf_open_stream(ctx, doc, pdf_to_num(ctx, obj), pdf_to_gen(ctx, obj)));
+			fz_concat_push(ctx, stm, pdf_open_contents_part(ctx, doc, pdf_to_num(ctx, obj), pdf_to_gen(ctx, obj)));
 		}
 		fz_catch(ctx)
 		{
@@ -647,7 +740,7 @@ pdf_open_contents_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 	num = pdf_to_num(ctx, obj);
 	gen = pdf_to_gen(ctx, obj);
 	if (pdf_is_stream(ctx, doc, num, gen))
-		return pdf_open_image_stream(ctx, doc, num, gen, num, gen, NULL);
+		return pdf_open_contents_part(ctx, doc, num, gen);
 
 	fz_throw(ctx, FZ_ERROR_GENERIC, "pdf object stream missing (%d %d R)", num, gen);
 }
@@ -1829,9 +1829,9 @@ static void writexrefsubsect(fz_context *ctx, pdf_write_options *opts, int from,
 	for (num = from; num < to; num++)
 	{
 		if (opts->use_list[num])
-			fz_fprintf(ctx, opts->out, "%010Zd %05d n \n", opts->ofs_list[num], opts->gen_list[num]);
+			fz_fprintf(ctx, opts->out, "%010Zd %05d n \n", (fz_off_t)opts->ofs_list[num], opts->gen_list[num]);
 		else
-			fz_fprintf(ctx, opts->out, "%010Zd %05d f \n", opts->ofs_list[num], opts->gen_list[num]);
+			fz_fprintf(ctx, opts->out, "%010Zd %05d f \n", (fz_off_t)opts->ofs_list[num], opts->gen_list[num]);
 	}
 }
 
@@ -2052,7 +2052,7 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_option
 		pdf_update_stream(ctx, doc, dict, fzbuf, 0);
 
 		writeobject(ctx, doc, opts, num, 0, 0);
-		fz_fprintf(ctx, opts->out, "startxref\n%Zd\n%%%%EOF\n", startxref);
+		fz_fprintf(ctx, opts->out, "startxref\n%Zd\n%%%%EOF\n", (fz_off_t)startxref);
 	}
 	fz_always(ctx)
 	{
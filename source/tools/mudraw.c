@@ -12,6 +12,12 @@
 #include <sys/time.h>
 #endif
 
+#ifndef _WIN32
+#include <pthread.h>
+#define HAVE_THREADS
+#define MAX_THREADS 64
+#endif
+
 enum {
 	OUT_NONE,
 	OUT_PNG, OUT_TGA, OUT_PNM, OUT_PGM, OUT_PPM, OUT_PAM,
@@ -135,6 +141,7 @@ static int out_cs = CS_UNSET;
 static float gamma_value = 1;
 static int invert = 0;
 static int bandheight = 0;
+static int num_threads = 1;
 
 static int errored = 0;
 static int append = 0;
@@ -176,7 +183,8 @@ static void usage(void)
 		"\t-w -\twidth (in pixels) (maximum width if -r is specified)\n"
 		"\t-h -\theight (in pixels) (maximum height if -r is specified)\n"
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
-		"\t-B -\tmaximum bandheight (pgm, ppm, pam, png output only)\n"
+		"\t-B -\tmaximum bandheight (pgm, ppm, pam, png, pwg, pcl output only)\n"
+		"\t-T -\tnumber of threads to extract text with (txt output only)\n"
 		"\n"
 		"\t-W -\tpage width for EPUB layout\n"
 		"\t-H -\tpage height for EPUB layout\n"
@@ -325,7 +333,31 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		}
 	}
 
-	else if (output_format == OUT_TEXT || output_format == OUT_HTML || output_format == OUT_STEXT)
+	else if (output_format == OUT_TEXT)
+	{
+		fz_try(ctx)
+		{
+			dev = fz_new_text_output_device(ctx, sheet, out);
+			if (list)
+				fz_run_display_list(ctx, list, dev, &fz_identity, &fz_infinite_rect, &cookie);
+			else
+				fz_run_page(ctx, page, dev, &fz_identity, &cookie);
+			fz_printf(ctx, out, "\f\n");
+		}
+		fz_always(ctx)
+		{
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_display_list(ctx, list);
+			fz_drop_page(ctx, page);
+			fz_rethrow(ctx);
+		}
+	}
+
+	else if (output_format == OUT_HTML || output_format == OUT_STEXT)
 	{
 		fz_text_page *text = NULL;
 
@@ -352,11 +384,6 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				fz_analyze_text(ctx, sheet, text);
 				fz_print_text_page_html(ctx, out, text);
 			}
-			else if (output_format == OUT_TEXT)
-			{
-				fz_print_text_page(ctx, out, text);
-				fz_printf(ctx, out, "\f\n");
-			}
 		}
 		fz_always(ctx)
 		{
@@ -473,9 +500,12 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		int w, h;
 		fz_output *output_file = NULL;
 		fz_png_output_context *poc = NULL;
+		fz_pcl_output_context *pcloc = NULL;
+		fz_pcl_options pcl_options;
 
 		fz_var(pix);
 		fz_var(poc);
+		fz_var(pcloc);
 
 		fz_bound_page(ctx, page, &bounds);
 		zoom = resolution / 72;
@@ -564,6 +594,20 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			{
 				if (!strcmp(output, "-"))
 					output_file = fz_new_output_with_file(ctx, stdout, 0);
+				else if (output_format == OUT_PWG || output_format == OUT_PCL)
+				{
+					/* Successive pages are appended to the file,
+					 * unless each page has its own. */
+					FILE *file;
+
+					sprintf(filename_buf, output, pagenum);
+					if (has_percent_d(output))
+						append = 0;
+					file = fopen(filename_buf, append ? "ab" : "wb");
+					if (!file)
+						fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open file '%s': %s", filename_buf, strerror(errno));
+					output_file = fz_new_output_with_file(ctx, file, 1);
+				}
 				else
 				{
 					sprintf(filename_buf, output, pagenum);
@@ -576,6 +620,21 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 					fz_output_pam_header(ctx, output_file, pix->w, totalheight, pix->n, savealpha);
 				else if (output_format == OUT_PNG)
 					poc = fz_output_png_header(ctx, output_file, pix->w, totalheight, pix->n, savealpha);
+				else if (output_format == OUT_PWG)
+				{
+					if (!append)
+						fz_output_pwg_file_header(ctx, output_file);
+					if (out_cs == CS_MONO)
+						fz_output_pwg_bitmap_header(ctx, output_file, pix->w, totalheight, 1, pix->xres, pix->yres, NULL);
+					else
+						fz_output_pwg_page_header(ctx, output_file, pix->w, totalheight, pix->n, pix->xres, pix->yres, NULL);
+				}
+				else if (output_format == OUT_PCL)
+				{
+					fz_pcl_preset(ctx, &pcl_options, "ljet4");
+					pcloc = fz_output_pcl_bitmap_header(ctx, output_file, pix->w, totalheight, pix->xres, pix->yres, &pcl_options);
+				}
+				append = 1;
 			}
 
 			for (band = 0; band < bands; band++)
@@ -613,35 +672,20 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 						fz_output_png_band(ctx, output_file, pix->w, totalheight, pix->n, band, drawheight, pix->samples, savealpha, poc);
 					else if (output_format == OUT_PWG)
 					{
-						if (has_percent_d(output))
-							append = 0;
 						if (out_cs == CS_MONO)
 						{
-							fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
-							fz_write_pwg_bitmap(ctx, bit, filename_buf, append, NULL);
+							fz_bitmap *bit = fz_halftone_pixmap_band(ctx, pix, NULL, band * drawheight, totalheight - band * drawheight);
+							fz_output_pwg_bitmap_band(ctx, output_file, bit);
 							fz_drop_bitmap(ctx, bit);
 						}
 						else
-							fz_write_pwg(ctx, pix, filename_buf, append, NULL);
-						append = 1;
+							fz_output_pwg_band(ctx, output_file, pix->w, totalheight, pix->n, band, drawheight, pix->samples);
 					}
 					else if (output_format == OUT_PCL)
 					{
-						fz_pcl_options options;
-
-						fz_pcl_preset(ctx, &options, "ljet4");
-
-						if (has_percent_d(output))
-							append = 0;
-						if (out_cs == CS_MONO)
-						{
-							fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
-							fz_write_pcl_bitmap(ctx, bit, filename_buf, append, &options);
-							fz_drop_bitmap(ctx, bit);
-						}
-						else
-							fz_write_pcl(ctx, pix, filename_buf, append, &options);
-						append = 1;
+						fz_bitmap *bit = fz_halftone_pixmap_band(ctx, pix, NULL, band * drawheight, totalheight - band * drawheight);
+						fz_output_pcl_bitmap_band(ctx, output_file, bit, pcloc);
+						fz_drop_bitmap(ctx, bit);
 					}
 					else if (output_format == OUT_PBM) {
 						fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
@@ -673,6 +717,8 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			{
 				if (output_format == OUT_PNG)
 					fz_output_png_trailer(ctx, output_file, poc);
+				else if (output_format == OUT_PCL)
+					fz_output_pcl_bitmap_trailer(ctx, output_file, pcloc);
 			}
 
 			fz_drop_device(ctx, dev);
@@ -731,12 +777,279 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		errored = 1;
 }
 
+#ifdef HAVE_THREADS
+
+/*
+	Text output with several threads. The pages to draw are queued up,
+	and each thread opens the document for itself and takes the next
+	page from the queue. The text of each page is gathered in a buffer,
+	and the main thread writes the buffers out in page order. Threads
+	only run a few pages ahead of the output, to bound the memory held
+	in buffers.
+*/
+
+static pthread_mutex_t mutexes[FZ_LOCK_MAX];
+
+static void lock_mutex(void *user, int lock)
+{
+	pthread_mutex_lock(&mutexes[lock]);
+}
+
+static void unlock_mutex(void *user, int lock)
+{
+	pthread_mutex_unlock(&mutexes[lock]);
+}
+
+static fz_locks_context locks = { NULL, lock_mutex, unlock_mutex };
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *password;
+	int *pages;
+	int len, cap;
+	int next, written, abort, errors;
+	fz_buffer **text;
+	int *done; /* 0 pending, 1 done, -1 failed */
+} queue;
+
+static void queuepage(fz_context *ctx, int pagenum)
+{
+	if (queue.len == queue.cap)
+	{
+		int newcap = queue.cap ? queue.cap * 2 : 64;
+		queue.pages = fz_resize_array(ctx, queue.pages, newcap, sizeof(int));
+		queue.cap = newcap;
+	}
+	queue.pages[queue.len++] = pagenum;
+}
+
+static fz_buffer *textpage(fz_context *ctx, fz_document *doc, fz_text_sheet *tsheet, int pagenum)
+{
+	fz_page *page = NULL;
+	fz_buffer *buf = NULL;
+	fz_output *tout = NULL;
+	fz_device *dev = NULL;
+	fz_cookie cookie = { 0 };
+
+	fz_var(page);
+	fz_var(buf);
+	fz_var(tout);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		page = fz_load_page(ctx, doc, pagenum - 1);
+		buf = fz_new_buffer(ctx, 4096);
+		tout = fz_new_output_with_buffer(ctx, buf);
+		dev = fz_new_text_output_device(ctx, tsheet, tout);
+		fz_run_page(ctx, page, dev, &fz_identity, &cookie);
+		fz_printf(ctx, tout, "\f\n");
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_output(ctx, tout);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+	}
+
+	if (cookie.errors)
+	{
+		pthread_mutex_lock(&queue.lock);
+		queue.errors = 1;
+		pthread_mutex_unlock(&queue.lock);
+	}
+
+	return buf;
+}
+
+static void *textworker(void *arg)
+{
+	fz_context *ctx = arg;
+	fz_document *doc = NULL;
+	fz_text_sheet *tsheet = NULL;
+	fz_buffer *buf;
+	int i;
+
+	fz_var(doc);
+	fz_var(tsheet);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, filename);
+		if (fz_needs_password(ctx, doc))
+			if (!fz_authenticate_password(ctx, doc, queue.password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+		fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+		tsheet = fz_new_text_sheet(ctx);
+	}
+	fz_catch(ctx)
+	{
+		/* Every page this thread takes will fail */
+		fz_drop_document(ctx, doc);
+		doc = NULL;
+	}
+
+	pthread_mutex_lock(&queue.lock);
+	for (;;)
+	{
+		while (!queue.abort && queue.next < queue.len && queue.next >= queue.written + 2 * num_threads)
+			pthread_cond_wait(&queue.cond, &queue.lock);
+		if (queue.abort || queue.next >= queue.len)
+			break;
+		i = queue.next++;
+		pthread_mutex_unlock(&queue.lock);
+
+		buf = doc ? textpage(ctx, doc, tsheet, queue.pages[i]) : NULL;
+
+		pthread_mutex_lock(&queue.lock);
+		queue.text[i] = buf;
+		queue.done[i] = buf ? 1 : -1;
+		pthread_cond_broadcast(&queue.cond);
+	}
+	pthread_mutex_unlock(&queue.lock);
+
+	fz_drop_text_sheet(ctx, tsheet);
+	fz_drop_document(ctx, doc);
+	fz_flush_warnings(ctx);
+	return NULL;
+}
+
+static void drawqueue(fz_context *ctx)
+{
+	pthread_t threads[MAX_THREADS];
+	fz_context *contexts[MAX_THREADS];
+	fz_buffer *buf = NULL;
+	int started = 0;
+	int failed = 0;
+	int i;
+
+	fz_var(buf);
+	fz_var(started);
+
+	fz_try(ctx)
+	{
+		queue.next = queue.written = queue.abort = queue.errors = 0;
+		queue.text = fz_calloc(ctx, queue.len, sizeof(fz_buffer *));
+		queue.done = fz_calloc(ctx, queue.len, sizeof(int));
+
+		while (started < num_threads)
+		{
+			contexts[started] = fz_clone_context(ctx);
+			if (!contexts[started])
+				break;
+			if (pthread_create(&threads[started], NULL, textworker, contexts[started]))
+			{
+				fz_drop_context(contexts[started]);
+				break;
+			}
+			started++;
+		}
+		if (started == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start text threads");
+
+		for (i = 0; i < queue.len; i++)
+		{
+			pthread_mutex_lock(&queue.lock);
+			while (!queue.done[i])
+				pthread_cond_wait(&queue.cond, &queue.lock);
+			buf = queue.text[i];
+			queue.text[i] = NULL;
+			queue.written = i + 1;
+			pthread_cond_broadcast(&queue.cond);
+			pthread_mutex_unlock(&queue.lock);
+
+			if (!buf)
+			{
+				failed = queue.pages[i];
+				break;
+			}
+			fz_write(ctx, out, buf->data, buf->len);
+			fz_drop_buffer(ctx, buf);
+			buf = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pthread_mutex_lock(&queue.lock);
+		queue.abort = 1;
+		pthread_cond_broadcast(&queue.cond);
+		pthread_mutex_unlock(&queue.lock);
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
+			fz_drop_context(contexts[i]);
+		}
+
+		fz_drop_buffer(ctx, buf);
+		if (queue.text)
+			for (i = 0; i < queue.len; i++)
+				fz_drop_buffer(ctx, queue.text[i]);
+		fz_free(ctx, queue.text);
+		fz_free(ctx, queue.done);
+		queue.text = NULL;
+		queue.done = NULL;
+		queue.len = 0;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	if (queue.errors)
+		errored = 1;
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot draw page %d in file '%s'", failed, filename);
+}
+
+#endif
+
+static void dopage(fz_context *ctx, fz_document *doc, int pagenum)
+{
+#ifdef HAVE_THREADS
+	if (num_threads > 1)
+	{
+		queuepage(ctx, pagenum);
+		return;
+	}
+#endif
+	drawpage(ctx, doc, pagenum);
+}
+
+/* Reflowable documents may only estimate their page count until their
+ * pages have been laid out; loading the last page settles it. */
+static int count_pages(fz_context *ctx, fz_document *doc)
+{
+	int n = fz_count_pages(ctx, doc);
+	int last = -1;
+
+	if (!fz_is_document_reflowable(ctx, doc))
+		return n;
+
+	while (n > 0 && n != last)
+	{
+		fz_try(ctx)
+			fz_drop_page(ctx, fz_load_page(ctx, doc, n - 1));
+		fz_catch(ctx)
+			break; /* the page will fail again when it is drawn */
+		last = n;
+		n = fz_count_pages(ctx, doc);
+	}
+
+	return n;
+}
+
 static void drawrange(fz_context *ctx, fz_document *doc, char *range)
 {
 	int page, spage, epage, pagecount;
 	char *spec, *dash;
 
-	pagecount = fz_count_pages(ctx, doc);
+	pagecount = count_pages(ctx, doc);
 	spec = fz_strsep(&range, ",");
 	while (spec)
 	{
@@ -760,10 +1073,10 @@ static void drawrange(fz_context *ctx, fz_document *doc, char *range)
 
 		if (spage < epage)
 			for (page = spage; page <= epage; page++)
-				drawpage(ctx, doc, page);
+				dopage(ctx, doc, page);
 		else
 			for (page = spage; page >= epage; page--)
-				drawpage(ctx, doc, page);
+				dopage(ctx, doc, page);
 
 		spec = fz_strsep(&range, ",");
 	}
@@ -855,7 +1168,7 @@ int main(int argc, char **argv)
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "po:F:R:r:w:h:fB:c:G:I:s:A:DiW:H:S:v")) != -1)
+	while ((c = fz_getopt(argc, argv, "po:F:R:r:w:h:fB:T:c:G:I:s:A:DiW:H:S:v")) != -1)
 	{
 		switch (c)
 		{
@@ -872,6 +1185,11 @@ int main(int argc, char **argv)
 		case 'h': height = atof(fz_optarg); break;
 		case 'f': fit = 1; break;
 		case 'B': bandheight = atoi(fz_optarg); break;
+#ifdef HAVE_THREADS
+		case 'T': num_threads = fz_clampi(atoi(fz_optarg), 1, MAX_THREADS); break;
+#else
+		case 'T': fprintf(stderr, "Threads are not supported in this build; ignoring -T\n"); break;
+#endif
 
 		case 'c': out_cs = parse_colorspace(fz_optarg); break;
 		case 'G': gamma_value = atof(fz_optarg); break;
@@ -899,6 +1217,18 @@ int main(int argc, char **argv)
 	if (fz_optind == argc)
 		usage();
 
+#ifdef HAVE_THREADS
+	if (num_threads > 1)
+	{
+		for (c = 0; c < FZ_LOCK_MAX; c++)
+			pthread_mutex_init(&mutexes[c], NULL);
+		pthread_mutex_init(&queue.lock, NULL);
+		pthread_cond_init(&queue.cond, NULL);
+		queue.password = password;
+		ctx = fz_new_context((showmemory == 0 ? NULL : &alloc_ctx), &locks, FZ_STORE_DEFAULT);
+	}
+	else
+#endif
 	ctx = fz_new_context((showmemory == 0 ? NULL : &alloc_ctx), NULL, FZ_STORE_DEFAULT);
 	if (!ctx)
 	{
@@ -954,9 +1284,9 @@ int main(int argc, char **argv)
 
 	if (bandheight)
 	{
-		if (output_format != OUT_PAM && output_format != OUT_PGM && output_format != OUT_PPM && output_format != OUT_PNM && output_format != OUT_PNG)
+		if (output_format != OUT_PAM && output_format != OUT_PGM && output_format != OUT_PPM && output_format != OUT_PNM && output_format != OUT_PNG && output_format != OUT_PWG && output_format != OUT_PCL)
 		{
-			fprintf(stderr, "Banded operation only possible with PAM, PGM, PPM, PNM and PNG outputs\n");
+			fprintf(stderr, "Banded operation only possible with PAM, PGM, PPM, PNM, PNG, PWG and PCL outputs\n");
 			exit(1);
 		}
 		if (showmd5)
@@ -966,6 +1296,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Text is written out as it is extracted; a display list would only
+	 * hold on to the whole page. */
+	if (output_format == OUT_TEXT)
+		uselist = 0;
+
+	if (num_threads > 1 && output_format != OUT_TEXT)
+	{
+		fprintf(stderr, "Multiple threads only possible with text output\n");
+		exit(1);
+	}
+	if (num_threads > 1 && (showtime || showfeatures || showmd5))
+	{
+		fprintf(stderr, "Multiple threads not compatible with timings, features or MD5\n");
+		exit(1);
+	}
+
 	{
 		int i, j;
 
@@ -1082,6 +1428,10 @@ int main(int argc, char **argv)
 					drawrange(ctx, doc, "1-");
 				if (fz_optind < argc && isrange(argv[fz_optind]))
 					drawrange(ctx, doc, argv[fz_optind++]);
+#ifdef HAVE_THREADS
+				if (num_threads > 1)
+					drawqueue(ctx);
+#endif
 
 				if (output_format == OUT_STEXT || output_format == OUT_TRACE)
 					fz_printf(ctx, out, "</document>\n");
@@ -1126,6 +1476,9 @@ int main(int argc, char **argv)
 	fz_drop_text_sheet(ctx, sheet);
 	fz_drop_output(ctx, out);
 	out = NULL;
+#ifdef HAVE_THREADS
+	fz_free(ctx, queue.pages);
+#endif
 
 	if (showtime && timing.count > 0)
 	{
@@ -1147,6 +1500,16 @@ int main(int argc, char **argv)
 
 	fz_drop_context(ctx);
 
+#ifdef HAVE_THREADS
+	if (num_threads > 1)
+	{
+		for (c = 0; c < FZ_LOCK_MAX; c++)
+			pthread_mutex_destroy(&mutexes[c]);
+		pthread_mutex_destroy(&queue.lock);
+		pthread_cond_destroy(&queue.cond);
+	}
+#endif
+
 	if (showmemory)
 	{
 #if defined(_WIN64)
@@ -0,0 +1,322 @@
+/*
+ * Index tool.
+ * Build a full-text index of a document, or search one.
+ */
+
+#include "mupdf/fitz.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#define HAVE_THREADS
+#endif
+
+#define MAX_THREADS 64
+#define MAX_HITS 500
+
+static void
+indexusage(void)
+{
+	fprintf(stderr,
+		"usage: mutool index [options] input [output.idx]\n"
+		"\t-p -\tpassword for decryption\n"
+		"\t-j -\tnumber of threads to extract text with (default 1)\n"
+		"usage: mutool index -s text input.idx\n"
+		"\t-s -\tsearch the index for a word or phrase and print\n"
+		"\t\tthe page number and bbox of each hit\n"
+		);
+	exit(1);
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	const char *filename;
+	const char *password;
+	fz_text_index *index;
+	int first, step;
+	int failed;
+#ifdef HAVE_THREADS
+	pthread_t thread;
+	pthread_mutex_t *index_lock;
+#endif
+} index_worker;
+
+static void
+index_page(fz_context *ctx, index_worker *w, fz_document *doc, fz_text_sheet *sheet, int number)
+{
+	fz_page *page = NULL;
+	fz_text_page *text = NULL;
+	fz_device *dev = NULL;
+
+	fz_var(page);
+	fz_var(text);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		page = fz_load_page(ctx, doc, number);
+		/* Loading a page settles an estimated page count, which
+		 * may turn out to end before this page */
+		if (number >= fz_count_pages(ctx, doc))
+			break;
+		text = fz_new_text_page(ctx);
+		dev = fz_new_text_device(ctx, sheet, text);
+		fz_run_page(ctx, page, dev, &fz_identity, NULL);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+
+#ifdef HAVE_THREADS
+		if (w->index_lock)
+			pthread_mutex_lock(w->index_lock);
+#endif
+		fz_try(ctx)
+		{
+			fz_index_text_page(ctx, w->index, number, text);
+		}
+		fz_always(ctx)
+		{
+#ifdef HAVE_THREADS
+			if (w->index_lock)
+				pthread_mutex_unlock(w->index_lock);
+#endif
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_text_page(ctx, text);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot index page %d", number + 1);
+	}
+}
+
+/* Each worker opens the document for itself, and indexes every step'th page. */
+static void *
+index_pages(void *arg)
+{
+	index_worker *w = arg;
+	fz_context *ctx = w->ctx;
+	fz_document *doc = NULL;
+	fz_text_sheet *sheet = NULL;
+	int i;
+
+	fz_var(doc);
+	fz_var(sheet);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, w->filename);
+		if (fz_needs_password(ctx, doc))
+			if (!fz_authenticate_password(ctx, doc, w->password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", w->filename);
+		sheet = fz_new_text_sheet(ctx);
+		/* Reflowable documents refine their page count as pages are laid out */
+		for (i = w->first; i < fz_count_pages(ctx, doc); i += w->step)
+			index_page(ctx, w, doc, sheet, i);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_text_sheet(ctx, sheet);
+		fz_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		w->failed = 1;
+	}
+
+	return NULL;
+}
+
+#ifdef HAVE_THREADS
+static void
+lock_mutex(void *user, int lock)
+{
+	pthread_mutex_lock(&((pthread_mutex_t *)user)[lock]);
+}
+
+static void
+unlock_mutex(void *user, int lock)
+{
+	pthread_mutex_unlock(&((pthread_mutex_t *)user)[lock]);
+}
+#endif
+
+static int
+build_index(const char *filename, const char *password, const char *output, int nthreads)
+{
+	index_worker workers[MAX_THREADS];
+	fz_context *ctx;
+	fz_text_index *index = NULL;
+	int failed = 0;
+	int i;
+#ifdef HAVE_THREADS
+	pthread_mutex_t mutexes[FZ_LOCK_MAX];
+	pthread_mutex_t index_lock;
+	fz_locks_context locks;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_init(&mutexes[i], NULL);
+	pthread_mutex_init(&index_lock, NULL);
+	locks.user = mutexes;
+	locks.lock = lock_mutex;
+	locks.unlock = unlock_mutex;
+
+	ctx = fz_new_context(NULL, nthreads > 1 ? &locks : NULL, FZ_STORE_DEFAULT);
+#else
+	nthreads = 1;
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+#endif
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_var(index);
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		index = fz_new_text_index(ctx);
+
+		memset(workers, 0, sizeof workers);
+		for (i = 0; i < nthreads; i++)
+		{
+			workers[i].filename = filename;
+			workers[i].password = password;
+			workers[i].index = index;
+			workers[i].first = i;
+			workers[i].step = nthreads;
+		}
+
+#ifdef HAVE_THREADS
+		if (nthreads > 1)
+		{
+			int started;
+			for (started = 0; started < nthreads; started++)
+			{
+				workers[started].index_lock = &index_lock;
+				workers[started].ctx = fz_clone_context(ctx);
+				if (!workers[started].ctx || pthread_create(&workers[started].thread, NULL, index_pages, &workers[started]))
+				{
+					fz_drop_context(workers[started].ctx);
+					break;
+				}
+			}
+			for (i = 0; i < started; i++)
+			{
+				pthread_join(workers[i].thread, NULL);
+				fz_drop_context(workers[i].ctx);
+			}
+			if (started < nthreads)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start index threads");
+		}
+		else
+#endif
+		{
+			workers[0].ctx = ctx;
+			index_pages(&workers[0]);
+		}
+
+		for (i = 0; i < nthreads; i++)
+			if (workers[i].failed)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot index document: %s", filename);
+
+		fz_save_text_index(ctx, index, output);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_text_index(ctx, index);
+	}
+	fz_catch(ctx)
+	{
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+
+#ifdef HAVE_THREADS
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_destroy(&mutexes[i]);
+	pthread_mutex_destroy(&index_lock);
+#endif
+
+	return failed;
+}
+
+static int
+search_index(const char *filename, const char *needle)
+{
+	fz_text_index_hit hits[MAX_HITS];
+	fz_text_index *index = NULL;
+	fz_context *ctx;
+	int failed = 0;
+	int i, n;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_var(index);
+
+	fz_try(ctx)
+	{
+		index = fz_open_text_index(ctx, filename);
+		n = fz_search_text_index(ctx, index, needle, hits, nelem(hits));
+		for (i = 0; i < n; i++)
+			printf("%d %g %g %g %g\n", hits[i].page + 1,
+				hits[i].rect.x0, hits[i].rect.y0, hits[i].rect.x1, hits[i].rect.y1);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_text_index(ctx, index);
+	}
+	fz_catch(ctx)
+	{
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed;
+}
+
+int muindex_main(int argc, char **argv)
+{
+	char *password = "";
+	char *needle = NULL;
+	char *output = "out.idx";
+	int nthreads = 1;
+	int c;
+
+	while ((c = fz_getopt(argc, argv, "p:j:s:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p': password = fz_optarg; break;
+		case 'j': nthreads = fz_clampi(atoi(fz_optarg), 1, MAX_THREADS); break;
+		case 's': needle = fz_optarg; break;
+		default: indexusage(); break;
+		}
+	}
+
+	if (fz_optind == argc)
+		indexusage();
+
+	if (needle)
+		return search_index(argv[fz_optind], needle);
+
+	if (fz_optind + 1 < argc)
+		output = argv[fz_optind + 1];
+
+	return build_index(argv[fz_optind], password, output, nthreads);
+}
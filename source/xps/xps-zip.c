@@ -33,6 +33,37 @@ xps_drop_part(fz_context *ctx, xps_document *doc, xps_part *part)
 	fz_free(ctx, part);
 }
 
+/*
+ * Append a zip entry to a buffer, decompressing it straight into place.
+ */
+static void
+xps_append_piece(fz_context *ctx, fz_archive *zip, fz_buffer *buf, char *name)
+{
+	fz_stream *stm;
+	int n;
+
+	stm = fz_open_archive_entry(ctx, zip, name);
+	fz_try(ctx)
+	{
+		do
+		{
+			if (buf->len == buf->cap)
+				fz_grow_buffer(ctx, buf);
+			n = fz_read(ctx, stm, buf->data + buf->len, buf->cap - buf->len);
+			buf->len += n;
+		}
+		while (n > 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 /*
  * Read and interleave split parts from a ZIP file.
  */
@@ -40,7 +71,7 @@ xps_part *
 xps_read_part(fz_context *ctx, xps_document *doc, char *partname)
 {
 	fz_archive *zip = doc->zip;
-	fz_buffer *buf, *tmp;
+	fz_buffer *buf;
 	char path[2048];
 	unsigned char *data;
 	int size;
@@ -58,37 +89,31 @@ xps_read_part(fz_context *ctx, xps_document *doc, char *partname)
 		buf = fz_read_archive_entry(ctx, zip, name);
 	}
 
-	/* Assemble all the pieces */
+	/* Assemble all the pieces, one after another, in a single buffer */
 	else
 	{
 		buf = fz_new_buffer(ctx, 512);
-		seen_last = 0;
-		for (count = 0; !seen_last; ++count)
+		fz_try(ctx)
 		{
-			sprintf(path, "%s/[%d].piece", name, count);
-			if (fz_has_archive_entry(ctx, zip, path))
+			seen_last = 0;
+			for (count = 0; !seen_last; ++count)
 			{
-				tmp = fz_read_archive_entry(ctx, zip, path);
-				fz_buffer_cat(ctx, buf, tmp);
-				fz_drop_buffer(ctx, tmp);
-			}
-			else
-			{
-				sprintf(path, "%s/[%d].last.piece", name, count);
-				if (fz_has_archive_entry(ctx, zip, path))
+				sprintf(path, "%s/[%d].piece", name, count);
+				if (!fz_has_archive_entry(ctx, zip, path))
 				{
-					tmp = fz_read_archive_entry(ctx, zip, path);
-					fz_buffer_cat(ctx, buf, tmp);
-					fz_drop_buffer(ctx, tmp);
+					sprintf(path, "%s/[%d].last.piece", name, count);
+					if (!fz_has_archive_entry(ctx, zip, path))
+						fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find all pieces for part '%s'", partname);
 					seen_last = 1;
 				}
-				else
-				{
-					fz_drop_buffer(ctx, buf);
-					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find all pieces for part '%s'", partname);
-				}
+				xps_append_piece(ctx, zip, buf, path);
 			}
 		}
+		fz_catch(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_rethrow(ctx);
+		}
 	}
 
 	fz_write_buffer_byte(ctx, buf, 0); /* zero-terminate */